@@ -0,0 +1,958 @@
+/*
+
+Offline Analysis for EEPROM Control
+
+Takes the place of pasting "board N data.csv" into processed.xlsx by hand.
+Any number of logs from any number of boards, either the old data.csv files or
+binary event logs, go in; per chip and per bank upset rates with Poisson
+confidence intervals and a cumulative upset curve per board come out:
+
+    ./analyze "Collected Data/data/"*.csv
+    ./analyze --bin 300 --out beam "board 3 events.bin" "board 5 events.bin"
+
+    beam chips.csv   Board, Bank, EEPROM, Exposure (h), Flips, Stuck, Misreads, Rate (/h), Lower, Upper, Rate (/Mbit/h)
+    beam banks.csv   Board, Bank, Exposure (h), Flips, Rate (/h), Lower, Upper
+    beam curve.csv   Board, Time (s), Flips, Cumulative Flips
+
+plus the bank table on stdout. Exposure is how long each chip was actually
+being scanned, added up over every run in the logs, and the curve puts a
+board's runs end to end on that axis.
+
+Every file is cut into ANALYZE_CHUNK pieces (on record or line boundaries)
+and a pool of threads aggregates the pieces independently - a piece that
+starts in the middle of a run just says so, and gets stitched onto the run
+it belongs to when the pieces are merged back in order. Only a few pieces per
+thread can be waiting to be merged at once, so memory stays flat however big
+the logs are.
+
+A binary log's flips are the bits in its EV_FLIP records (misreads and the
+stuck count come along too), and a fleet log counts for every board in it. data.csv only has the running failure count per
+chip, so there the flips are how much that went up.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "evlog.h"
+#include "topology.h"
+
+// Bytes of a file one thread takes at a time
+#define ANALYZE_CHUNK (16 << 20)
+
+// Longest CSV line we expect, a piece reads this far past its end to finish its last line
+#define ANALYZE_LINE 4096
+
+// Chips are kept by bank and EEPROM number (address - EEPROM_ADDRESS)
+#define ANALYZE_ADDR_BASE 0x50
+#define ANALYZE_EEPROMS 128
+#define ANALYZE_SLOTS (TOPO_MAX_BANKS * ANALYZE_EEPROMS)
+
+// Default curve resolution - override with --bin
+#define ANALYZE_BIN_SEC 60
+
+// Default confidence level - override with --confidence
+#define ANALYZE_CONFIDENCE 0.95
+
+// Pieces per thread that can be finished but not merged yet
+#define ANALYZE_AHEAD 4
+
+// Most boards one fleet log can have in it
+#define ANALYZE_FLEET_BOARDS 64
+
+// Per bin values, v[i] is bin first + i
+typedef struct {
+    int first;
+    int n;
+    int cap;
+    int64_t* v;
+} binSeries;
+
+typedef struct {
+    int64_t flips;        // binary: bits that flipped. csv: highest failure count
+    int64_t stuck;
+    int64_t misreads;
+    binSeries bins;       // same thing per curve bin (csv: the highest count by then)
+} chipAgg;
+
+// One run, or the part of one run that was in a piece
+typedef struct fragment {
+    int board;
+    bool continues;       // the run started in an earlier piece
+    bool cumulative;      // csv - values are running counts, not new flips
+    double maxSec;        // latest time in it, how long the run went for
+    chipAgg* chips[ANALYZE_SLOTS]; // NULL = nothing from that chip
+    struct fragment* next;
+} fragment;
+
+typedef struct {
+    const char* path;
+    int board;
+    bool binary;
+    long dataStart;       // first record (binary) or byte (csv)
+    long size;
+} inputFile;
+
+typedef struct {
+    int file;
+    long start;
+    long end;
+    fragment* frags;      // what it found, in order
+    bool done;
+} workUnit;
+
+typedef struct {
+    bool seen;
+    double exposureSec;
+    int64_t flips;
+    int64_t stuck;
+    int64_t misreads;
+} chipTotal;
+
+typedef struct {
+    int board;
+    double exposureSec;
+    int runs;
+    chipTotal chips[ANALYZE_SLOTS];
+    binSeries curve;      // new flips per bin, runs end to end
+    fragment* pending;    // the run being stitched back together, it might go on in the next piece
+} boardAgg;
+
+typedef struct {
+    inputFile* files;
+    int numFiles;
+    workUnit* units;
+    int numUnits;
+    int binSec;
+    int window;           // units that can be ahead of the merge
+    int next;             // next unit a worker takes
+    int merged;           // units merged so far
+    bool failed;          // a worker couldn't get its buffer, the results would be missing pieces
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} analysis;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// slot for bin, grown (with zeros) to fit. NULL if out of memory
+static int64_t* binAt(binSeries* series, int bin) {
+    if (series->n == 0) {
+        series->first = bin;
+    }
+
+    int lo = bin < series->first ? bin : series->first;
+    int hi = bin >= series->first + series->n ? bin + 1 : series->first + series->n;
+
+    if (hi - lo > series->cap) {
+        int cap = series->cap > 0 ? series->cap : 16;
+
+        while (cap < hi - lo) {
+            cap *= 2;
+        }
+
+        int64_t* v = (int64_t*) realloc(series->v, cap * sizeof(int64_t));
+
+        if (v == NULL) {
+            return NULL;
+        }
+
+        series->v = v;
+        series->cap = cap;
+    }
+
+    // growing down means moving what's there up
+    if (lo < series->first) {
+        memmove(series->v + (series->first - lo), series->v, series->n * sizeof(int64_t));
+        memset(series->v, 0, (series->first - lo) * sizeof(int64_t));
+        series->n += series->first - lo;
+        series->first = lo;
+    }
+
+    if (hi > series->first + series->n) {
+        memset(series->v + series->n, 0, (hi - series->first - series->n) * sizeof(int64_t));
+        series->n = hi - series->first;
+    }
+
+    return &series->v[bin - series->first];
+}
+
+static fragment* fragmentNew(fragment** list, int board, bool continues, bool cumulative) {
+    fragment* frag = (fragment*) calloc(1, sizeof(fragment));
+
+    if (frag == NULL) {
+        return NULL;
+    }
+
+    frag->board = board;
+    frag->continues = continues;
+    frag->cumulative = cumulative;
+
+    while (*list != NULL) {
+        list = &(*list)->next;
+    }
+
+    *list = frag;
+
+    return frag;
+}
+
+static void fragmentFree(fragment* frag) {
+    for (int s = 0; s < ANALYZE_SLOTS; s++) {
+        if (frag->chips[s] != NULL) {
+            free(frag->chips[s]->bins.v);
+            free(frag->chips[s]);
+        }
+    }
+
+    free(frag);
+}
+
+static chipAgg* fragmentChip(fragment* frag, int bank, int eeprom) {
+    if (bank < 0 || bank >= TOPO_MAX_BANKS || eeprom < 0 || eeprom >= ANALYZE_EEPROMS) {
+        return NULL;
+    }
+
+    chipAgg** chip = &frag->chips[bank * ANALYZE_EEPROMS + eeprom];
+
+    if (*chip == NULL) {
+        *chip = (chipAgg*) calloc(1, sizeof(chipAgg));
+    }
+
+    return *chip;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+Event log records in [start, end). Anything before the first EV_START in the
+piece belongs to a run an earlier piece started. A fleet log has every board's
+runs mixed together, so each board has its own run going.
+*/
+static void scanBinary(analysis* an, workUnit* unit, int fd, uint8_t* buf) {
+    ssize_t got = pread(fd, buf, unit->end - unit->start, unit->start);
+    int fileBoard = an->files[unit->file].board;
+    fragment* running[ANALYZE_FLEET_BOARDS];
+    int runningBoard[ANALYZE_FLEET_BOARDS];
+    int numRunning = 0;
+    double binNs = an->binSec * 1e9;
+
+    for (ssize_t at = 0; at + (ssize_t) sizeof(evlogRecord) <= got; at += sizeof(evlogRecord)) {
+        evlogRecord rec;
+
+        memcpy(&rec, buf + at, sizeof(rec));
+
+        int board = fileBoard == EVLOG_FLEET ? rec.board : fileBoard;
+        int k = 0;
+
+        while (k < numRunning && runningBoard[k] != board) {
+            k++;
+        }
+
+        if (k == numRunning) {
+            if (numRunning == ANALYZE_FLEET_BOARDS) {
+                continue;
+            }
+
+            runningBoard[numRunning] = board;
+            running[numRunning++] = NULL;
+        }
+
+        if (rec.kind == EV_START) {
+            running[k] = fragmentNew(&unit->frags, board, false, false);
+            continue;
+        }
+
+        if (running[k] == NULL && (running[k] = fragmentNew(&unit->frags, board, true, false)) == NULL) {
+            return;
+        }
+
+        fragment* frag = running[k];
+
+        frag->maxSec = rec.ns / 1e9 > frag->maxSec ? rec.ns / 1e9 : frag->maxSec;
+
+        // a pass marker isn't about any one chip
+        if (rec.kind == EV_PASS) {
+            continue;
+        }
+
+        chipAgg* chip = fragmentChip(frag, rec.bank, rec.eeprom);
+
+        if (chip == NULL) {
+            continue;
+        }
+
+        if (rec.kind == EV_FLIP) {
+            int bits = __builtin_popcount(rec.mask);
+            int64_t* bin = binAt(&chip->bins, (int) (rec.ns / binNs));
+
+            chip->flips += bits;
+            chip->stuck += __builtin_popcount(rec.mask & rec.count);
+
+            if (bin != NULL) {
+                *bin += bits;
+            }
+        } else if (rec.kind == EV_MISREAD) {
+            chip->misreads += __builtin_popcount(rec.mask);
+        }
+    }
+}
+
+/*
+Lines that start in [start, end). The one that starts before it belongs to
+the previous piece, and the last one can run past the end.
+*/
+static void scanCsv(analysis* an, workUnit* unit, int fd, char* buf) {
+    long from = unit->start > 0 ? unit->start - 1 : 0;
+    ssize_t got = pread(fd, buf, unit->end - from + ANALYZE_LINE, from);
+    fragment* frag = NULL;
+
+    if (got <= 0) {
+        return;
+    }
+
+    buf[got] = '\0';
+
+    char* line = buf;
+    char* stop = buf + (unit->end - from);
+
+    if (unit->start > 0) {
+        char* nl = strchr(buf, '\n');
+
+        line = nl != NULL ? nl + 1 : buf + got;
+    }
+
+    while (line < stop && *line != '\0') {
+        char* nl = strchr(line, '\n');
+        char* end;
+
+        if (nl == NULL) {
+            nl = buf + got;
+        }
+
+        if (line[0] == 'E') {
+            // "Elapsed Time, ..." starts a run
+            frag = fragmentNew(&unit->frags, an->files[unit->file].board, false, true);
+        } else {
+            long elapsed = strtol(line, &end, 10);
+            long bank = end[0] == ',' ? strtol(end + 1, &end, 10) : -1;
+            long eeprom = end[0] == ',' ? strtol(end + 1, &end, 10) : -1;
+            long failures = end[0] == ',' ? strtol(end + 1, &end, 10) : -1;
+
+            if (failures >= 0 && (frag != NULL || (frag = fragmentNew(&unit->frags, an->files[unit->file].board, true, true)) != NULL)) {
+                chipAgg* chip = fragmentChip(frag, (int) bank, (int) eeprom);
+
+                frag->maxSec = elapsed > frag->maxSec ? elapsed : frag->maxSec;
+
+                if (chip != NULL) {
+                    int64_t* bin = binAt(&chip->bins, (int) (elapsed / an->binSec));
+
+                    chip->flips = failures > chip->flips ? failures : chip->flips;
+
+                    if (bin != NULL && failures > *bin) {
+                        *bin = failures;
+                    }
+                }
+            }
+        }
+
+        line = nl + 1;
+    }
+}
+
+static void* worker(void* arg) {
+    analysis* an = (analysis*) arg;
+    char* buf = (char*) malloc(ANALYZE_CHUNK + ANALYZE_LINE + 2);
+    int openFile = -1;
+    int fd = -1;
+
+    // nobody else would pick up the pieces it took, so the merge would wait on them forever
+    if (buf == NULL) {
+        pthread_mutex_lock(&an->lock);
+        an->failed = true;
+        pthread_cond_broadcast(&an->changed);
+        pthread_mutex_unlock(&an->lock);
+
+        return NULL;
+    }
+
+    while (true) {
+        pthread_mutex_lock(&an->lock);
+
+        // don't get too far ahead of the merge, that's what keeps memory flat
+        while (!an->failed && an->next < an->numUnits && an->next >= an->merged + an->window) {
+            pthread_cond_wait(&an->changed, &an->lock);
+        }
+
+        int i = !an->failed && an->next < an->numUnits ? an->next++ : -1;
+
+        pthread_mutex_unlock(&an->lock);
+
+        if (i < 0) {
+            break;
+        }
+
+        workUnit* unit = &an->units[i];
+
+        if (unit->file != openFile) {
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            fd = open(an->files[unit->file].path, O_RDONLY);
+            openFile = unit->file;
+        }
+
+        if (fd >= 0 && an->files[unit->file].binary) {
+            scanBinary(an, unit, fd, (uint8_t*) buf);
+        } else if (fd >= 0) {
+            scanCsv(an, unit, fd, buf);
+        }
+
+        pthread_mutex_lock(&an->lock);
+        unit->done = true;
+        pthread_cond_broadcast(&an->changed);
+        pthread_mutex_unlock(&an->lock);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    free(buf);
+
+    return NULL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// the rest of a run from a later piece
+static void fragmentMerge(fragment* into, fragment* from) {
+    into->maxSec = from->maxSec > into->maxSec ? from->maxSec : into->maxSec;
+
+    for (int s = 0; s < ANALYZE_SLOTS; s++) {
+        chipAgg* src = from->chips[s];
+
+        if (src == NULL) {
+            continue;
+        }
+
+        if (into->chips[s] == NULL) {
+            into->chips[s] = src;
+            from->chips[s] = NULL;
+            continue;
+        }
+
+        chipAgg* dst = into->chips[s];
+
+        dst->flips = into->cumulative ? (src->flips > dst->flips ? src->flips : dst->flips) : dst->flips + src->flips;
+        dst->stuck += src->stuck;
+        dst->misreads += src->misreads;
+
+        for (int b = 0; b < src->bins.n; b++) {
+            int64_t* bin = binAt(&dst->bins, src->bins.first + b);
+
+            if (bin != NULL) {
+                *bin = into->cumulative ? (src->bins.v[b] > *bin ? src->bins.v[b] : *bin) : *bin + src->bins.v[b];
+            }
+        }
+    }
+}
+
+static boardAgg* findBoard(boardAgg** boards, int* numBoards, int board) {
+    for (int i = 0; i < *numBoards; i++) {
+        if ((*boards)[i].board == board) {
+            return &(*boards)[i];
+        }
+    }
+
+    boardAgg* grown = (boardAgg*) realloc(*boards, (*numBoards + 1) * sizeof(boardAgg));
+
+    if (grown == NULL) {
+        return NULL;
+    }
+
+    *boards = grown;
+    memset(&grown[*numBoards], 0, sizeof(boardAgg));
+    grown[*numBoards].board = board;
+
+    return &grown[(*numBoards)++];
+}
+
+/*
+A whole run goes onto the end of its board: exposure for every chip that
+showed up in it, and its flips onto the curve after the board's earlier runs
+*/
+static void finishRun(analysis* an, boardAgg* board, fragment* run) {
+    int offset = (int) (board->exposureSec / an->binSec);
+
+    for (int s = 0; s < ANALYZE_SLOTS; s++) {
+        chipAgg* chip = run->chips[s];
+        chipTotal* total = &board->chips[s];
+
+        if (chip == NULL) {
+            continue;
+        }
+
+        total->seen = true;
+        total->exposureSec += run->maxSec;
+        total->flips += chip->flips;
+        total->stuck += chip->stuck;
+        total->misreads += chip->misreads;
+
+        int64_t highest = 0;
+
+        for (int b = 0; b < chip->bins.n; b++) {
+            int64_t count = chip->bins.v[b];
+
+            // running counts -> how much it went up in that bin
+            if (run->cumulative) {
+                count = chip->bins.v[b] > highest ? chip->bins.v[b] - highest : 0;
+                highest = chip->bins.v[b] > highest ? chip->bins.v[b] : highest;
+            }
+
+            int64_t* bin = count > 0 ? binAt(&board->curve, offset + chip->bins.first + b) : NULL;
+
+            if (bin != NULL) {
+                *bin += count;
+            }
+        }
+    }
+
+    board->exposureSec += run->maxSec;
+    board->runs++;
+
+    // the curve covers all of the exposure, quiet stretches too
+    binAt(&board->curve, 0);
+    binAt(&board->curve, (int) (board->exposureSec / an->binSec));
+}
+
+// every board's run so far is as long as it's going to get
+static void finishPending(analysis* an, boardAgg* boards, int numBoards) {
+    for (int i = 0; i < numBoards; i++) {
+        if (boards[i].pending != NULL) {
+            finishRun(an, &boards[i], boards[i].pending);
+            fragmentFree(boards[i].pending);
+            boards[i].pending = NULL;
+        }
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// regularized lower incomplete gamma P(a, x), series below a + 1 and continued fraction above
+static double gammaP(double a, double x) {
+    if (x <= 0) {
+        return 0;
+    }
+
+    double lead = exp(-x + a * log(x) - lgamma(a));
+
+    if (x < a + 1) {
+        double term = 1 / a;
+        double sum = term;
+
+        for (int n = 1; n < 1000 && term > sum * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+
+        return sum * lead;
+    }
+
+    double b = x + 1 - a;
+    double c = 1e300;
+    double d = 1 / b;
+    double h = d;
+
+    for (int n = 1; n < 1000; n++) {
+        double an = -n * (n - a);
+
+        b += 2;
+        d = an * d + b;
+        d = fabs(d) < 1e-300 ? 1e-300 : d;
+        c = b + an / c;
+        c = fabs(c) < 1e-300 ? 1e-300 : c;
+        d = 1 / d;
+        h *= d * c;
+
+        if (fabs(d * c - 1) < 1e-15) {
+            break;
+        }
+    }
+
+    return 1 - lead * h;
+}
+
+// x with P(a, x) = p
+static double gammaInv(double p, double a) {
+    double lo = 0;
+    double hi = a + 50 * sqrt(a) + 50;
+
+    for (int i = 0; i < 200; i++) {
+        double mid = (lo + hi) / 2;
+
+        if (gammaP(a, mid) < p) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo + hi) / 2;
+}
+
+// Exact (Garwood) interval for a Poisson count, in counts
+static void poissonInterval(int64_t count, double confidence, double* lower, double* upper) {
+    double alpha = 1 - confidence;
+
+    *lower = count > 0 ? gammaInv(alpha / 2, (double) count) : 0;
+    *upper = gammaInv(1 - alpha / 2, (double) count + 1);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static FILE* openOutput(const char* prefix, const char* name) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s %s", prefix, name);
+
+    FILE* out = fopen(path, "w");
+
+    if (out == NULL) {
+        printf("Failed to open %s\n", path);
+    }
+
+    return out;
+}
+
+static void writeResults(boardAgg* boards, int numBoards, const char* prefix, int binSec, double confidence, const boardTopology* topo) {
+    FILE* chips = openOutput(prefix, "chips.csv");
+    FILE* banks = openOutput(prefix, "banks.csv");
+    FILE* curve = openOutput(prefix, "curve.csv");
+
+    if (chips == NULL || banks == NULL || curve == NULL) {
+        return;
+    }
+
+    fprintf(chips, "Board, Bank, EEPROM, Exposure (h), Flips, Stuck, Misreads, Rate (/h), Lower, Upper, Rate (/Mbit/h)\n");
+    fprintf(banks, "Board, Bank, Exposure (h), Flips, Rate (/h), Lower, Upper\n");
+    fprintf(curve, "Board, Time (s), Flips, Cumulative Flips\n");
+    printf("Board Bank  Chips  Exposure (h)    Flips   Rate (/h)   %.0f%% interval\n", confidence * 100);
+
+    for (int i = 0; i < numBoards; i++) {
+        boardAgg* board = &boards[i];
+
+        for (int bank = 0; bank < TOPO_MAX_BANKS; bank++) {
+            double bankHours = 0;
+            int64_t bankFlips = 0;
+            int bankChips = 0;
+
+            for (int e = 0; e < ANALYZE_EEPROMS; e++) {
+                chipTotal* total = &board->chips[bank * ANALYZE_EEPROMS + e];
+
+                if (!total->seen) {
+                    continue;
+                }
+
+                double hours = total->exposureSec / 3600;
+                double lower, upper;
+                int found = topologyFind(topo, bank, ANALYZE_ADDR_BASE + e);
+
+                poissonInterval(total->flips, confidence, &lower, &upper);
+                fprintf(chips, "%d, %d, %d, %.4f, %lld, %lld, %lld, %.4g, %.4g, %.4g, ", board->board, bank, e, hours,
+                    (long long) total->flips, (long long) total->stuck, (long long) total->misreads,
+                    hours > 0 ? total->flips / hours : 0, hours > 0 ? lower / hours : 0, hours > 0 ? upper / hours : 0);
+
+                // per Mbit only if we know how big it is
+                if (found >= 0 && hours > 0) {
+                    fprintf(chips, "%.4g\n", total->flips / hours / (topo->chips[found].size * 8 / 1e6));
+                } else {
+                    fprintf(chips, "\n");
+                }
+
+                bankHours += hours;
+                bankFlips += total->flips;
+                bankChips++;
+            }
+
+            if (bankChips == 0) {
+                continue;
+            }
+
+            // chip-hours, so the rate is per chip like the chip rows
+            double lower, upper;
+
+            poissonInterval(bankFlips, confidence, &lower, &upper);
+            fprintf(banks, "%d, %d, %.4f, %lld, %.4g, %.4g, %.4g\n", board->board, bank, bankHours, (long long) bankFlips,
+                bankHours > 0 ? bankFlips / bankHours : 0, bankHours > 0 ? lower / bankHours : 0, bankHours > 0 ? upper / bankHours : 0);
+            printf("%5d %4d %6d %13.3f %8lld %11.4g   %.4g - %.4g\n", board->board, bank, bankChips, bankHours / bankChips,
+                (long long) bankFlips, bankHours > 0 ? bankFlips / bankHours : 0, bankHours > 0 ? lower / bankHours : 0,
+                bankHours > 0 ? upper / bankHours : 0);
+        }
+
+        int64_t cumulative = 0;
+
+        for (int b = 0; b < board->curve.n; b++) {
+            cumulative += board->curve.v[b];
+            fprintf(curve, "%d, %lld, %lld, %lld\n", board->board, (long long) (board->curve.first + b) * binSec,
+                (long long) board->curve.v[b], (long long) cumulative);
+        }
+    }
+
+    fclose(chips);
+    fclose(banks);
+    fclose(curve);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// board number and format, -1 if it isn't something we can read
+static int inspectFile(inputFile* file) {
+    struct stat st;
+    int fd = open(file->path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Failed to open %s\n", file->path);
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    evlogHeader header;
+    const char* name = strrchr(file->path, '/');
+
+    file->size = st.st_size;
+    file->binary = read(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) && evlogHeaderValid(&header);
+    close(fd);
+
+    if (file->binary) {
+        file->board = header.board;
+        file->dataStart = header.headerSize;
+
+        return 0;
+    }
+
+    file->dataStart = 0;
+
+    // "board N data.csv"
+    if (sscanf(name != NULL ? name + 1 : file->path, "board %d", &file->board) != 1) {
+        printf("%s isn't an event log and its name doesn't say which board it is\n", file->path);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int binSec = ANALYZE_BIN_SEC;
+    double confidence = ANALYZE_CONFIDENCE;
+    const char* prefix = "analysis";
+    const char* topoPath = NULL;
+    inputFile* files = (inputFile*) calloc(argc, sizeof(inputFile));
+    int numFiles = 0;
+
+    for (int i = 1; i < argc && files != NULL; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bin") == 0 && hasValue) {
+            binSec = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--confidence") == 0 && hasValue) {
+            confidence = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            prefix = argv[++i];
+        } else if (strcmp(argv[i], "--topology") == 0 && hasValue) {
+            topoPath = argv[++i];
+        } else {
+            files[numFiles].path = argv[i];
+
+            if (inspectFile(&files[numFiles]) == 0) {
+                numFiles++;
+            }
+        }
+    }
+
+    if (numFiles == 0 || threads <= 0 || binSec <= 0 || confidence <= 0 || confidence >= 1) {
+        printf("Usage: %s [--threads N] [--bin SEC] [--confidence C] [--out PREFIX] [--topology FILE] LOG...\n", argv[0]);
+        free(files);
+
+        return -1;
+    }
+
+    boardTopology topo;
+
+    if (topoPath == NULL) {
+        topologyDefault(&topo);
+    } else if (topologyLoad(topoPath, &topo) != 0) {
+        free(files);
+
+        return -1;
+    }
+
+    // cut every file into pieces, records never straddle one
+    analysis an = { .files = files, .numFiles = numFiles, .binSec = binSec, .window = threads * ANALYZE_AHEAD };
+    long chunk = ANALYZE_CHUNK - ANALYZE_CHUNK % (long) sizeof(evlogRecord);
+
+    for (int pass = 0; pass < 2; pass++) {
+        an.numUnits = 0;
+
+        for (int f = 0; f < numFiles; f++) {
+            for (long start = files[f].dataStart; start < files[f].size; start += chunk) {
+                if (an.units != NULL) {
+                    workUnit* unit = &an.units[an.numUnits];
+
+                    unit->file = f;
+                    unit->start = start;
+                    unit->end = start + chunk < files[f].size ? start + chunk : files[f].size;
+                }
+
+                an.numUnits++;
+            }
+        }
+
+        if (an.units == NULL && (an.units = (workUnit*) calloc(an.numUnits + 1, sizeof(workUnit))) == NULL) {
+            free(files);
+
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&an.lock, NULL);
+    pthread_cond_init(&an.changed, NULL);
+
+    pthread_t* pool = (pthread_t*) calloc(threads, sizeof(pthread_t));
+    uint64_t bytes = 0;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int t = 0; t < threads && pool != NULL; t++) {
+        pthread_create(&pool[t], NULL, worker, &an);
+    }
+
+    // merge in order as pieces finish - runs have to be stitched back together front to back
+    boardAgg* boards = NULL;
+    int numBoards = 0;
+
+    for (int i = 0; i < an.numUnits && pool != NULL; i++) {
+        workUnit* unit = &an.units[i];
+
+        pthread_mutex_lock(&an.lock);
+
+        while (!unit->done && !an.failed) {
+            pthread_cond_wait(&an.changed, &an.lock);
+        }
+
+        bool failed = an.failed;
+
+        pthread_mutex_unlock(&an.lock);
+
+        if (failed) {
+            break;
+        }
+
+        // a new file never continues the last one's runs
+        if (unit->start == files[unit->file].dataStart) {
+            finishPending(&an, boards, numBoards);
+        }
+
+        for (fragment* frag = unit->frags; frag != NULL; ) {
+            fragment* next = frag->next;
+            boardAgg* board = findBoard(&boards, &numBoards, frag->board);
+
+            if (board != NULL && frag->continues && board->pending != NULL) {
+                fragmentMerge(board->pending, frag);
+                fragmentFree(frag);
+            } else if (board != NULL) {
+                if (board->pending != NULL) {
+                    finishRun(&an, board, board->pending);
+                    fragmentFree(board->pending);
+                }
+
+                board->pending = frag;
+            } else {
+                fragmentFree(frag);
+            }
+
+            frag = next;
+        }
+
+        unit->frags = NULL;
+        bytes += (uint64_t) (unit->end - unit->start);
+
+        pthread_mutex_lock(&an.lock);
+        an.merged++;
+        pthread_cond_broadcast(&an.changed);
+        pthread_mutex_unlock(&an.lock);
+    }
+
+    if (!an.failed) {
+        finishPending(&an, boards, numBoards);
+    }
+
+    for (int t = 0; t < threads && pool != NULL; t++) {
+        pthread_join(pool[t], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // half the logs would look like fewer flips, better nothing than that
+    if (an.failed) {
+        printf("Out of memory for a worker's buffer, no results written\n");
+
+        for (int i = 0; i < an.numUnits; i++) {
+            for (fragment* frag = an.units[i].frags; frag != NULL; ) {
+                fragment* next = frag->next;
+
+                fragmentFree(frag);
+                frag = next;
+            }
+        }
+
+        for (int i = 0; i < numBoards; i++) {
+            if (boards[i].pending != NULL) {
+                fragmentFree(boards[i].pending);
+            }
+
+            free(boards[i].curve.v);
+        }
+
+        free(boards);
+        free(pool);
+        free(an.units);
+        free(files);
+
+        return -1;
+    }
+
+    writeResults(boards, numBoards, prefix, binSec, confidence, &topo);
+
+    double took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%d files, %.1f MB in %.2f s on %d threads (%.0f MB/s)\n", numFiles, bytes / 1e6, took, threads, took > 0 ? bytes / 1e6 / took : 0);
+
+    for (int i = 0; i < numBoards; i++) {
+        free(boards[i].curve.v);
+    }
+
+    free(boards);
+    free(pool);
+    free(an.units);
+    free(files);
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+
+Arena Allocator for EEPROM Control
+
+*/
+
+// Libraries
+#include <sys/mman.h>
+#include "arena.h"
+
+// the pages up front, so the first touch isn't a fault in the middle of a sweep
+#ifdef MAP_POPULATE
+#define ARENA_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE)
+#else
+#define ARENA_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+int arenaCreate(arena* mem, size_t bytes) {
+    size_t size = arenaRound(bytes > 0 ? bytes : 1);
+    void* base = MAP_FAILED;
+
+    mem->huge = false;
+
+#ifdef MAP_HUGETLB
+    // only worth a whole huge page if it's going to fill most of one
+    if (size >= ARENA_HUGE_PAGE / 2) {
+        size_t hugeSize = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+
+        base = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, ARENA_MAP_FLAGS | MAP_HUGETLB, -1, 0);
+
+        if (base != MAP_FAILED) {
+            size = hugeSize;
+            mem->huge = true;
+        }
+    }
+#endif
+
+    // none reserved (the usual case) - normal pages, and let khugepaged merge them if it wants to
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, ARENA_MAP_FLAGS, -1, 0);
+
+        if (base == MAP_FAILED) {
+            mem->base = NULL;
+            mem->size = 0;
+            atomic_init(&mem->used, 0);
+
+            return -1;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (size >= ARENA_HUGE_PAGE) {
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    mem->base = (uint8_t*) base;
+    mem->size = size;
+    atomic_init(&mem->used, 0);
+
+    return 0;
+}
+
+void* arenaAlloc(arena* mem, size_t bytes) {
+    size_t take = arenaRound(bytes);
+    size_t used = atomic_load_explicit(&mem->used, memory_order_relaxed);
+
+    // nothing is ever given back, so fresh pages out of mmap are still zero
+    do {
+        if (take > mem->size - used) {
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&mem->used, &used, used + take, memory_order_relaxed, memory_order_relaxed));
+
+    return mem->base + used;
+}
+
+void arenaDestroy(arena* mem) {
+    uint8_t* base = mem->base;
+    size_t size = mem->size;
+
+    // the arena can live inside itself (allEEPROMs does), so nothing touches *mem after the munmap
+    mem->base = NULL;
+    mem->size = 0;
+
+    if (base != NULL) {
+        munmap(base, size);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+
+Arena Allocator for EEPROM Control
+
+One mapping per board, sized up front from the topology, that everything the
+board needs for the run gets carved out of: the EEPROM structs, region heat,
+seen masks, scratch buffers and the scan pipeline's blocks and rings. Nothing
+is ever handed back on its own - the whole thing goes in one munmap at the
+end - so once scanning starts the footprint doesn't move.
+
+Huge pages are used when the kernel has some reserved (vm.nr_hugepages),
+otherwise it's normal pages with a transparent huge page hint. Either way the
+pages are faulted in when it's made, not in the middle of a sweep.
+
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Everything handed out starts on a cache line, so two threads' data never share one
+#define ARENA_ALIGN 64
+
+// Size of a huge page (2 MB on x86 and the Pi's arm64 kernel)
+#define ARENA_HUGE_PAGE (2UL * 1024 * 1024)
+
+typedef struct {
+    uint8_t* base;
+    size_t size;          // bytes mapped
+    _Atomic size_t used;  // bump pointer, atomic so the compare threads can grow seen tables out of it
+    bool huge;            // backed by reserved huge pages
+} arena;
+
+// what an allocation of bytes really takes out of an arena, for sizing one
+static inline size_t arenaRound(size_t bytes) {
+    return (bytes + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+// map at least bytes, -1 if it can't be had
+int arenaCreate(arena* mem, size_t bytes);
+
+// zeroed, ARENA_ALIGN aligned, NULL once it's full. Lock free
+void* arenaAlloc(arena* mem, size_t bytes);
+
+// everything that came out of it goes at once
+void arenaDestroy(arena* mem);
+
+#endif
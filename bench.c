@@ -0,0 +1,575 @@
+/*
+
+Benchmarks for EEPROM Control
+
+Times the pieces a scan is made of on their own, so a change to any of them
+shows up as a number instead of "the 512k dump feels slower":
+
+    bus      bulk reads per chunk size through the simulator (no bus time,
+             so it's our own overhead) and, with --bus N, the real bus
+    compare  vectorized vs scalar kernels for every pattern, clean and with flips
+    failmap  failure map + seen mask insert and lookup at a few flip densities
+    log      event log records vs the old CSV lines, both committed per batch
+
+    ./bench                        everything, appended to bench.csv
+    ./bench --only compare --quick
+    ./bench --bus 1 --only bus     real board: EEPROM 0x50 in bank 0, read only
+
+Every result is one line of bench.csv (label, time, benchmark, case, param,
+value, unit) and the label defaults to the current git commit, so two commits
+can be put side by side with a sort or a pivot table.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bus.h"
+#include "compare.h"
+#include "pattern.h"
+#include "failmap.h"
+#include "evlog.h"
+
+// How long each case runs for (best of BENCH_ROUNDS rounds), --quick cuts it down
+#define BENCH_MS 300
+#define BENCH_QUICK_MS 50
+#define BENCH_ROUNDS 3
+
+// Chip the bus benchmark reads
+#define BENCH_CHIP_ADDR 0x50
+#define BENCH_CHIP_SIZE 512000
+#define BENCH_CHIP_PAGE 128
+#define BENCH_ADDR_BYTES 2
+
+// Block the compare benchmark diffs, same as the default read chunk
+#define BENCH_BLOCK 4096
+#define BENCH_DIFFS 256
+
+// Failure map as big as the biggest chip
+#define BENCH_MAP_BITS 512000
+
+// Records per log benchmark round, committed every BENCH_LOG_BATCH
+#define BENCH_LOG_RECORDS 100000
+#define BENCH_LOG_BATCH 4096
+
+typedef struct {
+    FILE* out;
+    char label[64];
+    long stamp;           // wall clock the run started, so reruns of one commit can be told apart
+    int ms;
+    int busNum;           // -1 = no real bus
+    const char* only;     // NULL = everything
+    const char* dir;      // scratch files go here
+} benchRun;
+
+static const int chunkSizes[] = { 16, 64, 256, 1024, 4096, 8192 };
+static const double densities[] = { 0.00001, 0.001, 0.01 };
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static uint64_t benchNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void benchResult(benchRun* run, const char* bench, const char* name, const char* param, double value, const char* unit) {
+    printf("%-8s %-28s %-10s %12.2f %s\n", bench, name, param, value, unit);
+    fprintf(run->out, "%s, %ld, %s, %s, %s, %.3f, %s\n", run->label, run->stamp, bench, name, param, value, unit);
+}
+
+static bool benchWanted(const benchRun* run, const char* bench) {
+    return run->only == NULL || strcmp(run->only, bench) == 0;
+}
+
+// the commit we're on, so results line up with history without having to say
+static void benchLabel(char* label, size_t len) {
+    FILE* git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+
+    snprintf(label, len, "unlabeled");
+
+    if (git != NULL) {
+        char line[64];
+
+        if (fgets(line, sizeof(line), git) != NULL && line[0] != '\0') {
+            line[strcspn(line, "\r\n")] = '\0';
+            snprintf(label, len, "%s", line);
+        }
+
+        pclose(git);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+Bulk reads of chunk bytes, walking through the chip like a sweep does. Best
+of the rounds in MB/s plus what one transaction costs.
+*/
+static void benchBusChunks(benchRun* run, i2cBus* bus, const char* backend, int size) {
+    int handle = busSetup(bus, BENCH_CHIP_ADDR);
+    uint8_t* buf = (uint8_t*) malloc(BUS_MAX_XFER);
+
+    if (handle < 0 || buf == NULL) {
+        printf("Can't read EEPROM 0x%02x on the %s bus\n", BENCH_CHIP_ADDR, backend);
+        free(buf);
+
+        return;
+    }
+
+    busSelectBank(bus, 0);
+
+    for (int c = 0; c < (int) (sizeof(chunkSizes) / sizeof(chunkSizes[0])); c++) {
+        int chunk = chunkSizes[c];
+        double best = 0;
+        double bestXferUs = 0;
+        int failed = 0;
+
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            uint64_t bytes = 0;
+            uint64_t xfers = 0;
+            uint64_t start = benchNs();
+            uint64_t took;
+            int addr = 0;
+
+            do {
+                int len = addr + chunk > size ? size - addr : chunk;
+
+                if (busReadBlock(bus, handle, BENCH_CHIP_ADDR, BENCH_ADDR_BYTES, addr, buf, len) != 0) {
+                    failed++;
+                }
+
+                bytes += (uint64_t) len;
+                xfers++;
+                addr = (addr + len) % size;
+                took = benchNs() - start;
+            } while (took < (uint64_t) run->ms * 1000000ULL);
+
+            double mbs = bytes / 1e6 / (took / 1e9);
+
+            if (mbs > best) {
+                best = mbs;
+                bestXferUs = took / 1e3 / xfers;
+            }
+        }
+
+        char param[32];
+
+        snprintf(param, sizeof(param), "%d", chunk);
+        benchResult(run, "bus", backend, param, best, "MB/s");
+        benchResult(run, "bus", backend, param, bestXferUs, "us/xfer");
+
+        if (failed > 0) {
+            printf("  %d reads failed at chunk %d, numbers above are suspect\n", failed, chunk);
+        }
+    }
+
+    busClose(bus, handle);
+    free(buf);
+}
+
+static void benchBus(benchRun* run) {
+    simConfig cfg = simDefaults();
+    char simDir[300];
+
+    // no bus time and no faults - whatever's left is our code and the syscalls
+    cfg.byteLatencyNs = 0;
+    cfg.xferLatencyNs = 0;
+    cfg.writeCycleNs = 0;
+    snprintf(simDir, sizeof(simDir), "%s/bench-sim", run->dir);
+
+    i2cBus* bus = busOpenSim(simDir, &cfg);
+
+    if (bus != NULL && simAddChip(bus, 0, BENCH_CHIP_ADDR, BENCH_CHIP_SIZE, BENCH_CHIP_PAGE, BENCH_ADDR_BYTES) == 0) {
+        benchBusChunks(run, bus, "sim", BENCH_CHIP_SIZE);
+    }
+
+    if (bus != NULL) {
+        char path[350];
+
+        busDestroy(bus);
+        snprintf(path, sizeof(path), "%s/bank0_0x%02x.bin", simDir, BENCH_CHIP_ADDR);
+        unlink(path);
+        rmdir(simDir);
+    }
+
+    if (run->busNum < 0) {
+        return;
+    }
+
+    // real chip - reads only, and only as far as 2 address bytes reach
+    bus = busOpenWiringPi(run->busNum, true);
+
+    if (bus != NULL) {
+        char backend[32];
+
+        snprintf(backend, sizeof(backend), "i2c-%d", run->busNum);
+        benchBusChunks(run, bus, backend, 1 << (8 * BENCH_ADDR_BYTES));
+        busDestroy(bus);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+typedef int (*patternKernel)(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs);
+
+// diff the block until the round's up, going back for more whenever the diffs fill up like the pipeline does
+static double benchKernel(benchRun* run, patternKernel kernel, const testPattern* pat, const uint8_t* data) {
+    byteDiff diffs[BENCH_DIFFS];
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        uint64_t bytes = 0;
+        uint64_t start = benchNs();
+        uint64_t took;
+        int found = 0;
+
+        do {
+            int from = 0;
+            int n;
+
+            do {
+                n = kernel(pat, (uint32_t) from, data + from, BENCH_BLOCK - from, diffs, BENCH_DIFFS);
+                found += n;
+
+                if (n == BENCH_DIFFS) {
+                    from += diffs[n - 1].offset + 1;
+                }
+            } while (n == BENCH_DIFFS);
+
+            bytes += BENCH_BLOCK;
+            took = benchNs() - start;
+        } while (took < (uint64_t) run->ms * 1000000ULL);
+
+        // keeps the loop from being thrown away
+        if (found < 0) {
+            printf("?\n");
+        }
+
+        double mbs = bytes / 1e6 / (took / 1e9);
+
+        best = mbs > best ? mbs : best;
+    }
+
+    return best;
+}
+
+static int fillKernel(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs) {
+    static uint8_t expect[BENCH_BLOCK];
+
+    (void) data;
+    (void) diffs;
+    (void) maxDiffs;
+    patternFill(pat, addr, expect, len);
+
+    return expect[0] == 0x12 && expect[len - 1] == 0x34;
+}
+
+static void benchCompare(benchRun* run) {
+    uint8_t* data = (uint8_t*) malloc(BENCH_BLOCK);
+
+    if (data == NULL) {
+        return;
+    }
+
+    printf("compare kernel: %s\n", compareKernelName());
+
+    for (int type = PATTERN_FF; type <= PATTERN_PRNG; type++) {
+        testPattern pat = { (patternType) type, 1 };
+
+        // clean, then about one flipped bit per 64 bytes - way past anything a beam does, so it's the worst case
+        for (int dirty = 0; dirty <= 1; dirty++) {
+            char name[64];
+
+            patternFill(&pat, 0, data, BENCH_BLOCK);
+
+            for (int i = 0; dirty && i < BENCH_BLOCK; i += 64) {
+                data[i + (i / 64) % 64] ^= (uint8_t) (1 << (i / 64 % 8));
+            }
+
+            snprintf(name, sizeof(name), "%s-vector", patternName(pat.type));
+            benchResult(run, "compare", name, dirty ? "dirty" : "clean", benchKernel(run, comparePattern, &pat, data), "MB/s");
+            snprintf(name, sizeof(name), "%s-scalar", patternName(pat.type));
+            benchResult(run, "compare", name, dirty ? "dirty" : "clean", benchKernel(run, comparePatternScalar, &pat, data), "MB/s");
+        }
+
+        // what generating the expected data costs on its own
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s-fill", patternName(pat.type));
+        benchResult(run, "compare", name, "-", benchKernel(run, fillKernel, &pat, data), "MB/s");
+    }
+
+    free(data);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// xorshift, the failure map doesn't care how good the randomness is
+static uint32_t benchRand(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return *state;
+}
+
+/*
+What compare does per flipped byte: set the map bit and find its seen mask.
+Inserts go into a fresh map until density of it is failed, then lookups hit
+a mix of failed and clean addresses like a resumed sweep does.
+*/
+static void benchFailMap(benchRun* run) {
+    for (int d = 0; d < (int) (sizeof(densities) / sizeof(densities[0])); d++) {
+        int flips = (int) (BENCH_MAP_BITS * densities[d]);
+        double bestInsert = 0;
+        double bestLookup = 0;
+
+        flips = flips > 0 ? flips : 1;
+
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            failMap map;
+            flipMasks seen;
+            uint32_t state = 12345;
+
+            if (failMapCreate(&map, BENCH_MAP_BITS) != 0 || flipMasksCreate(&seen, 64, NULL) != 0) {
+                return;
+            }
+
+            uint64_t start = benchNs();
+
+            for (int i = 0; i < flips; i++) {
+                int addr = (int) (benchRand(&state) % BENCH_MAP_BITS);
+                uint8_t* mask = flipMasksSlot(&seen, (uint32_t) addr);
+
+                failMapTestAndSet(&map, addr);
+
+                if (mask != NULL) {
+                    *mask |= 1;
+                }
+            }
+
+            double insertNs = (double) (benchNs() - start) / flips;
+            uint64_t lookups = 0;
+            uint64_t hits = 0;
+
+            start = benchNs();
+
+            do {
+                for (int i = 0; i < 4096; i++) {
+                    int addr = (int) (benchRand(&state) % BENCH_MAP_BITS);
+
+                    if (failMapTest(&map, addr)) {
+                        hits += *flipMasksSlot(&seen, (uint32_t) addr);
+                    }
+                }
+
+                lookups += 4096;
+            } while (benchNs() - start < (uint64_t) run->ms * 1000000ULL);
+
+            double lookupNs = (double) (benchNs() - start) / lookups;
+
+            if (hits > lookups) {
+                printf("?\n");
+            }
+
+            bestInsert = round == 0 || insertNs < bestInsert ? insertNs : bestInsert;
+            bestLookup = round == 0 || lookupNs < bestLookup ? lookupNs : bestLookup;
+
+            failMapFree(&map);
+            flipMasksFree(&seen);
+        }
+
+        char param[32];
+
+        snprintf(param, sizeof(param), "%g", densities[d]);
+        benchResult(run, "failmap", "insert", param, bestInsert, "ns/op");
+        benchResult(run, "failmap", "lookup", param, bestLookup, "ns/op");
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void benchRecord(evlogRecord* rec, int i) {
+    memset(rec, 0, sizeof(evlogRecord));
+    rec->ns = (uint64_t) i * 1000;
+    rec->kind = EV_FLIP;
+    rec->bank = (uint8_t) (i & 1);
+    rec->eeprom = (uint8_t) (i % 8);
+    rec->addr = (uint32_t) (i * 2654435761u % BENCH_CHIP_SIZE);
+    rec->mask = (uint8_t) (1 << (i % 8));
+    rec->data = (uint8_t) ~rec->mask;
+}
+
+/*
+Same flips both ways: binary records through evlog, and the one line per bit
+CSV the logger used to print. Both get committed (fdatasync) every
+BENCH_LOG_BATCH records so it's the format that's being compared, not the
+flushing.
+*/
+static void benchLog(benchRun* run) {
+    char path[300];
+    double bestBin = 0;
+    double bestCsv = 0;
+    long binBytes = 0;
+    long csvBytes = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        evlogConfig cfg = evlogDefaults();
+
+        cfg.intervalMs = 0;
+        cfg.batchRecords = BENCH_LOG_BATCH;
+        snprintf(path, sizeof(path), "%s/bench-events.bin", run->dir);
+        unlink(path);
+
+        evlog* log = evlogOpen(path, 0, &cfg);
+
+        if (log == NULL) {
+            return;
+        }
+
+        uint64_t start = benchNs();
+
+        for (int i = 0; i < BENCH_LOG_RECORDS; i++) {
+            evlogRecord rec;
+
+            benchRecord(&rec, i);
+            evlogAppend(log, &rec);
+        }
+
+        evlogClose(log);
+
+        double rate = BENCH_LOG_RECORDS / ((benchNs() - start) / 1e9);
+
+        bestBin = rate > bestBin ? rate : bestBin;
+
+        FILE* in = fopen(path, "rb");
+
+        if (in != NULL) {
+            fseek(in, 0, SEEK_END);
+            binBytes = ftell(in);
+            fclose(in);
+        }
+
+        unlink(path);
+
+        snprintf(path, sizeof(path), "%s/bench-flips.csv", run->dir);
+
+        FILE* out = fopen(path, "w");
+
+        if (out == NULL) {
+            return;
+        }
+
+        start = benchNs();
+
+        for (int i = 0; i < BENCH_LOG_RECORDS; i++) {
+            evlogRecord rec;
+
+            benchRecord(&rec, i);
+
+            for (int bit = 0; bit < 8; bit++) {
+                if (rec.mask & (1 << bit)) {
+                    fprintf(out, "%llu, %d, %d, %u, %d, %s\n", (unsigned long long) rec.ns, rec.bank, rec.eeprom, rec.addr, bit,
+                        (rec.data >> bit) & 1 ? "0->1" : "1->0");
+                }
+            }
+
+            if ((i + 1) % BENCH_LOG_BATCH == 0) {
+                fflush(out);
+                fdatasync(fileno(out));
+            }
+        }
+
+        fflush(out);
+        fdatasync(fileno(out));
+        csvBytes = ftell(out);
+        fclose(out);
+        unlink(path);
+
+        rate = BENCH_LOG_RECORDS / ((benchNs() - start) / 1e9);
+        bestCsv = rate > bestCsv ? rate : bestCsv;
+    }
+
+    benchResult(run, "log", "evlog", "-", bestBin, "records/s");
+    benchResult(run, "log", "evlog", "-", (double) binBytes / BENCH_LOG_RECORDS, "bytes/record");
+    benchResult(run, "log", "csv", "-", bestCsv, "records/s");
+    benchResult(run, "log", "csv", "-", (double) csvBytes / BENCH_LOG_RECORDS, "bytes/record");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+int main(int argc, char** argv) {
+    benchRun run = { NULL, "", (long) time(NULL), BENCH_MS, -1, NULL, "." };
+    const char* outPath = "bench.csv";
+    const char* label = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--label") == 0 && hasValue) {
+            label = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0 && hasValue) {
+            run.only = argv[++i];
+        } else if (strcmp(argv[i], "--bus") == 0 && hasValue) {
+            run.busNum = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dir") == 0 && hasValue) {
+            run.dir = argv[++i];
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            run.ms = BENCH_QUICK_MS;
+        } else {
+            printf("Usage: %s [--out FILE] [--label L] [--only bus|compare|failmap|log] [--bus N] [--dir DIR] [--quick]\n", argv[0]);
+
+            return -1;
+        }
+    }
+
+    if (label != NULL) {
+        snprintf(run.label, sizeof(run.label), "%s", label);
+    } else {
+        benchLabel(run.label, sizeof(run.label));
+    }
+
+    bool fresh = access(outPath, F_OK) != 0;
+
+    run.out = fopen(outPath, "a");
+
+    if (run.out == NULL) {
+        printf("Failed to open %s\n", outPath);
+
+        return -1;
+    }
+
+    if (fresh) {
+        fprintf(run.out, "Label, Time, Benchmark, Case, Param, Value, Unit\n");
+    }
+
+    if (benchWanted(&run, "bus")) {
+        benchBus(&run);
+    }
+
+    if (benchWanted(&run, "compare")) {
+        benchCompare(&run);
+    }
+
+    if (benchWanted(&run, "failmap")) {
+        benchFailMap(&run);
+    }
+
+    if (benchWanted(&run, "log")) {
+        benchLog(&run);
+    }
+
+    fclose(run.out);
+    printf("Results appended to %s (label %s)\n", outPath, run.label);
+
+    return 0;
+}
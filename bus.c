@@ -0,0 +1,191 @@
+/*
+
+Bus Helpers for EEPROM Control
+
+Multi-byte EEPROM operations built out of the raw backend transactions, so
+every backend gets them for free. Bank selection goes through here too so the
+current bank can be cached and the switch timed.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "bus.h"
+
+static uint64_t busNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// split an address into the word address bytes the chip expects, MSB first
+static void busWordAddr(uint8_t* out, int addrBytes, long word) {
+    for (int i = 0; i < addrBytes; i++) {
+        out[i] = (uint8_t) (word >> (8 * (addrBytes - 1 - i)));
+    }
+}
+
+/*
+Sequential read of len bytes starting at addr. The word address is sent
+explicitly (addrBytes of it, MSB first) at the start of every transaction so
+we never depend on where the chip's address counter was left.
+
+Addresses that don't fit in addrBytes roll over, same as the chip's own
+counter does when a sequential read runs off the end.
+*/
+int busReadBlock(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, uint8_t* buf, int len) {
+    long span = 1L << (8 * addrBytes);
+    uint8_t wordAddr[4];
+
+    while (len > 0) {
+        long word = addr % span;
+        int n = len < BUS_MAX_XFER ? len : BUS_MAX_XFER;
+
+        // don't let a single transaction run past the roll over point
+        if (word + n > span) {
+            n = (int) (span - word);
+        }
+
+        busWordAddr(wordAddr, addrBytes, word);
+
+        if (busXfer(bus, handle, devAddr, wordAddr, addrBytes, buf, n) != 0) {
+            return -1;
+        }
+
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+Page write - address and up to one page of data in a single transaction.
+The caller has to keep it inside one page, the chip wraps around within the
+page otherwise. Doesn't wait for the write cycle, see busAckPoll.
+*/
+int busWritePage(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, const uint8_t* data, int len) {
+    uint8_t wbuf[4 + BUS_MAX_PAGE];
+
+    if (len > BUS_MAX_PAGE) {
+        return -1;
+    }
+
+    busWordAddr(wbuf, addrBytes, addr % (1L << (8 * addrBytes)));
+    memcpy(wbuf + addrBytes, data, len);
+
+    return busXfer(bus, handle, devAddr, wbuf, addrBytes + len, NULL, 0);
+}
+
+/*
+Wait out a write cycle. The chip NACKs everything until it's done, so keep
+poking it with a harmless address-only write instead of sleeping the worst
+case datasheet time. Returns -1 if it never comes back.
+*/
+int busAckPoll(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, long timeoutUs) {
+    uint8_t wordAddr[4];
+    struct timespec start, now;
+
+    busWordAddr(wordAddr, addrBytes, addr % (1L << (8 * addrBytes)));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (busXfer(bus, handle, devAddr, wordAddr, addrBytes, NULL, 0) != 0) {
+        statAdd(&bus->stats.ackPolls, 1);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long waitedUs = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+
+        if (waitedUs > timeoutUs) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+Bank select with the current bank cached, so going back to the bank we're
+already on doesn't touch the GPIO lines at all
+*/
+bool busSelectBank(i2cBus* bus, int bank) {
+    if (bus->bank == bank) {
+        statAdd(&bus->stats.bankSkips, 1);
+
+        return false;
+    }
+
+    uint64_t start = busNowNs();
+
+    bus->ops->selectBank(bus, bank);
+    bus->bank = bank;
+    statAdd(&bus->stats.bankSwitches, 1);
+    statAdd(&bus->stats.switchNs, busNowNs() - start);
+
+    return true;
+}
+
+/*
+The mux takes a moment to connect the new bank. ACK poll the chip we're about
+to talk to so the first real read doesn't eat a NACK, and keep track of how
+long that took.
+*/
+int busSettle(i2cBus* bus, int handle, int devAddr, int addrBytes, long timeoutUs) {
+    uint64_t start = busNowNs();
+    int result = busAckPoll(bus, handle, devAddr, addrBytes, 0, timeoutUs);
+
+    if (result == 0) {
+        uint64_t took = busNowNs() - start;
+
+        statAdd(&bus->stats.settles, 1);
+        statAdd(&bus->stats.settleNs, took);
+        statMax(&bus->stats.maxSettleNs, took);
+    }
+
+    return result;
+}
+
+/*
+Watchdog on every transaction. A NACK on its own is normal (write cycles,
+settling, a missing chip), so only a run of failures gets the lines looked
+at - and a bus clear only happens if SDA really is being held low.
+*/
+int busXfer(i2cBus* bus, int handle, int devAddr, const uint8_t* wbuf, int wlen, uint8_t* rbuf, int rlen) {
+    uint64_t start = busNowNs();
+    int result = bus->ops->xfer(bus, handle, devAddr, wbuf, wlen, rbuf, rlen);
+    uint64_t took = busNowNs() - start;
+
+    statAdd(&bus->stats.xfers, 1);
+    statMax(&bus->stats.maxXferNs, took);
+    histAdd(&bus->stats.xferHist, took);
+
+    if (took > BUS_XFER_TIMEOUT_MS * 1000000ULL) {
+        statAdd(&bus->stats.timeouts, 1);
+    }
+
+    if (result == 0) {
+        statAdd(&bus->stats.readBytes, (uint64_t) rlen);
+        bus->failStreak = 0;
+
+        return 0;
+    }
+
+    statAdd(&bus->stats.xferErrors, 1);
+
+    if (++bus->failStreak % BUS_STUCK_FAILS == 0) {
+        int cleared = bus->ops->clear(bus);
+
+        if (cleared > 0) {
+            statAdd(&bus->stats.clears, 1);
+            bus->failStreak = 0;
+        } else if (cleared < 0) {
+            statAdd(&bus->stats.clearFails, 1);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,126 @@
+/*
+
+I2C Bus Backends for EEPROM Control
+
+Everything that touches the I2C bus or the bank select pins goes through one
+of these so logger() and initEEPROMs() can run against either the real
+wiringPi bus on the Pi or a file-backed simulator on any Linux box.
+
+*/
+
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stats.h"
+
+// i2c-dev won't take more than this in one message
+#define BUS_MAX_XFER 8192
+
+// biggest page write any part we use takes
+#define BUS_MAX_PAGE 256
+
+// Deadline for one transaction - a full BUS_MAX_XFER read at 1 MHz is ~75 ms
+#define BUS_XFER_TIMEOUT_MS 100
+
+// Failed transactions in a row (any chip) before the watchdog checks the lines
+#define BUS_STUCK_FAILS 3
+
+typedef struct i2cBus i2cBus;
+
+// What every backend has to provide
+typedef struct {
+    const char* name;
+    void (*selectBank)(i2cBus* bus, int bank);         // flip the bank mux
+    int  (*setup)(i2cBus* bus, int devAddr);           // get a handle for a chip, -1 on failure
+    int  (*read)(i2cBus* bus, int handle);             // byte at the chip's address counter, -1 on failure
+    int  (*write)(i2cBus* bus, int handle, int data);  // one byte write transaction, -1 on failure
+    // write wlen bytes then (repeated start) read rlen bytes from devAddr, either may be 0. -1 on NACK/failure
+    int  (*xfer)(i2cBus* bus, int handle, int devAddr, const uint8_t* wbuf, int wlen, uint8_t* rbuf, int rlen);
+    void (*close)(i2cBus* bus, int handle);
+    // SDA held low -> clock it free and send a STOP. 1 = it was stuck and isn't now, 0 = lines were fine, -1 = still stuck
+    int  (*clear)(i2cBus* bus);
+    void (*destroy)(i2cBus* bus);
+} busOps;
+
+// Where bank switching time goes, per bus. Only the bus's owner writes them (see stats.h)
+typedef struct {
+    uint64_t bankSwitches;  // times the select lines actually changed
+    uint64_t bankSkips;     // already on that bank, nothing written
+    uint64_t switchNs;      // driving the select lines
+    uint64_t settles;       // switches we waited out with busSettle
+    uint64_t settleNs;      // switch until the first chip answered
+    uint64_t maxSettleNs;
+    uint64_t xfers;         // transactions through busXfer
+    uint64_t xferErrors;    // ones that NACK'd or failed
+    uint64_t timeouts;      // ones that took longer than BUS_XFER_TIMEOUT_MS
+    uint64_t maxXferNs;
+    uint64_t clears;        // times the watchdog found the bus stuck and freed it
+    uint64_t clearFails;    // times it couldn't
+    uint64_t readBytes;     // data that came back in transactions that worked
+    uint64_t ackPolls;      // extra polls while waiting out a write cycle or a settle
+    latHist xferHist;       // how long transactions take
+} busStats;
+
+struct i2cBus {
+    const busOps* ops;
+    void* priv;           // backend specific state
+    int bank;             // bank the mux is on, -1 = don't know
+    int failStreak;       // failed transactions in a row, for the watchdog
+    busStats stats;       // only touched by whoever owns the bus
+};
+
+// Simulator knobs
+typedef struct {
+    long byteLatencyNs;   // time to clock one byte over the bus, 0 = run at full CPU speed
+    long xferLatencyNs;   // start + device address + stop overhead per transaction
+    long writeCycleNs;    // internal write time after a page write, chip NACKs until it's done
+    double flipRate;      // persistent upsets per megabit per second
+    double flipCluster;   // fraction of them that land in one 4K hot spot per chip
+    double stuckBits;     // fraction of them that stick - writing the bit back doesn't change it
+    long muxSettleNs;     // nothing on the bus answers for this long after a bank switch
+    double readErrRate;   // chance a single byte read comes back garbled (nothing stored changes)
+    double stuckRate;     // chance a transaction leaves SDA stuck low until a bus clear
+    double dropRate;      // times per minute a chip stops answering
+    long dropMs;          // for this long
+    unsigned int seed;    // seed for the fault injection
+} simConfig;
+
+// Roughly what a 1 MHz bus looks like with no faults
+simConfig simDefaults(void);
+
+// Real hardware on /dev/i2c-busNum. Only a bus with more than one bank on it
+// drives the bank select pins (useMux), the others are wired straight through.
+i2cBus* busOpenWiringPi(int busNum, bool useMux);
+
+// Simulator - every chip is an mmap'd file in dir
+i2cBus* busOpenSim(const char* dir, const simConfig* cfg);
+int simAddChip(i2cBus* bus, int bank, int devAddr, int size, int pageSize, int addrBytes);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Helpers that work on top of any backend (bus.c)
+int busReadBlock(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, uint8_t* buf, int len);
+int busWritePage(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, const uint8_t* data, int len);
+int busAckPoll(i2cBus* bus, int handle, int devAddr, int addrBytes, int addr, long timeoutUs);
+
+// Switch banks, skipped if the mux is already there. True if it actually switched
+bool busSelectBank(i2cBus* bus, int bank);
+
+// Wait for devAddr to answer after a switch and put how long it took in the stats
+int busSettle(i2cBus* bus, int handle, int devAddr, int addrBytes, long timeoutUs);
+
+// Every transaction goes through here: timed against the deadline, and enough
+// failures in a row get the watchdog to check for (and clear) a stuck bus
+int busXfer(i2cBus* bus, int handle, int devAddr, const uint8_t* wbuf, int wlen, uint8_t* rbuf, int rlen);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static inline int busSetup(i2cBus* bus, int devAddr) { return bus->ops->setup(bus, devAddr); }
+static inline int busRead(i2cBus* bus, int handle) { return bus->ops->read(bus, handle); }
+static inline int busWrite(i2cBus* bus, int handle, int data) { return bus->ops->write(bus, handle, data); }
+static inline void busClose(i2cBus* bus, int handle) { bus->ops->close(bus, handle); }
+static inline void busDestroy(i2cBus* bus) { bus->ops->destroy(bus); }
+
+#endif
@@ -0,0 +1,549 @@
+/*
+
+Simulated Bus Backend for EEPROM Control
+
+Each chip is a file mmap'd into memory so its contents survive between runs
+just like a real part. Bus time is modelled per transaction and per byte, and
+radiation is faked by flipping bits in the stored images at a set rate.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bus.h"
+
+#define SIM_MAX_BANKS 4
+#define SIM_MAX_DEVS 128  // 7 bit addresses
+
+// where clustered flips land
+#define SIM_CLUSTER_BYTES 4096
+
+// stuck bits a chip can have, later ones are just upsets
+#define SIM_MAX_STUCK 64
+
+// sleep in chunks so we aren't calling nanosleep for every byte
+#define SIM_SLEEP_QUANTUM_NS 1000000
+
+typedef struct {
+    uint8_t* mem;         // mmap'd chip contents
+    int size;             // size in bytes
+    int fd;               // backing file
+    int ptr;              // chip's internal address counter
+    int pageSize;         // page write size
+    int addrBytes;        // word address bytes it takes
+    double nextFlip;      // monotonic time of the next injected upset
+    double busyUntil;     // still in a write cycle until then
+    int clusterStart;     // hot spot for --flip-cluster
+    double nextDrop;      // monotonic time it next stops answering (--drop-rate)
+    double droppedUntil;  // not answering until then
+    int stuck[SIM_MAX_STUCK]; // bit numbers that won't take a write (--stuck-bits)
+    int numStuck;
+} simChip;
+
+typedef struct {
+    simConfig cfg;
+    char dir[256];
+    int bank;             // currently selected bank
+    long owedNs;          // bus time we still have to sleep off
+    unsigned int rng;
+    long nextReadErr;     // bytes left until the next garbled read
+    double settleUntil;   // mux still switching until then
+    bool stuck;           // SDA held low, nothing gets through until a bus clear
+    simChip* chips[SIM_MAX_BANKS][SIM_MAX_DEVS];
+} simState;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static double nowSec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// uniform in (0, 1]
+static double simRand(simState* sim) {
+    return (rand_r(&sim->rng) + 1.0) / ((double) RAND_MAX + 1.0);
+}
+
+/*
+Account for bus time - only actually sleep once enough has piled up
+*/
+static void simDelay(simState* sim, long ns) {
+    sim->owedNs += ns;
+
+    if (sim->owedNs >= SIM_SLEEP_QUANTUM_NS) {
+        struct timespec ts = { sim->owedNs / 1000000000L, sim->owedNs % 1000000000L };
+        nanosleep(&ts, NULL);
+        sim->owedNs = 0;
+    }
+}
+
+/*
+Upsets are a poisson process per chip so bigger chips get hit more often
+*/
+static double simFlipInterval(simState* sim, simChip* chip) {
+    double rate = sim->cfg.flipRate * (chip->size * 8.0 / 1e6);
+
+    return -log(simRand(sim)) / rate;
+}
+
+static void simInjectFlips(simState* sim, simChip* chip) {
+    if (sim->cfg.flipRate <= 0) {
+        return;
+    }
+
+    double now = nowSec();
+
+    while (chip->nextFlip <= now) {
+        int bit = rand_r(&sim->rng) % (chip->size * 8);
+
+        // some of them go in the hot spot instead
+        if (sim->cfg.flipCluster > 0 && simRand(sim) <= sim->cfg.flipCluster) {
+            int span = chip->size - chip->clusterStart < SIM_CLUSTER_BYTES ? chip->size - chip->clusterStart : SIM_CLUSTER_BYTES;
+
+            bit = chip->clusterStart * 8 + rand_r(&sim->rng) % (span * 8);
+        }
+        chip->mem[bit / 8] ^= (uint8_t) (1 << (bit % 8));
+        chip->nextFlip += simFlipInterval(sim, chip);
+
+        if (sim->cfg.stuckBits > 0 && chip->numStuck < SIM_MAX_STUCK && simRand(sim) <= sim->cfg.stuckBits) {
+            chip->stuck[chip->numStuck++] = bit;
+        }
+    }
+}
+
+/*
+Garbled reads are skipped ahead geometrically instead of rolling the dice for
+every byte. Returns -1 if none of the next n bytes are hit, otherwise which one
+*/
+static long simReadErr(simState* sim, long n) {
+    if (sim->cfg.readErrRate <= 0) {
+        return -1;
+    }
+
+    if (sim->nextReadErr < 0) {
+        sim->nextReadErr = (long) (log(simRand(sim)) / log1p(-sim->cfg.readErrRate));
+    }
+
+    if (sim->nextReadErr >= n) {
+        sim->nextReadErr -= n;
+
+        return -1;
+    }
+
+    long hit = sim->nextReadErr;
+    sim->nextReadErr = -1;
+
+    return hit;
+}
+
+// chip has dropped off the bus for a while (--drop-rate)
+static bool simDropped(simState* sim, simChip* chip) {
+    if (sim->cfg.dropRate <= 0) {
+        return false;
+    }
+
+    double now = nowSec();
+
+    while (chip->nextDrop <= now) {
+        chip->droppedUntil = chip->nextDrop + sim->cfg.dropMs / 1e3;
+        chip->nextDrop += -log(simRand(sim)) * 60.0 / sim->cfg.dropRate;
+    }
+
+    return now < chip->droppedUntil;
+}
+
+// stuck bits keep whatever the upset left them at, no matter what got written
+static void simHoldStuck(simChip* chip, const uint8_t* before) {
+    for (int k = 0; k < chip->numStuck; k++) {
+        int byte = chip->stuck[k] / 8;
+        uint8_t mask = (uint8_t) (1 << (chip->stuck[k] % 8));
+
+        chip->mem[byte] = (uint8_t) ((chip->mem[byte] & ~mask) | (before[k] & mask));
+    }
+}
+
+static bool simBusy(simChip* chip) {
+    return chip->busyUntil > 0 && nowSec() < chip->busyUntil;
+}
+
+static simChip* simLookup(simState* sim, int handle) {
+    if (handle < 0 || handle >= SIM_MAX_DEVS || sim->bank < 0 || sim->bank >= SIM_MAX_BANKS) {
+        return NULL;
+    }
+
+    // mux hasn't connected the bank yet, nobody answers
+    if (sim->settleUntil > 0 && nowSec() < sim->settleUntil) {
+        return NULL;
+    }
+
+    return sim->chips[sim->bank][handle];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void simSelectBank(i2cBus* bus, int bank) {
+    simState* sim = (simState*) bus->priv;
+
+    if (bank < 0 || bank >= SIM_MAX_BANKS) {
+        printf("Invalid bank number\n");
+
+        return;
+    }
+
+    if (sim->bank != bank && sim->cfg.muxSettleNs > 0) {
+        sim->settleUntil = nowSec() + sim->cfg.muxSettleNs / 1e9;
+    }
+
+    sim->bank = bank;
+}
+
+/*
+Same as wiringPiI2CSetup - the handle is just the device address and a
+missing chip isn't noticed until something talks to it
+*/
+static int simSetup(i2cBus* bus, int devAddr) {
+    (void) bus;
+
+    if (devAddr < 0 || devAddr >= SIM_MAX_DEVS) {
+        return -1;
+    }
+
+    return devAddr;
+}
+
+static int simRead(i2cBus* bus, int handle) {
+    simState* sim = (simState*) bus->priv;
+    simChip* chip = simLookup(sim, handle);
+
+    simDelay(sim, sim->cfg.xferLatencyNs + sim->cfg.byteLatencyNs);
+
+    // nobody home, or busy writing -> NACK
+    if (sim->stuck || chip == NULL || simDropped(sim, chip) || simBusy(chip)) {
+        return -1;
+    }
+
+    simInjectFlips(sim, chip);
+
+    int data = chip->mem[chip->ptr];
+    chip->ptr = (chip->ptr + 1) % chip->size;
+
+    if (simReadErr(sim, 1) >= 0) {
+        data ^= 1 << (rand_r(&sim->rng) % 8);
+    }
+
+    return data;
+}
+
+/*
+A lone byte only gets as far as the word address on a real 24xx part, so a
+single byte write never stores anything - it only costs bus time
+*/
+static int simWrite(i2cBus* bus, int handle, int data) {
+    simState* sim = (simState*) bus->priv;
+    simChip* chip = simLookup(sim, handle);
+
+    (void) data;
+
+    simDelay(sim, sim->cfg.xferLatencyNs + sim->cfg.byteLatencyNs);
+
+    if (sim->stuck || chip == NULL || simDropped(sim, chip) || simBusy(chip)) {
+        return -1;
+    }
+
+    simInjectFlips(sim, chip);
+
+    return 0;
+}
+
+/*
+Combined transaction. The first addrBytes written are the word address,
+anything short of that leaves the address counter alone
+*/
+static int simXfer(i2cBus* bus, int handle, int devAddr, const uint8_t* wbuf, int wlen, uint8_t* rbuf, int rlen) {
+    simState* sim = (simState*) bus->priv;
+    simChip* chip = simLookup(sim, devAddr);
+
+    // the device address is all the sim needs
+    (void) handle;
+
+    // stuck bus - every transaction runs into the driver's timeout
+    if (sim->stuck) {
+        simDelay(sim, BUS_XFER_TIMEOUT_MS * 1000000L);
+
+        return -1;
+    }
+
+    simDelay(sim, sim->cfg.xferLatencyNs + sim->cfg.byteLatencyNs * (long) (wlen + rlen + (wlen > 0 && rlen > 0)));
+
+    // something glitched mid transfer and a chip is holding SDA now
+    if (sim->cfg.stuckRate > 0 && simRand(sim) <= sim->cfg.stuckRate) {
+        sim->stuck = true;
+
+        return -1;
+    }
+
+    // nobody home, dropped off, or busy writing -> NACK
+    if (chip == NULL || simDropped(sim, chip) || simBusy(chip)) {
+        return -1;
+    }
+
+    simInjectFlips(sim, chip);
+
+    if (wlen >= chip->addrBytes) {
+        long word = 0;
+
+        for (int i = 0; i < chip->addrBytes; i++) {
+            word = (word << 8) | wbuf[i];
+        }
+
+        chip->ptr = (int) (word % chip->size);
+    }
+
+    // page write - the address counter wraps inside the page like the real part
+    if (wlen > chip->addrBytes) {
+        int pageStart = chip->ptr - chip->ptr % chip->pageSize;
+        uint8_t before[SIM_MAX_STUCK];
+
+        for (int k = 0; k < chip->numStuck; k++) {
+            before[k] = chip->mem[chip->stuck[k] / 8];
+        }
+
+        for (int i = chip->addrBytes; i < wlen; i++) {
+            chip->mem[chip->ptr] = wbuf[i];
+            chip->ptr = pageStart + (chip->ptr + 1 - pageStart) % chip->pageSize;
+
+            if (chip->ptr >= chip->size) {
+                chip->ptr = pageStart;
+            }
+        }
+
+        simHoldStuck(chip, before);
+
+        if (sim->cfg.writeCycleNs > 0) {
+            chip->busyUntil = nowSec() + sim->cfg.writeCycleNs / 1e9;
+        }
+
+        return 0;
+    }
+
+    // sequential read, rolls over at the end of the chip
+    int done = 0;
+
+    while (done < rlen) {
+        int n = chip->size - chip->ptr;
+
+        if (n > rlen - done) {
+            n = rlen - done;
+        }
+
+        memcpy(rbuf + done, chip->mem + chip->ptr, n);
+        chip->ptr = (chip->ptr + n) % chip->size;
+        done += n;
+    }
+
+    long at = 0;
+    long hit;
+
+    while ((hit = simReadErr(sim, rlen - at)) >= 0) {
+        at += hit;
+        rbuf[at] ^= (uint8_t) (1 << (rand_r(&sim->rng) % 8));
+        at++;
+    }
+
+    return 0;
+}
+
+static void simClose(i2cBus* bus, int handle) {
+    // nothing to do, handles are just addresses
+    (void) bus;
+    (void) handle;
+}
+
+// nine clocks at 100 kHz and a STOP frees it
+static int simClear(i2cBus* bus) {
+    simState* sim = (simState*) bus->priv;
+
+    if (!sim->stuck) {
+        return 0;
+    }
+
+    simDelay(sim, 9 * 10000L);
+    sim->stuck = false;
+
+    return 1;
+}
+
+static void simDestroy(i2cBus* bus) {
+    simState* sim = (simState*) bus->priv;
+
+    for (int bank = 0; bank < SIM_MAX_BANKS; bank++) {
+        for (int dev = 0; dev < SIM_MAX_DEVS; dev++) {
+            simChip* chip = sim->chips[bank][dev];
+
+            if (chip != NULL) {
+                munmap(chip->mem, chip->size);
+                close(chip->fd);
+                free(chip);
+            }
+        }
+    }
+
+    free(sim);
+    free(bus);
+}
+
+static const busOps simOps = {
+    .name = "sim",
+    .selectBank = simSelectBank,
+    .setup = simSetup,
+    .read = simRead,
+    .write = simWrite,
+    .xfer = simXfer,
+    .close = simClose,
+    .clear = simClear,
+    .destroy = simDestroy,
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+simConfig simDefaults(void) {
+    simConfig cfg = {
+        .byteLatencyNs = 9000,    // 8 data bits + ACK at 1 MHz
+        .xferLatencyNs = 20000,   // start, device address, stop
+        .writeCycleNs = 5000000,  // datasheet worst case is 5 ms
+        .flipRate = 0,
+        .flipCluster = 0,
+        .stuckBits = 0,
+        .muxSettleNs = 0,
+        .readErrRate = 0,
+        .stuckRate = 0,
+        .dropRate = 0,
+        .dropMs = 5000,
+        .seed = 1,
+    };
+
+    return cfg;
+}
+
+i2cBus* busOpenSim(const char* dir, const simConfig* cfg) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create sim directory %s\n", dir);
+
+        return NULL;
+    }
+
+    i2cBus* bus = (i2cBus*) calloc(1, sizeof(i2cBus));
+    simState* sim = (simState*) calloc(1, sizeof(simState));
+
+    if (bus == NULL || sim == NULL) {
+        free(bus);
+        free(sim);
+
+        return NULL;
+    }
+
+    sim->cfg = *cfg;
+    sim->rng = cfg->seed;
+    sim->nextReadErr = -1;
+    snprintf(sim->dir, sizeof(sim->dir), "%s", dir);
+
+    bus->ops = &simOps;
+    bus->priv = sim;
+    bus->bank = -1;
+
+    return bus;
+}
+
+/*
+Put a chip on the simulated board. A new (or resized) backing file starts out
+erased to 0xFF, an existing one keeps whatever was left in it last run.
+*/
+int simAddChip(i2cBus* bus, int bank, int devAddr, int size, int pageSize, int addrBytes) {
+    simState* sim = (simState*) bus->priv;
+
+    if (bank < 0 || bank >= SIM_MAX_BANKS || devAddr < 0 || devAddr >= SIM_MAX_DEVS || size <= 0 || pageSize <= 0 ||
+        addrBytes < 1 || addrBytes > 3) {
+        return -1;
+    }
+
+    if (sim->chips[bank][devAddr] != NULL) {
+        return -1;
+    }
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/bank%d_0x%02x.bin", sim->dir, bank, devAddr);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        printf("Failed to open sim chip %s\n", path);
+
+        return -1;
+    }
+
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || st.st_size != size;
+
+    if (fresh && ftruncate(fd, size) != 0) {
+        close(fd);
+
+        return -1;
+    }
+
+    uint8_t* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mem == MAP_FAILED) {
+        close(fd);
+
+        return -1;
+    }
+
+    if (fresh) {
+        memset(mem, 0xFF, size);
+    }
+
+    simChip* chip = (simChip*) calloc(1, sizeof(simChip));
+
+    if (chip == NULL) {
+        munmap(mem, size);
+        close(fd);
+
+        return -1;
+    }
+
+    chip->mem = mem;
+    chip->size = size;
+    chip->fd = fd;
+    chip->ptr = 0;
+    chip->pageSize = pageSize;
+    chip->addrBytes = addrBytes;
+
+    if (sim->cfg.flipCluster > 0) {
+        chip->clusterStart = (rand_r(&sim->rng) % size) & ~(SIM_CLUSTER_BYTES - 1);
+    }
+
+    if (sim->cfg.flipRate > 0) {
+        chip->nextFlip = nowSec() + simFlipInterval(sim, chip);
+    }
+
+    if (sim->cfg.dropRate > 0) {
+        chip->nextDrop = nowSec() - log(simRand(sim)) * 60.0 / sim->cfg.dropRate;
+    }
+
+    sim->chips[bank][devAddr] = chip;
+
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+
+wiringPi Bus Backend for EEPROM Control
+
+The real thing: I2C through wiringPi and the bank mux on two GPIO pins.
+Build with -DSIM_ONLY on machines without wiringPi and this turns into a stub.
+
+Every bus gets one fd on its i2c-dev node, opened once when the bus is opened.
+Block transfers carry the chip address in every I2C_RDWR message so they don't
+care which chip the fd points at; the single byte calls retarget it with
+I2C_SLAVE only when the chip changes. A handle is just the chip's address, so
+setting up and closing chips costs nothing.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "bus.h"
+
+#ifndef SIM_ONLY
+
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <wiringPi.h>
+#include <wiringPiI2C.h>
+
+// Selector Pins
+#define BANK_SELECT_1 0
+#define BANK_SELECT_2 1
+
+// pinModeAlt() function select values
+#define FSEL_ALT0 4
+#define FSEL_ALT5 2
+
+// Bus clear timing, half a 100 kHz clock
+#define CLEAR_HALF_CLOCK_US 5
+
+// SDA/SCL for every bus a Pi 4 has, wiringPi pin numbers (default dtoverlay pins)
+typedef struct {
+    int busNum;
+    int sda;
+    int scl;
+    int alt;              // function that gives the pins back to the controller
+} wpPins;
+
+static const wpPins busPins[] = {
+    { 1,  8,  9, FSEL_ALT0 },   // GPIO 2/3
+    { 3,  7, 21, FSEL_ALT5 },   // GPIO 4/5
+    { 4, 22, 11, FSEL_ALT5 },   // GPIO 6/7
+    { 5, 26, 23, FSEL_ALT5 },   // GPIO 12/13
+    { 6,  3,  4, FSEL_ALT5 },   // GPIO 22/23
+};
+
+typedef struct {
+    char device[32];      // /dev/i2c-N
+    bool useMux;          // this bus goes through the bank select mux
+    int fd;               // the one fd for the whole bus
+    int slave;            // chip the fd is pointed at for byte reads/writes, -1 = none yet
+    const wpPins* pins;   // NULL = don't know them, no bus clears
+} wpState;
+
+/*
+Choose with bank of EEPROM we are looking at by changing which switch state we are at
+*/
+static void wpSelectBank(i2cBus* bus, int bank) {
+    wpState* wp = (wpState*) bus->priv;
+
+    // only one bank on this bus, nothing to switch
+    if (!wp->useMux) {
+        return;
+    }
+
+    switch (bank) {
+        case 0:
+            digitalWrite(BANK_SELECT_1, LOW);
+            digitalWrite(BANK_SELECT_2, LOW);
+
+            break;
+        case 1:
+            digitalWrite(BANK_SELECT_1, HIGH);
+            digitalWrite(BANK_SELECT_2, LOW);
+
+            break;
+        case 2:
+            digitalWrite(BANK_SELECT_1, HIGH);
+            digitalWrite(BANK_SELECT_2, HIGH);
+
+            break;
+        default:
+            printf("Invalid bank number\n");
+
+            break;
+    }
+}
+
+static int wpSetup(i2cBus* bus, int devAddr) {
+    (void) bus;
+
+    if (devAddr < 0 || devAddr > 0x7F) {
+        return -1;
+    }
+
+    return devAddr;
+}
+
+// point the bus fd at handle for the byte calls, only if it isn't already
+static int wpTarget(wpState* wp, int handle) {
+    if (wp->slave != handle) {
+        if (ioctl(wp->fd, I2C_SLAVE, handle) < 0) {
+            return -1;
+        }
+
+        wp->slave = handle;
+    }
+
+    return wp->fd;
+}
+
+static int wpRead(i2cBus* bus, int handle) {
+    int fd = wpTarget((wpState*) bus->priv, handle);
+
+    return fd < 0 ? -1 : wiringPiI2CRead(fd);
+}
+
+static int wpWrite(i2cBus* bus, int handle, int data) {
+    int fd = wpTarget((wpState*) bus->priv, handle);
+
+    return fd < 0 ? -1 : wiringPiI2CWrite(fd, data);
+}
+
+/*
+Skip wiringPi and do a combined write/read with a repeated start in one
+ioctl on the bus fd
+*/
+static int wpXfer(i2cBus* bus, int handle, int devAddr, const uint8_t* wbuf, int wlen, uint8_t* rbuf, int rlen) {
+    wpState* wp = (wpState*) bus->priv;
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data xfer = { msgs, 0 };
+
+    // the ioctl goes by devAddr, not the byte calls' handle
+    (void) handle;
+
+    if (wlen > 0) {
+        msgs[xfer.nmsgs].addr = devAddr;
+        msgs[xfer.nmsgs].flags = 0;
+        msgs[xfer.nmsgs].len = wlen;
+        msgs[xfer.nmsgs].buf = (uint8_t*) wbuf;
+        xfer.nmsgs++;
+    }
+
+    if (rlen > 0) {
+        msgs[xfer.nmsgs].addr = devAddr;
+        msgs[xfer.nmsgs].flags = I2C_M_RD;
+        msgs[xfer.nmsgs].len = rlen;
+        msgs[xfer.nmsgs].buf = rbuf;
+        xfer.nmsgs++;
+    }
+
+    if (xfer.nmsgs == 0) {
+        return 0;
+    }
+
+    return ioctl(wp->fd, I2C_RDWR, &xfer) < 0 ? -1 : 0;
+}
+
+static void wpClose(i2cBus* bus, int handle) {
+    // nothing to do, the fd belongs to the bus
+    (void) bus;
+    (void) handle;
+}
+
+/*
+Standard bus clear. The pins are read straight off the GPIO level register
+(works whatever function they're set to); if SDA is low a chip got cut off
+mid byte and is waiting for clocks, so take SCL away from the controller and
+clock up to 9 times until it lets go, then STOP. Lines are only ever driven
+low or let float, same as open drain.
+*/
+static int wpClear(i2cBus* bus) {
+    wpState* wp = (wpState*) bus->priv;
+
+    if (wp->pins == NULL) {
+        return 0;
+    }
+
+    int sda = wp->pins->sda;
+    int scl = wp->pins->scl;
+
+    if (digitalRead(sda) == HIGH && digitalRead(scl) == HIGH) {
+        return 0;
+    }
+
+    pinMode(sda, INPUT);
+    pinMode(scl, INPUT);
+
+    for (int i = 0; i < 9 && digitalRead(sda) == LOW; i++) {
+        pinMode(scl, OUTPUT);
+        digitalWrite(scl, LOW);
+        delayMicroseconds(CLEAR_HALF_CLOCK_US);
+        pinMode(scl, INPUT);
+        delayMicroseconds(CLEAR_HALF_CLOCK_US);
+    }
+
+    // STOP - SDA goes high while SCL is high
+    pinMode(sda, OUTPUT);
+    digitalWrite(sda, LOW);
+    delayMicroseconds(CLEAR_HALF_CLOCK_US);
+    pinMode(sda, INPUT);
+    delayMicroseconds(CLEAR_HALF_CLOCK_US);
+
+    bool freed = digitalRead(sda) == HIGH && digitalRead(scl) == HIGH;
+
+    pinModeAlt(sda, wp->pins->alt);
+    pinModeAlt(scl, wp->pins->alt);
+
+    return freed ? 1 : -1;
+}
+
+static void wpDestroy(i2cBus* bus) {
+    wpState* wp = (wpState*) bus->priv;
+
+    close(wp->fd);
+    free(wp);
+    free(bus);
+}
+
+static const busOps wiringPiOps = {
+    .name = "wiringPi",
+    .selectBank = wpSelectBank,
+    .setup = wpSetup,
+    .read = wpRead,
+    .write = wpWrite,
+    .xfer = wpXfer,
+    .close = wpClose,
+    .clear = wpClear,
+    .destroy = wpDestroy,
+};
+
+/*
+Initialize GPIO Pins and hand back the real bus
+*/
+i2cBus* busOpenWiringPi(int busNum, bool useMux) {
+    static bool wiringPiReady = false;
+
+    i2cBus* bus = (i2cBus*) calloc(1, sizeof(i2cBus));
+    wpState* wp = (wpState*) calloc(1, sizeof(wpState));
+
+    if (bus == NULL || wp == NULL) {
+        free(bus);
+        free(wp);
+
+        return NULL;
+    }
+
+    if (!wiringPiReady) {
+        wiringPiSetup();
+        wiringPiReady = true;
+    }
+
+    if (useMux) {
+        pinMode(BANK_SELECT_1, OUTPUT);
+        pinMode(BANK_SELECT_2, OUTPUT);
+    }
+
+    snprintf(wp->device, sizeof(wp->device), "/dev/i2c-%d", busNum);
+    wp->useMux = useMux;
+    wp->slave = -1;
+    wp->fd = open(wp->device, O_RDWR);
+
+    if (wp->fd < 0) {
+        printf("Failed to open %s\n", wp->device);
+        free(bus);
+        free(wp);
+
+        return NULL;
+    }
+
+    // the driver default is a second or more, a stuck bus would hold the whole sweep up (units of 10 ms)
+    ioctl(wp->fd, I2C_TIMEOUT, BUS_XFER_TIMEOUT_MS / 10);
+    ioctl(wp->fd, I2C_RETRIES, 0);
+
+    for (int i = 0; i < (int) (sizeof(busPins) / sizeof(busPins[0])); i++) {
+        if (busPins[i].busNum == busNum) {
+            wp->pins = &busPins[i];
+        }
+    }
+
+    bus->ops = &wiringPiOps;
+    bus->priv = wp;
+    bus->bank = -1;
+
+    return bus;
+}
+
+#else
+
+i2cBus* busOpenWiringPi(int busNum, bool useMux) {
+    (void) busNum;
+    (void) useMux;
+
+    printf("Built with SIM_ONLY - no wiringPi backend, use --sim\n");
+
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,267 @@
+/*
+
+Checkpoint for EEPROM Control
+
+File layout: ckptHeader, a ckptChip for every chip, then every chip's failure
+map back to back, then every chip's reported bits (a byte per address, all of
+it 8 byte aligned). The reported bits are mostly zero and never touched, so
+they stay holes in the file and never get paged in. MAP_SHARED pages outlive
+the process, so a segfault loses nothing - ckptSync() is only there for power
+cuts.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static size_t ckptSeenBytes(int size) {
+    return ((size_t) size + 7) & ~(size_t) 7;
+}
+
+static size_t ckptLength(const ckptLayout* layout) {
+    size_t len = sizeof(ckptHeader) + layout->topo->count * sizeof(ckptChip);
+
+    for (int i = 0; i < layout->topo->count; i++) {
+        len += failMapBytes(layout->topo->chips[i].size) + ckptSeenBytes(layout->topo->chips[i].size);
+    }
+
+    return len;
+}
+
+/*
+Would resuming this checkpoint be comparing against the same board, chips
+and pattern? Says what's different if not.
+*/
+static bool ckptMatches(const checkpoint* ckpt, const ckptLayout* layout) {
+    const ckptHeader* header = ckpt->header;
+
+    if (header->board != (uint32_t) layout->board || header->numChips != (uint32_t) layout->topo->count) {
+        printf("Checkpoint is for a different board\n");
+
+        return false;
+    }
+
+    if (header->patternType != layout->patternType || header->patternSeed != layout->patternSeed) {
+        printf("Checkpoint was run with a different pattern\n");
+
+        return false;
+    }
+
+    for (int i = 0; i < layout->topo->count; i++) {
+        const chipDesc* chip = &layout->topo->chips[i];
+        const ckptChip* saved = &ckpt->chips[i];
+
+        if (saved->bank != chip->bank || saved->devAddr != chip->devAddr) {
+            printf("Checkpoint has different chips on the board\n");
+
+            return false;
+        }
+
+        if (saved->size != chip->size || saved->busNum != chip->busNum || saved->addrBytes != chip->addrBytes) {
+            printf("Checkpoint has 0x%02x in bank %d set up differently\n", chip->devAddr, chip->bank);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ckptMapFile(checkpoint* ckpt, size_t len) {
+    void* base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, ckpt->fd, 0);
+
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    ckpt->base = (uint8_t*) base;
+    ckpt->len = len;
+    ckpt->header = (ckptHeader*) base;
+    ckpt->chips = (ckptChip*) (ckpt->base + sizeof(ckptHeader));
+
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+checkpoint* ckptOpen(const char* path, const ckptLayout* layout, bool fresh, bool* resumed) {
+    checkpoint* ckpt = (checkpoint*) calloc(1, sizeof(checkpoint));
+
+    if (ckpt == NULL) {
+        return NULL;
+    }
+
+    ckpt->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (ckpt->fd < 0) {
+        free(ckpt);
+
+        return NULL;
+    }
+
+    size_t len = ckptLength(layout);
+    struct stat st;
+    ckptHeader old;
+
+    *resumed = false;
+
+    // anything unfinished in there?
+    if (!fresh && fstat(ckpt->fd, &st) == 0 && st.st_size >= (off_t) sizeof(ckptHeader) &&
+        pread(ckpt->fd, &old, sizeof(old), 0) == sizeof(old) &&
+        memcmp(old.magic, CKPT_MAGIC, sizeof(old.magic)) == 0 && old.version == CKPT_VERSION &&
+        old.initDone && !old.cleanExit) {
+        if ((size_t) st.st_size != len || !ckptMapFile(ckpt, st.st_size) || !ckptMatches(ckpt, layout)) {
+            printf("Not resuming %s - start over with --fresh\n", path);
+            ckptClose(ckpt, false);
+
+            return NULL;
+        }
+
+        *resumed = true;
+
+        return ckpt;
+    }
+
+    // start over - truncating to 0 first zeroes everything
+    if (ftruncate(ckpt->fd, 0) != 0 || ftruncate(ckpt->fd, len) != 0 || !ckptMapFile(ckpt, len)) {
+        close(ckpt->fd);
+        free(ckpt);
+
+        return NULL;
+    }
+
+    ckptHeader* header = ckpt->header;
+
+    memcpy(header->magic, CKPT_MAGIC, sizeof(header->magic));
+    header->version = CKPT_VERSION;
+    header->board = layout->board;
+    header->numChips = layout->topo->count;
+    header->patternType = layout->patternType;
+    header->patternSeed = layout->patternSeed;
+
+    uint64_t offset = sizeof(ckptHeader) + layout->topo->count * sizeof(ckptChip);
+
+    for (int i = 0; i < layout->topo->count; i++) {
+        const chipDesc* chip = &layout->topo->chips[i];
+        ckptChip* saved = &ckpt->chips[i];
+
+        saved->size = chip->size;
+        saved->bank = chip->bank;
+        saved->devAddr = chip->devAddr;
+        saved->busNum = chip->busNum;
+        saved->addrBytes = chip->addrBytes;
+        saved->mapOffset = offset;
+        offset += failMapBytes(chip->size);
+    }
+
+    for (int i = 0; i < layout->topo->count; i++) {
+        ckpt->chips[i].seenOffset = offset;
+        offset += ckptSeenBytes(layout->topo->chips[i].size);
+    }
+
+    return ckpt;
+}
+
+uint64_t* ckptMap(checkpoint* ckpt, int chip) {
+    return (uint64_t*) (ckpt->base + ckpt->chips[chip].mapOffset);
+}
+
+uint8_t* ckptSeen(checkpoint* ckpt, int chip) {
+    return ckpt->base + ckpt->chips[chip].seenOffset;
+}
+
+void ckptRestore(checkpoint* ckpt, allEEPROMs* population) {
+    for (int i = 0; i < (int) ckpt->header->numChips; i++) {
+        EEPROM* current = &population->all[i];
+        ckptChip* saved = &ckpt->chips[i];
+
+        current->i2cAddr = -1;
+
+        // same as initEEPROMs hands out
+        current->pattern.type = (patternType) ckpt->header->patternType;
+        current->pattern.seed = ckpt->header->patternSeed + i;
+
+        if (!saved->present) {
+            continue;
+        }
+
+        failMapAttach(&current->mems, ckptMap(ckpt, i), current->size);
+
+        if (flipMasksCreate(&current->seen, seenReserve(current), &population->mem) != 0) {
+            printf("Out of memory for EEPROM %d in bank %d\n", eepromNum(current), current->bank);
+        }
+
+        // the seen masks back the way they were, only the failed bytes can have anything reported
+        const uint8_t* reported = ckptSeen(ckpt, i);
+
+        for (int w = 0; current->seen.keys != NULL && w < (current->size + 63) / 64; w++) {
+            for (uint64_t bits = current->mems.words[w]; bits != 0; bits &= bits - 1) {
+                int addr = w * 64 + __builtin_ctzll(bits);
+                uint8_t* seen = reported[addr] != 0 ? flipMasksSlot(&current->seen, (uint32_t) addr) : NULL;
+
+                if (seen != NULL) {
+                    *seen = reported[addr];
+                }
+            }
+        }
+
+        current->failures = current->mems.count;
+        current->multiBit = saved->multiBit;
+        current->misreads = saved->misreads;
+        current->stuckBits = saved->stuckBits;
+        memcpy(current->bitFlips, saved->bitFlips, sizeof(current->bitFlips));
+    }
+}
+
+void ckptSaveChip(checkpoint* ckpt, int chip, const EEPROM* current) {
+    ckptChip* saved = &ckpt->chips[chip];
+
+    saved->present = current->mems.words != NULL;
+    saved->failures = current->failures;
+    saved->multiBit = current->multiBit;
+    saved->misreads = current->misreads;
+    saved->stuckBits = current->stuckBits;
+    memcpy(saved->bitFlips, current->bitFlips, sizeof(saved->bitFlips));
+}
+
+void ckptInitDone(checkpoint* ckpt) {
+    ckpt->header->initDone = 1;
+    msync(ckpt->base, ckpt->len, MS_SYNC);
+}
+
+void ckptSync(checkpoint* ckpt) {
+    msync(ckpt->base, ckpt->len, MS_ASYNC);
+}
+
+void ckptFlush(checkpoint* ckpt) {
+    msync(ckpt->base, ckpt->len, MS_SYNC);
+}
+
+void ckptClose(checkpoint* ckpt, bool clean) {
+    if (ckpt == NULL) {
+        return;
+    }
+
+    if (ckpt->base != NULL) {
+        if (clean) {
+            ckpt->header->cleanExit = 1;
+        }
+
+        msync(ckpt->base, ckpt->len, MS_SYNC);
+        munmap(ckpt->base, ckpt->len);
+    }
+
+    close(ckpt->fd);
+    free(ckpt);
+}
@@ -0,0 +1,105 @@
+/*
+
+Checkpoint for EEPROM Control
+
+All the failure state lives in an mmap'd file ("board N state.bin") that gets
+updated in place while we scan: the failure maps and the bits already reported
+for each failed byte are the file itself, and the counters and where each
+chip's sweep got to are copied in after every block. If the
+program dies the kernel still has the pages, so the next start picks up where
+it left off instead of re-filling the chips and wiping the evidence.
+
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "radpi.h"
+
+#define CKPT_MAGIC "RADCKPT1"
+#define CKPT_VERSION 5
+
+typedef struct {
+    char magic[8];        // CKPT_MAGIC, no terminator
+    uint32_t version;
+    uint32_t board;
+    uint32_t numChips;
+    uint32_t patternType;
+    uint32_t patternSeed;
+    uint32_t initDone;    // every chip got filled, safe to resume from
+    uint32_t cleanExit;   // last run finished on its own, nothing to resume
+    uint32_t reserved;    // keeps the chips 8 byte aligned
+} ckptHeader;
+
+// where a chip is has to match too, or we'd be comparing one chip against another's map
+typedef struct {
+    int32_t size;         // bytes in the chip, the map layout depends on it
+    int32_t bank;
+    int32_t devAddr;
+    int32_t busNum;
+    int32_t addrBytes;
+    int32_t present;      // got initialized and has a failure map
+    int32_t failures;
+    int32_t multiBit;
+    uint32_t bitFlips[8][2];
+    int32_t cursor;       // next address its sweep will read
+    int32_t misreads;
+    int32_t stuckBits;
+    int32_t reserved;
+    uint64_t mapOffset;   // where its failure map starts in the file
+    uint64_t seenOffset;  // where its reported bits start, a byte per address
+} ckptChip;
+
+// What a checkpoint has to match to be resumed from
+typedef struct {
+    int board;
+    const boardTopology* topo;
+    uint32_t patternType;
+    uint32_t patternSeed;
+} ckptLayout;
+
+struct checkpoint {
+    int fd;
+    uint8_t* base;
+    size_t len;
+    ckptHeader* header;
+    ckptChip* chips;
+};
+
+// Open the state file. *resumed says whether there was an unfinished run to
+// pick up, otherwise (or with fresh) it starts out empty. NULL if it can't be
+// used - including a leftover run that doesn't match layout.
+checkpoint* ckptOpen(const char* path, const ckptLayout* layout, bool fresh, bool* resumed);
+
+// Failure map storage for a chip, failMapBytes(size) long
+uint64_t* ckptMap(checkpoint* ckpt, int chip);
+
+// Bits already reported for every address of a chip, size bytes long
+uint8_t* ckptSeen(checkpoint* ckpt, int chip);
+
+// Put everything a resumed run needs back into the EEPROM structs
+void ckptRestore(checkpoint* ckpt, allEEPROMs* population);
+
+// Copy a chip's counters in
+void ckptSaveChip(checkpoint* ckpt, int chip, const EEPROM* current);
+
+static inline void ckptSetCursor(checkpoint* ckpt, int chip, int addr) {
+    ckpt->chips[chip].cursor = addr;
+}
+
+// initEEPROMs finished, from here on a restart resumes
+void ckptInitDone(checkpoint* ckpt);
+
+// Start writing dirty pages back (only matters if the power goes)
+void ckptSync(checkpoint* ckpt);
+
+// Same, but wait until they're on disk
+void ckptFlush(checkpoint* ckpt);
+
+// clean = the run finished, so the next start re-initializes like it used to
+void ckptClose(checkpoint* ckpt, bool clean);
+
+#endif
@@ -0,0 +1,210 @@
+/*
+
+Compare Kernels for EEPROM Control
+
+*/
+
+// Libraries
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "compare.h"
+#include "pattern.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// check a run of bytes one at a time - only used once we know something in it differs
+static int compareTail(const uint8_t* data, int from, int to, uint8_t expected, byteDiff* diffs, int n, int maxDiffs) {
+    for (int i = from; i < to && n < maxDiffs; i++) {
+        uint8_t diff = data[i] ^ expected;
+
+        if (diff != 0) {
+            diffs[n].offset = i;
+            diffs[n].diff = diff;
+            diffs[n].data = data[i];
+            n++;
+        }
+    }
+
+    return n;
+}
+
+int compareBlockScalar(const uint8_t* data, int len, uint8_t expected, byteDiff* diffs, int maxDiffs) {
+    return compareTail(data, 0, len, expected, diffs, 0, maxDiffs);
+}
+
+/*
+64 bytes per step: XOR against the expected byte, OR the lanes together and
+only drop into the byte loop if anything at all is set
+*/
+int compareBlock(const uint8_t* data, int len, uint8_t expected, byteDiff* diffs, int maxDiffs) {
+    int n = 0;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i want = _mm_set1_epi8((char) expected);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 64 <= len && n < maxDiffs; i += 64) {
+        __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + i)), want);
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + i + 16)), want);
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + i + 32)), want);
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + i + 48)), want);
+        __m128i any = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) {
+            n = compareTail(data, i, i + 64, expected, diffs, n, maxDiffs);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t want = vdupq_n_u8(expected);
+
+    for (; i + 64 <= len && n < maxDiffs; i += 64) {
+        uint8x16_t x0 = veorq_u8(vld1q_u8(data + i), want);
+        uint8x16_t x1 = veorq_u8(vld1q_u8(data + i + 16), want);
+        uint8x16_t x2 = veorq_u8(vld1q_u8(data + i + 32), want);
+        uint8x16_t x3 = veorq_u8(vld1q_u8(data + i + 48), want);
+        uint64x2_t any = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(x0, x1), vorrq_u8(x2, x3)));
+
+        if ((vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) != 0) {
+            n = compareTail(data, i, i + 64, expected, diffs, n, maxDiffs);
+        }
+    }
+#else
+    const uint64_t want = 0x0101010101010101ULL * expected;
+
+    for (; i + 64 <= len && n < maxDiffs; i += 64) {
+        uint64_t w[8];
+        memcpy(w, data + i, sizeof(w));
+
+        uint64_t any = (w[0] ^ want) | (w[1] ^ want) | (w[2] ^ want) | (w[3] ^ want) |
+                       (w[4] ^ want) | (w[5] ^ want) | (w[6] ^ want) | (w[7] ^ want);
+
+        if (any != 0) {
+            n = compareTail(data, i, i + 64, expected, diffs, n, maxDiffs);
+        }
+    }
+#endif
+
+    if (i < len) {
+        n = compareTail(data, i, len, expected, diffs, n, maxDiffs);
+    }
+
+    return n;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// does any byte of a 64 byte group differ from want
+static inline int groupDiffers(const uint8_t* data, const uint8_t* want) {
+#if defined(__SSE2__)
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) data), _mm_loadu_si128((const __m128i*) want));
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + 16)), _mm_loadu_si128((const __m128i*) (want + 16)));
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + 32)), _mm_loadu_si128((const __m128i*) (want + 32)));
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + 48)), _mm_loadu_si128((const __m128i*) (want + 48)));
+    __m128i any = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF;
+#elif defined(__ARM_NEON)
+    uint8x16_t x0 = veorq_u8(vld1q_u8(data), vld1q_u8(want));
+    uint8x16_t x1 = veorq_u8(vld1q_u8(data + 16), vld1q_u8(want + 16));
+    uint8x16_t x2 = veorq_u8(vld1q_u8(data + 32), vld1q_u8(want + 32));
+    uint8x16_t x3 = veorq_u8(vld1q_u8(data + 48), vld1q_u8(want + 48));
+    uint64x2_t any = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(x0, x1), vorrq_u8(x2, x3)));
+
+    return (vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) != 0;
+#else
+    uint64_t d[8], w[8];
+    memcpy(d, data, sizeof(d));
+    memcpy(w, want, sizeof(w));
+
+    return ((d[0] ^ w[0]) | (d[1] ^ w[1]) | (d[2] ^ w[2]) | (d[3] ^ w[3]) |
+            (d[4] ^ w[4]) | (d[5] ^ w[5]) | (d[6] ^ w[6]) | (d[7] ^ w[7])) != 0;
+#endif
+}
+
+// byte loop against an expected buffer, offsets reported relative to base
+static int compareTailBuf(const uint8_t* data, const uint8_t* want, int count, int base, byteDiff* diffs, int n, int maxDiffs) {
+    for (int i = 0; i < count && n < maxDiffs; i++) {
+        uint8_t diff = data[i] ^ want[i];
+
+        if (diff != 0) {
+            diffs[n].offset = base + i;
+            diffs[n].diff = diff;
+            diffs[n].data = data[i];
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/*
+Same idea for any pattern. The expected data is made 64 bytes at a time into
+a buffer that stays in L1 - and for patterns that repeat inside 64 bytes it's
+only made once - so there's never a golden copy of the chip in memory.
+*/
+int comparePattern(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs) {
+    int period = patternPeriod(pat);
+
+    if (period == 1) {
+        return compareBlock(data, len, patternByte(pat, addr), diffs, maxDiffs);
+    }
+
+    uint8_t want[64] __attribute__((aligned(16)));
+    bool reuse = period > 0 && 64 % period == 0;
+    int n = 0;
+    int i = 0;
+
+    if (reuse) {
+        patternFill(pat, addr, want, 64);
+    }
+
+    for (; i + 64 <= len && n < maxDiffs; i += 64) {
+        if (!reuse) {
+            patternFill(pat, addr + i, want, 64);
+        }
+
+        if (groupDiffers(data + i, want)) {
+            n = compareTailBuf(data + i, want, 64, i, diffs, n, maxDiffs);
+        }
+    }
+
+    if (i < len && n < maxDiffs) {
+        patternFill(pat, addr + i, want, len - i);
+        n = compareTailBuf(data + i, want, len - i, i, diffs, n, maxDiffs);
+    }
+
+    return n;
+}
+
+int comparePatternScalar(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs) {
+    int n = 0;
+
+    for (int i = 0; i < len && n < maxDiffs; i++) {
+        uint8_t diff = data[i] ^ patternByte(pat, addr + i);
+
+        if (diff != 0) {
+            diffs[n].offset = i;
+            diffs[n].diff = diff;
+            diffs[n].data = data[i];
+            n++;
+        }
+    }
+
+    return n;
+}
+
+const char* compareKernelName(void) {
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "u64";
+#endif
+}
@@ -0,0 +1,44 @@
+/*
+
+Compare Kernels for EEPROM Control
+
+XOR a block of read data against what should be there and hand back only the
+bytes that differ. Clean data is skipped 64 bytes at a time with SSE2 or NEON
+(plain 64-bit words otherwise), so the compare keeps up with bulk reads.
+
+*/
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdint.h>
+#include "pattern.h"
+
+// one byte that didn't match
+typedef struct {
+    int offset;           // where in the block
+    uint8_t diff;         // read ^ expected, set bits are flipped bits
+    uint8_t data;         // what we actually read
+} byteDiff;
+
+/*
+Compare len bytes against expected. Writes at most maxDiffs differences and
+returns how many it wrote - if that's maxDiffs, call again starting after the
+last offset to get the rest.
+*/
+int compareBlock(const uint8_t* data, int len, uint8_t expected, byteDiff* diffs, int maxDiffs);
+
+// byte at a time reference version, same results
+int compareBlockScalar(const uint8_t* data, int len, uint8_t expected, byteDiff* diffs, int maxDiffs);
+
+/*
+Same thing against any test pattern, data being what was read from addr on.
+Expected bytes are generated as it goes rather than stored.
+*/
+int comparePattern(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs);
+int comparePatternScalar(const testPattern* pat, uint32_t addr, const uint8_t* data, int len, byteDiff* diffs, int maxDiffs);
+
+// which kernel compareBlock is using
+const char* compareKernelName(void);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+
+Run Control for EEPROM Control
+
+The signal handler and the control socket. Neither is anywhere near the hot
+path: the handler only sets a flag, and the control thread spends its life in
+poll() waiting for somebody to connect.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// the handler can't be handed anything, and there's only ever one run per process
+static runControl* signalled = NULL;
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// a lock free atomic store is all that's safe in here, the readers see it within a slice
+static void onSignal(int sig) {
+    (void) sig;
+
+    atomic_store(&signalled->stop, true);
+}
+
+void controlInit(runControl* ctl, int runSeconds, int rateKBps) {
+    atomic_init(&ctl->stop, false);
+    atomic_init(&ctl->paused, false);
+    atomic_init(&ctl->rateKBps, rateKBps);
+    atomic_init(&ctl->flushes, 0);
+    atomic_init(&ctl->flushed, 0);
+    atomic_init(&ctl->snapshots, 0);
+    atomic_init(&ctl->done, false);
+    ctl->startNs = nowNs();
+    ctl->runSeconds = runSeconds;
+    ctl->fd = -1;
+    ctl->path[0] = '\0';
+}
+
+void controlSignals(runControl* ctl) {
+    struct sigaction sa;
+
+    signalled = ctl;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigemptyset(&sa.sa_mask);
+
+    // back to the default after the first one, so a second ^C still gets out of a wedged drain
+    sa.sa_flags = SA_RESETHAND;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// one command in, one line of answer out
+static void controlCommand(runControl* ctl, const char* line, char* reply, size_t len) {
+    int value;
+
+    if (strcmp(line, "pause") == 0) {
+        atomic_store(&ctl->paused, true);
+        snprintf(reply, len, "ok paused\n");
+    } else if (strcmp(line, "resume") == 0) {
+        atomic_store(&ctl->paused, false);
+        snprintf(reply, len, "ok running\n");
+    } else if (sscanf(line, "rate %d", &value) == 1 && value >= 0) {
+        atomic_store(&ctl->rateKBps, value);
+        snprintf(reply, len, value > 0 ? "ok rate %d KB/s per bus\n" : "ok rate unlimited\n", value);
+    } else if (strcmp(line, "flush") == 0) {
+        unsigned want = atomic_fetch_add(&ctl->flushes, 1) + 1;
+        uint64_t giveUpNs = nowNs() + CONTROL_FLUSH_MS * 1000000ULL;
+
+        // only the log thread can touch the log, so it does the work and we wait for it
+        while ((int) (atomic_load(&ctl->flushed) - want) < 0 && nowNs() < giveUpNs) {
+            usleep(1000);
+        }
+
+        snprintf(reply, len, (int) (atomic_load(&ctl->flushed) - want) >= 0 ? "ok flushed\n" : "error the log thread didn't get to it\n");
+    } else if (strcmp(line, "snapshot") == 0) {
+        // compare picks it up as each chip's sweep comes back round to the start
+        snprintf(reply, len, "ok snapshot %u on the next sweep\n", atomic_fetch_add(&ctl->snapshots, 1) + 1);
+    } else if (strcmp(line, "status") == 0) {
+        double inSec = (nowNs() - ctl->startNs) / 1e9;
+
+        snprintf(reply, len, "ok %s rateKBps %d seconds %.0f left %.0f\n",
+            atomic_load(&ctl->stop) ? "stopping" : atomic_load(&ctl->paused) ? "paused" : "running", atomic_load(&ctl->rateKBps),
+            inSec, ctl->runSeconds > 0 ? (ctl->runSeconds > inSec ? ctl->runSeconds - inSec : 0) : -1.0);
+    } else if (strcmp(line, "stop") == 0) {
+        atomic_store(&ctl->stop, true);
+        snprintf(reply, len, "ok stopping\n");
+    } else {
+        snprintf(reply, len, "error try pause, resume, rate N, flush, snapshot, status or stop\n");
+    }
+}
+
+// one client at a time, for as long as it stays connected (or the run lasts)
+static void controlClient(runControl* ctl, int client) {
+    char buf[CONTROL_LINE];
+    size_t used = 0;
+
+    while (!atomic_load(&ctl->done)) {
+        struct pollfd pfd = { client, POLLIN, 0 };
+
+        if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) {
+            continue;
+        }
+
+        ssize_t got = read(client, buf + used, sizeof(buf) - 1 - used);
+
+        if (got <= 0) {
+            return;
+        }
+
+        used += (size_t) got;
+        buf[used] = '\0';
+
+        char* line = buf;
+        char* nl;
+
+        while ((nl = strchr(line, '\n')) != NULL) {
+            char reply[CONTROL_LINE];
+
+            *nl = '\0';
+
+            if (nl > line && nl[-1] == '\r') {
+                nl[-1] = '\0';
+            }
+
+            controlCommand(ctl, line, reply, sizeof(reply));
+
+            // they hung up before the answer, nothing to do about it
+            if (send(client, reply, strlen(reply), MSG_NOSIGNAL) < 0) {
+                return;
+            }
+
+            line = nl + 1;
+        }
+
+        // keep the half line for next time, and don't let one with no end fill the buffer
+        used = strlen(line);
+        memmove(buf, line, used);
+
+        if (used == sizeof(buf) - 1) {
+            used = 0;
+        }
+    }
+}
+
+static void* controlThread(void* arg) {
+    runControl* ctl = (runControl*) arg;
+
+    while (!atomic_load(&ctl->done)) {
+        struct pollfd pfd = { ctl->fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) {
+            continue;
+        }
+
+        int client = accept(ctl->fd, NULL, NULL);
+
+        if (client >= 0) {
+            controlClient(ctl, client);
+            close(client);
+        }
+    }
+
+    return NULL;
+}
+
+static bool controlAddr(struct sockaddr_un* addr, const char* path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return false;
+    }
+
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+
+    return true;
+}
+
+bool controlInUse(const char* path) {
+    struct sockaddr_un addr;
+
+    if (!controlAddr(&addr, path)) {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    // somebody answering on it means another run is using it
+    bool answered = connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+
+    close(fd);
+
+    return answered;
+}
+
+int controlOpen(runControl* ctl, const char* path) {
+    struct sockaddr_un addr;
+
+    if (!controlAddr(&addr, path)) {
+        printf("Control socket path %s is too long\n", path);
+
+        return -1;
+    }
+
+    if (controlInUse(path)) {
+        printf("Something's already listening on %s\n", path);
+
+        return -1;
+    }
+
+    // anything else is left over from one that died
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        printf("Failed to open control socket %s\n", path);
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    ctl->fd = fd;
+    snprintf(ctl->path, sizeof(ctl->path), "%s", path);
+
+    if (pthread_create(&ctl->thread, NULL, controlThread, ctl) != 0) {
+        close(fd);
+        unlink(path);
+        ctl->fd = -1;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void controlClose(runControl* ctl) {
+    atomic_store(&ctl->done, true);
+
+    if (ctl->fd < 0) {
+        return;
+    }
+
+    pthread_join(ctl->thread, NULL);
+    close(ctl->fd);
+    unlink(ctl->path);
+    ctl->fd = -1;
+}
@@ -0,0 +1,79 @@
+/*
+
+Run Control for EEPROM Control
+
+Everything about a run that can change while it's going: stopping early
+(SIGINT/SIGTERM or "stop"), pausing the bus, a cap on how fast every bus
+reads, and forcing the log and checkpoints out to disk. The signal handler and
+the control thread are the only writers; the pipeline just loads them, one
+relaxed atomic per slice.
+
+The control socket is a Unix stream socket next to the logs ("board N
+control.sock"), one command per line and one line back:
+
+    pause        readers stop touching the bus, compare and the log keep draining
+    resume
+    rate N       cap every bus at N KB/s, 0 = flat out
+    flush        commit the event log and sync every checkpoint, answers once it's done
+    snapshot     keep the next full sweep of every chip (see snapshot.h)
+    status       running or paused, the cap, seconds in and seconds left
+    stop         same as SIGTERM
+
+    echo pause | nc -U "board 7 control.sock"
+
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/un.h>
+
+// How often the control thread looks up from the socket to see if the run's over
+#define CONTROL_POLL_MS 100
+
+// Longest command
+#define CONTROL_LINE 128
+
+// Longest "flush" waits for the log thread to get to it
+#define CONTROL_FLUSH_MS 5000
+
+typedef struct {
+    atomic_bool stop;     // wind down: drain, final checkpoint, exit
+    atomic_bool paused;
+    atomic_int rateKBps;  // per bus, 0 = no cap
+    atomic_uint flushes;  // bumped by every "flush"
+    atomic_uint flushed;  // flushes the log thread has done
+    atomic_uint snapshots; // snapshots asked for, by "snapshot" or the --snapshot-min timer
+    atomic_bool done;     // the run's over, the control thread can go
+    uint64_t startNs;     // monotonic, when scanning started
+    int runSeconds;       // 0 = until stopped
+    int fd;               // listening socket, -1 = none
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    pthread_t thread;
+} runControl;
+
+void controlInit(runControl* ctl, int runSeconds, int rateKBps);
+
+// SIGINT/SIGTERM ask for a stop instead of killing us (a second one still does)
+void controlSignals(runControl* ctl);
+
+// Is another run answering on path? A socket file nobody answers is left over from one that died
+bool controlInUse(const char* path);
+
+// Answer commands on path until controlClose, -1 if the socket can't be made (or controlInUse)
+int controlOpen(runControl* ctl, const char* path);
+
+// Stop answering and take the socket away
+void controlClose(runControl* ctl);
+
+// Time's up or somebody asked us to stop
+static inline bool controlStopped(runControl* ctl, uint64_t nowNs) {
+    return atomic_load_explicit(&ctl->stop, memory_order_relaxed) ||
+        (ctl->runSeconds > 0 && nowNs - ctl->startNs > (uint64_t) ctl->runSeconds * 1000000000ULL);
+}
+
+#endif
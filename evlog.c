@@ -0,0 +1,224 @@
+/*
+
+Binary Event Log for EEPROM Control
+
+The file stays open for the whole run. Records pile up in a buffer and get
+group committed - one write() and one fdatasync() for the whole batch - once
+the batch is full or the commit interval runs out, so a beam run only ever
+loses the last interval and never pays to reopen the file. A torn record
+left at the end by a crash is cut off the next time the log is opened.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "evlog.h"
+
+// the file format depends on these not moving
+_Static_assert(sizeof(evlogHeader) == 32, "evlogHeader layout changed");
+_Static_assert(sizeof(evlogRecord) == 24, "evlogRecord layout changed");
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*) data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+bool evlogHeaderValid(const evlogHeader* header) {
+    return memcmp(header->magic, EVLOG_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == EVLOG_VERSION &&
+        header->recordSize == sizeof(evlogRecord) &&
+        header->headerSize == sizeof(evlogHeader);
+}
+
+evlogConfig evlogDefaults(void) {
+    evlogConfig cfg = {
+        .intervalMs = 1000,
+        .batchRecords = 4096,
+    };
+
+    return cfg;
+}
+
+/*
+New file -> write the header. Existing file -> make sure it's one of ours
+from the same board and trim any half written record off the end.
+*/
+evlog* evlogOpen(const char* path, int board, const evlogConfig* cfg) {
+    if (cfg->batchRecords <= 0 || cfg->intervalMs < 0) {
+        return NULL;
+    }
+
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+
+        return NULL;
+    }
+
+    if (st.st_size == 0) {
+        evlogHeader header = { 0 };
+
+        memcpy(header.magic, EVLOG_MAGIC, sizeof(header.magic));
+        header.version = EVLOG_VERSION;
+        header.recordSize = sizeof(evlogRecord);
+        header.board = (uint16_t) board;
+        header.headerSize = sizeof(evlogHeader);
+
+        if (!writeAll(fd, &header, sizeof(header))) {
+            close(fd);
+
+            return NULL;
+        }
+    } else {
+        evlogHeader header;
+
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || !evlogHeaderValid(&header) || header.board != board) {
+            printf("%s isn't an event log for board %d\n", path, board);
+            close(fd);
+
+            return NULL;
+        }
+
+        off_t torn = (st.st_size - sizeof(evlogHeader)) % sizeof(evlogRecord);
+
+        if (torn != 0 && ftruncate(fd, st.st_size - torn) != 0) {
+            close(fd);
+
+            return NULL;
+        }
+    }
+
+    evlog* log = (evlog*) calloc(1, sizeof(evlog));
+
+    if (log == NULL) {
+        close(fd);
+
+        return NULL;
+    }
+
+    log->buf = (evlogRecord*) malloc(cfg->batchRecords * sizeof(evlogRecord));
+
+    if (log->buf == NULL) {
+        free(log);
+        close(fd);
+
+        return NULL;
+    }
+
+    log->fd = fd;
+    log->board = (uint16_t) board;
+    log->cfg = *cfg;
+    log->lastCommitNs = nowNs();
+
+    return log;
+}
+
+bool evlogAppend(evlog* log, const evlogRecord* rec) {
+    log->buf[log->used] = *rec;
+
+    if (log->board != EVLOG_FLEET) {
+        log->buf[log->used].board = log->board;
+    }
+
+    log->used++;
+
+    if (log->used == log->cfg.batchRecords) {
+        return evlogCommit(log);
+    }
+
+    return true;
+}
+
+bool evlogTick(evlog* log) {
+    if (log->used == 0 || log->cfg.intervalMs == 0) {
+        return true;
+    }
+
+    if (nowNs() - log->lastCommitNs < (uint64_t) log->cfg.intervalMs * 1000000ULL) {
+        return true;
+    }
+
+    return evlogCommit(log);
+}
+
+bool evlogCommit(evlog* log) {
+    uint64_t start = nowNs();
+
+    log->lastCommitNs = start;
+
+    if (log->used == 0) {
+        return true;
+    }
+
+    bool ok = writeAll(log->fd, log->buf, log->used * sizeof(evlogRecord)) && fdatasync(log->fd) == 0;
+    uint64_t took = nowNs() - start;
+
+    statAdd(&log->stats.commits, 1);
+    statAdd(&log->stats.totalNs, took);
+    statMax(&log->stats.maxNs, took);
+    histAdd(&log->stats.commitHist, took);
+
+    if (ok) {
+        statAdd(&log->stats.records, (uint64_t) log->used);
+    } else {
+        statAdd(&log->stats.failures, 1);
+    }
+
+    // on failure whatever was buffered is gone, better than wedging the logger
+    log->used = 0;
+
+    return ok;
+}
+
+void evlogClose(evlog* log) {
+    if (log == NULL) {
+        return;
+    }
+
+    evlogCommit(log);
+    close(log->fd);
+    free(log->buf);
+    free(log);
+}
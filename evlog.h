@@ -0,0 +1,119 @@
+/*
+
+Binary Event Log for EEPROM Control
+
+Replaces the per-pass text CSVs with fixed width records appended to one file
+per board. A flipped byte is one 24 byte record instead of a text line for
+every bit, and nothing has to be parsed to read it back. evlog2csv turns a
+log back into the old CSVs.
+
+File layout: evlogHeader once, then evlogRecords back to back. Every run
+appends an EV_START record first so runs can be told apart. Everything is
+stored in host byte order (little endian on the Pi and x86).
+
+A fleet log (one process driving several boards, "fleet events.bin") has
+EVLOG_FLEET as its board. Its records keep whatever board they were appended
+with, and every board gets its own EV_START at the start of a run.
+
+*/
+
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stats.h"
+
+#define EVLOG_MAGIC "RADEVLOG"
+#define EVLOG_VERSION 1
+
+// Header board of a log that holds several boards, each record has its own
+#define EVLOG_FLEET 0xFFFF
+
+// What a record is
+enum {
+    EV_START,             // run started: ns = wall clock in ns, count = pattern seed
+    EV_FLIP,              // bits in mask flipped at addr, data is what the byte read as, count = the ones that are stuck
+    EV_CHIP,              // chip finished a pass, count = failures so far
+    EV_PASS,              // every chip got swept at least once since the last one
+    EV_SLICE,             // count bytes from addr came off the bus at ns, mask = EV_SLICE_* bits
+    EV_QUARANTINE,        // mask = 1: chip taken out of the scan, next try in count ms. mask = 0: it's back
+    EV_MISREAD,           // bits in mask read wrong once but not when re-read, data is the bad read
+};
+
+// EV_SLICE mask bits
+#define EV_SLICE_FAILED 0x01 // the read failed, nothing in it got compared
+#define EV_SLICE_HOT 0x02    // an extra read of a hot region, not the sweep
+
+typedef struct {
+    char magic[8];        // EVLOG_MAGIC, no terminator
+    uint16_t version;
+    uint16_t recordSize;  // sizeof(evlogRecord) when it was written
+    uint16_t board;
+    uint16_t headerSize;  // sizeof(evlogHeader) when it was written
+    uint32_t reserved[4];
+} evlogHeader;
+
+typedef struct {
+    uint64_t ns;          // since logging started (EV_START: wall clock)
+    uint32_t addr;        // byte address in the chip
+    uint32_t count;       // depends on kind
+    uint16_t board;
+    uint8_t kind;
+    uint8_t bank;
+    uint8_t eeprom;
+    uint8_t mask;         // bits that flipped
+    uint8_t data;         // what the byte read as, so mask & data are the 0->1's
+    uint8_t pattern;      // patternType the chip was filled with
+} evlogRecord;
+
+// When buffered records get committed (written + fdatasync'd)
+typedef struct {
+    int intervalMs;       // commit anything waiting at least this often, 0 = only when the batch is full
+    int batchRecords;     // commit as soon as this many are waiting
+} evlogConfig;
+
+// How the commits have been going, only the log's writer updates them (see stats.h)
+typedef struct {
+    uint64_t commits;
+    uint64_t records;     // records made durable
+    uint64_t failures;    // commits that didn't make it to disk
+    uint64_t totalNs;     // time spent in write + fdatasync
+    uint64_t maxNs;
+    latHist commitHist;   // write + fdatasync per commit
+} evlogStats;
+
+typedef struct {
+    int fd;
+    uint16_t board;
+    evlogConfig cfg;
+    evlogRecord* buf;     // cfg.batchRecords long
+    int used;
+    uint64_t lastCommitNs;
+    evlogStats stats;
+} evlog;
+
+// Commit every second or every 4096 records, whichever comes first
+evlogConfig evlogDefaults(void);
+
+// Open (or create) the log for a board, ready to append
+evlog* evlogOpen(const char* path, int board, const evlogConfig* cfg);
+
+// Buffer one record, commits the batch once it's full
+bool evlogAppend(evlog* log, const evlogRecord* rec);
+
+// Commit if the interval is up - call this whenever there's nothing to append
+bool evlogTick(evlog* log);
+
+// Write out and fdatasync whatever's buffered
+bool evlogCommit(evlog* log);
+
+// Commit and close
+void evlogClose(evlog* log);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Check a header read off the front of a file
+bool evlogHeaderValid(const evlogHeader* header);
+
+#endif
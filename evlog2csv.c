@@ -0,0 +1,183 @@
+/*
+
+Event Log to CSV for EEPROM Control
+
+Streams a "board N events.bin" back out as the CSVs the logger used to write:
+
+    ./evlog2csv "board 7 events.bin" > "board 7 data.csv"
+    ./evlog2csv --flips "board 7 events.bin" > "board 7 flips.csv"
+    ./evlog2csv --slices "board 7 events.bin" > "board 7 slices.csv"
+    ./evlog2csv --quarantine "board 7 events.bin" > "board 7 quarantine.csv"
+    ./evlog2csv --board 7 "fleet events.bin" > "board 7 data.csv"
+
+A fleet log has every board in it, so it needs --board to say which one.
+The log is read a block of records at a time so it doesn't matter how long
+the run was. Every run in the log starts with its own header line, same as
+appending to the CSVs did.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "evlog.h"
+
+// records pulled off the file per read
+#define CONVERT_BLOCK 4096
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void writeDataLine(FILE* out, const evlogRecord* rec) {
+    switch (rec->kind) {
+        case EV_START:
+            fprintf(out, "Elapsed Time, Bank, EEPROM, Failures\n");
+
+            break;
+        case EV_CHIP:
+            // elapsed seconds when the chip finished, same as time(NULL) - startTime used to give
+            fprintf(out, "%d, %d, %d, %d\n", (int) (rec->ns / 1000000000ULL), rec->bank, rec->eeprom, (int) rec->count);
+
+            break;
+    }
+}
+
+static void writeFlipLines(FILE* out, const evlogRecord* rec) {
+    switch (rec->kind) {
+        case EV_START:
+            fprintf(out, "Time (ns), Bank, EEPROM, Address, Bit, Direction, Kind\n");
+
+            break;
+        case EV_FLIP:
+        case EV_MISREAD:
+            // one line per bit like before, misreads are what the bad read looked like
+            for (int bit = 0; bit < 8; bit++) {
+                if (rec->mask & (1 << bit)) {
+                    const char* kind = rec->kind == EV_MISREAD ? "misread" : (rec->count >> bit) & 1 ? "stuck" : "upset";
+
+                    fprintf(out, "%llu, %d, %d, %u, %d, %s, %s\n", (unsigned long long) rec->ns, rec->bank, rec->eeprom, rec->addr, bit,
+                        (rec->data >> bit) & 1 ? "0->1" : "1->0", kind);
+                }
+            }
+
+            break;
+    }
+}
+
+// when every slice was read, so a flip can be pinned between two reads of its address
+static void writeSliceLine(FILE* out, const evlogRecord* rec) {
+    switch (rec->kind) {
+        case EV_START:
+            fprintf(out, "Time (ns), Bank, EEPROM, Start, Length, Read OK, Hot\n");
+
+            break;
+        case EV_SLICE:
+            fprintf(out, "%llu, %d, %d, %u, %u, %d, %d\n", (unsigned long long) rec->ns, rec->bank, rec->eeprom, rec->addr, rec->count,
+                !(rec->mask & EV_SLICE_FAILED), (rec->mask & EV_SLICE_HOT) != 0);
+
+            break;
+    }
+}
+
+// chips dropping out of the scan and coming back
+static void writeQuarantineLine(FILE* out, const evlogRecord* rec) {
+    switch (rec->kind) {
+        case EV_START:
+            fprintf(out, "Time (ns), Bank, EEPROM, Event, Retry In (ms)\n");
+
+            break;
+        case EV_QUARANTINE:
+            fprintf(out, "%llu, %d, %d, %s, %u\n", (unsigned long long) rec->ns, rec->bank, rec->eeprom,
+                rec->mask ? "quarantined" : "back", rec->count);
+
+            break;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool flips = false;
+    bool slices = false;
+    bool quarantine = false;
+    int board = -1;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--board") == 0 && i + 1 < argc) {
+            board = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--flips") == 0) {
+            flips = true;
+        } else if (strcmp(argv[i], "--slices") == 0) {
+            slices = true;
+        } else if (strcmp(argv[i], "--quarantine") == 0) {
+            quarantine = true;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (path == NULL) {
+        printf("Usage: %s [--flips | --slices | --quarantine] [--board N] LOG\n", argv[0]);
+
+        return -1;
+    }
+
+    FILE* in = fopen(path, "rb");
+
+    if (in == NULL) {
+        printf("Failed to open %s\n", path);
+
+        return -1;
+    }
+
+    evlogHeader header;
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || !evlogHeaderValid(&header)) {
+        printf("%s isn't an event log\n", path);
+        fclose(in);
+
+        return -1;
+    }
+
+    if (header.board == EVLOG_FLEET && board < 0) {
+        printf("%s is a fleet log, pick a board with --board N\n", path);
+        fclose(in);
+
+        return -1;
+    }
+
+    evlogRecord* block = (evlogRecord*) malloc(CONVERT_BLOCK * sizeof(evlogRecord));
+
+    if (block == NULL) {
+        fclose(in);
+
+        return -1;
+    }
+
+    size_t n;
+
+    // a torn record at the end just gets dropped by fread
+    while ((n = fread(block, sizeof(evlogRecord), CONVERT_BLOCK, in)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (board >= 0 && block[i].board != board) {
+                continue;
+            }
+
+            if (flips) {
+                writeFlipLines(stdout, &block[i]);
+            } else if (slices) {
+                writeSliceLine(stdout, &block[i]);
+            } else if (quarantine) {
+                writeQuarantineLine(stdout, &block[i]);
+            } else {
+                writeDataLine(stdout, &block[i]);
+            }
+        }
+    }
+
+    free(block);
+    fclose(in);
+
+    return 0;
+}
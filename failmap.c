@@ -0,0 +1,169 @@
+/*
+
+Failure Map for EEPROM Control
+
+*/
+
+// Libraries
+#include <stdlib.h>
+#include "failmap.h"
+
+size_t failMapBytes(int nbits) {
+    return ((size_t) (nbits + 63) / 64) * sizeof(uint64_t);
+}
+
+void failMapAttach(failMap* map, uint64_t* words, int nbits) {
+    map->words = words;
+    map->nbits = nbits;
+    map->owned = false;
+    map->count = failMapPopcount(map);
+}
+
+int failMapCreate(failMap* map, int nbits) {
+    uint64_t* words = (uint64_t*) calloc(1, failMapBytes(nbits));
+
+    if (words == NULL) {
+        return -1;
+    }
+
+    map->words = words;
+    map->nbits = nbits;
+    map->count = 0;
+    map->owned = true;
+
+    return 0;
+}
+
+void failMapFree(failMap* map) {
+    if (map->owned) {
+        free(map->words);
+    }
+
+    map->words = NULL;
+    map->nbits = 0;
+    map->count = 0;
+    map->owned = false;
+}
+
+int failMapPopcount(const failMap* map) {
+    int count = 0;
+    size_t nwords = failMapBytes(map->nbits) / sizeof(uint64_t);
+
+    for (size_t i = 0; i < nwords; i++) {
+        count += __builtin_popcountll(map->words[i]);
+    }
+
+    return count;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// slots for cap addresses, kept under 3/4 full
+static int flipMasksSlots(int cap) {
+    int size = 16;
+
+    while (size / 4 * 3 < cap) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+size_t flipMasksBytes(int cap) {
+    int size = flipMasksSlots(cap);
+
+    return arenaRound(size * sizeof(uint32_t)) + arenaRound(size * sizeof(uint8_t));
+}
+
+int flipMasksCreate(flipMasks* table, int cap, arena* mem) {
+    int size = flipMasksSlots(cap);
+
+    table->keys = NULL;
+    table->masks = NULL;
+    table->cap = size;
+    table->used = 0;
+    table->mem = mem;
+    table->owned = false;
+
+    // out of the arena if it's got room for both halves, so there's no malloc while scanning
+    if (mem != NULL && mem->size - atomic_load(&mem->used) >= flipMasksBytes(cap)) {
+        table->keys = (uint32_t*) arenaAlloc(mem, size * sizeof(uint32_t));
+        table->masks = (uint8_t*) arenaAlloc(mem, size * sizeof(uint8_t));
+    }
+
+    // a chip failing way past what the arena was sized for, or no arena at all
+    if (table->keys == NULL || table->masks == NULL) {
+        table->keys = (uint32_t*) calloc(size, sizeof(uint32_t));
+        table->masks = (uint8_t*) calloc(size, sizeof(uint8_t));
+        table->owned = true;
+    }
+
+    if (table->keys == NULL || table->masks == NULL) {
+        flipMasksFree(table);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void flipMasksFree(flipMasks* table) {
+    // arena tables go with the arena
+    if (table->owned) {
+        free(table->keys);
+        free(table->masks);
+    }
+
+    table->keys = NULL;
+    table->masks = NULL;
+    table->cap = 0;
+    table->used = 0;
+    table->owned = false;
+}
+
+static uint32_t flipMasksHash(uint32_t addr) {
+    return addr * 2654435761u;
+}
+
+// double the table and re-insert everything. The old one is only given back if it came off the heap
+static int flipMasksGrow(flipMasks* table) {
+    flipMasks bigger;
+
+    // twice the slots, at the same 3/4 limit
+    if (flipMasksCreate(&bigger, table->cap / 2 * 3, table->mem) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < table->cap; i++) {
+        if (table->keys[i] != 0) {
+            *flipMasksSlot(&bigger, table->keys[i] - 1) = table->masks[i];
+        }
+    }
+
+    flipMasksFree(table);
+    *table = bigger;
+
+    return 0;
+}
+
+uint8_t* flipMasksSlot(flipMasks* table, uint32_t addr) {
+    // keep it under 3/4 full
+    if ((table->used + 1) * 4 > table->cap * 3 && flipMasksGrow(table) != 0) {
+        return NULL;
+    }
+
+    uint32_t key = addr + 1;
+    uint32_t i = flipMasksHash(addr) & (table->cap - 1);
+
+    while (table->keys[i] != 0 && table->keys[i] != key) {
+        i = (i + 1) & (table->cap - 1);
+    }
+
+    if (table->keys[i] == 0) {
+        table->keys[i] = key;
+        table->masks[i] = 0;
+        table->used++;
+    }
+
+    return &table->masks[i];
+}
@@ -0,0 +1,80 @@
+/*
+
+Failure Map for EEPROM Control
+
+One bit per tracked byte address instead of a whole cell each. A 512k part
+takes 64 KB of map, so the maps for a full board sit comfortably in cache.
+
+*/
+
+#ifndef FAILMAP_H
+#define FAILMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+typedef struct {
+    uint64_t* words;      // packed bits, bit n of the map is words[n / 64] bit n % 64
+    int nbits;            // how many cells we track
+    int count;            // how many are set
+    bool owned;           // we calloc'd words and have to free them
+} failMap;
+
+// bytes of storage a map with nbits cells needs
+size_t failMapBytes(int nbits);
+
+// map over storage someone else owns (must be failMapBytes long); count is recomputed from it
+void failMapAttach(failMap* map, uint64_t* words, int nbits);
+
+// map with its own zeroed storage, -1 if out of memory
+int failMapCreate(failMap* map, int nbits);
+void failMapFree(failMap* map);
+
+// recount set bits from scratch
+int failMapPopcount(const failMap* map);
+
+// Sparse address -> flipped bits we've already reported. Only failed bytes
+// ever go in here so it stays tiny. Open addressing, key 0 means empty.
+typedef struct {
+    uint32_t* keys;       // address + 1
+    uint8_t* masks;
+    int cap;              // always a power of 2
+    int used;
+    arena* mem;           // where it grows from, NULL = the heap
+    bool owned;           // the current table came off the heap and has to be freed
+} flipMasks;
+
+// bytes of arena a table with room for cap addresses takes
+size_t flipMasksBytes(int cap);
+
+// empty table with room for cap addresses out of mem (the heap if that's NULL or full), -1 if out of memory
+int flipMasksCreate(flipMasks* table, int cap, arena* mem);
+void flipMasksFree(flipMasks* table);
+
+// mask slot for addr, inserted as 0 if it isn't there yet. NULL if out of memory
+uint8_t* flipMasksSlot(flipMasks* table, uint32_t addr);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static inline bool failMapTest(const failMap* map, int bit) {
+    return (map->words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// set a cell, true if it wasn't already set (i.e. a new failure)
+static inline bool failMapTestAndSet(failMap* map, int bit) {
+    uint64_t mask = 1ULL << (bit & 63);
+    uint64_t* word = &map->words[bit >> 6];
+
+    if (*word & mask) {
+        return false;
+    }
+
+    *word |= mask;
+    map->count++;
+
+    return true;
+}
+
+#endif
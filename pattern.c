@@ -0,0 +1,112 @@
+/*
+
+Test Patterns for EEPROM Control
+
+*/
+
+// Libraries
+#include <string.h>
+#include "pattern.h"
+
+static const char* patternNames[] = { "ff", "00", "checker", "addr", "prng" };
+
+// splitmix64 finalizer - one call gives 8 pattern bytes
+static uint64_t patternMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+    return x ^ (x >> 31);
+}
+
+uint8_t patternByte(const testPattern* pat, uint32_t addr) {
+    switch (pat->type) {
+        case PATTERN_FF:
+            return 0xFF;
+        case PATTERN_00:
+            return 0x00;
+        case PATTERN_CHECKER:
+            return (addr & 1) ? 0xAA : 0x55;
+        case PATTERN_ADDR:
+            return (uint8_t) (addr ^ (addr >> 8) ^ (addr >> 16) ^ (addr >> 24));
+        case PATTERN_PRNG:
+            return (uint8_t) (patternMix(((uint64_t) pat->seed << 32) | (addr >> 3)) >> (8 * (addr & 7)));
+    }
+
+    return 0xFF;
+}
+
+// the 8 pattern bytes from an 8 byte aligned addr, byte 0 in the low bits
+static uint64_t patternWord(const testPattern* pat, uint32_t addr) {
+    switch (pat->type) {
+        case PATTERN_CHECKER:
+            return 0xAA55AA55AA55AA55ULL;
+        case PATTERN_ADDR: {
+            // only the low 3 bits change inside the 8, so it's byte 0 XOR 0..7
+            uint64_t first = (uint8_t) (addr ^ (addr >> 8) ^ (addr >> 16) ^ (addr >> 24));
+
+            return first * 0x0101010101010101ULL ^ 0x0706050403020100ULL;
+        }
+        case PATTERN_PRNG:
+            return patternMix(((uint64_t) pat->seed << 32) | (addr >> 3));
+        default:
+            return patternByte(pat, addr) * 0x0101010101010101ULL;
+    }
+}
+
+void patternFill(const testPattern* pat, uint32_t addr, uint8_t* out, int len) {
+    int i = 0;
+
+    if (pat->type == PATTERN_FF || pat->type == PATTERN_00) {
+        memset(out, patternByte(pat, 0), len);
+
+        return;
+    }
+
+    // byte at a time up to an 8 byte boundary, then a whole word per 8 bytes
+    for (; i < len && ((addr + i) & 7) != 0; i++) {
+        out[i] = patternByte(pat, addr + i);
+    }
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word = patternWord(pat, addr + i);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(out + i, &word, 8);
+#else
+        for (int b = 0; b < 8; b++) {
+            out[i + b] = (uint8_t) (word >> (8 * b));
+        }
+#endif
+    }
+
+    for (; i < len; i++) {
+        out[i] = patternByte(pat, addr + i);
+    }
+}
+
+int patternPeriod(const testPattern* pat) {
+    switch (pat->type) {
+        case PATTERN_FF:
+        case PATTERN_00:
+            return 1;
+        case PATTERN_CHECKER:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+int patternParse(const char* name) {
+    for (int i = 0; i < (int) (sizeof(patternNames) / sizeof(patternNames[0])); i++) {
+        if (strcmp(name, patternNames[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char* patternName(patternType type) {
+    return patternNames[type];
+}
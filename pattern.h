@@ -0,0 +1,41 @@
+/*
+
+Test Patterns for EEPROM Control
+
+What every address is supposed to hold. All of these can be generated for any
+address range on the fly, so nothing needs a golden copy of the chip.
+
+*/
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+
+typedef enum {
+    PATTERN_FF,           // all 1s, only 1->0 flips show up
+    PATTERN_00,           // all 0s, only 0->1 flips show up
+    PATTERN_CHECKER,      // 0x55 on even addresses, 0xAA on odd
+    PATTERN_ADDR,         // low byte of the address folded with its upper bytes
+    PATTERN_PRNG,         // pseudo random, seeded per chip
+} patternType;
+
+typedef struct {
+    patternType type;
+    uint32_t seed;        // only used by PATTERN_PRNG
+} testPattern;
+
+// expected contents of addr .. addr + len - 1
+void patternFill(const testPattern* pat, uint32_t addr, uint8_t* out, int len);
+
+// expected byte at one address
+uint8_t patternByte(const testPattern* pat, uint32_t addr);
+
+// the whole pattern repeats every this many bytes (0 = never), anything dividing 64 lets the compare reuse one block
+int patternPeriod(const testPattern* pat);
+
+// "ff", "00", "checker", "addr", "prng" <-> patternType. -1 if unknown
+int patternParse(const char* name);
+const char* patternName(patternType type);
+
+#endif
@@ -0,0 +1,1276 @@
+/*
+
+Scan Pipeline for EEPROM Control
+
+The old logger() did bus reads, compares and fprintf's one after the other on
+one thread, so the bus sat idle whenever we were comparing or writing. Now
+it's three threads:
+
+    reader  -> fills blocks off the bus in the order scansched.c picks, and re-reads suspect bytes
+    compare -> diffs blocks against the pattern and keeps the failure maps
+    log     -> appends to the event log and group commits it
+
+hooked together with lock-free SPSC rings. Blocks come from a fixed pool and go
+back to the reader through their own ring once they've been compared.
+
+One read isn't enough to call a flip, a noisy transaction looks just the same.
+Bytes with bits that haven't been reported yet go back to the reader as
+suspects and get re-read readVotes times; only bits most of the re-reads agree
+on count. With --stuck-test those then get the right value written over them
+and read back - a bit that won't take it is stuck, the rest is an upset - and
+the upset value is put back so the chip stays the way the radiation left it.
+That's two write cycles per byte, so only STUCK_TESTS_PER_SLICE of them go
+between two slices.
+
+With banks spread over several buses every bus gets its own reader + compare
+pair (a shard) and they all feed the one log thread, so a sweep takes about as
+long as the slowest bus instead of the sum of them. Driving a fleet of boards
+is just more shards: every bus of every board gets its own pair, all on the
+same startNs, and the one log thread merges all of them into the one log.
+
+The readers also answer to control.h: they stop touching the bus while the
+run's paused, keep under the --rate cap, and wind down (everything already
+read still gets compared and logged) as soon as a stop is asked for. The log
+thread does the flushes asked for over the control socket, since it's the
+only one allowed to touch the log.
+
+Snapshots (snapshot.h) ride along on the same path: compare sends every wrong
+byte of a chip's snapshot sweep to the log thread, which encodes them and owns
+the files, the same way it owns the event log.
+
+A fourth thread wakes up every statsMs and writes every counter and histogram
+the others keep (stats.h) to the stats file, so a run can be watched while
+it's going without touching the hot path.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "radpi.h"
+#include "compare.h"
+#include "ring.h"
+#include "evlog.h"
+#include "checkpoint.h"
+#include "scansched.h"
+#include "stats.h"
+#include "control.h"
+#include "snapshot.h"
+
+// Blocks in flight between reader and compare
+#define PIPE_BLOCKS 16
+
+// Log records that can be waiting on the disk
+#define PIPE_LOG_RECORDS 16384
+
+// Flipped regions compare can tell the reader about before it catches up
+#define PIPE_HEAT_HINTS 1024
+
+// Nap when every chip on the bus is quarantined
+#define PIPE_IDLE_US 10000
+
+// Bytes compare can ask the reader to re-read before it catches up
+#define PIPE_SUSPECTS 1024
+
+// How often the stats thread checks whether the run's over
+#define PIPE_STATS_POLL_US 50000
+
+// What a scanBlock carries
+enum {
+    BLOCK_DATA,           // len bytes read from chip starting at start
+    BLOCK_BAD_READ,       // the read failed, nothing in data
+    BLOCK_CHIP_DONE,      // finished a pass over chip
+    BLOCK_QUARANTINED,    // chip stopped answering, next try in len ms
+    BLOCK_REINSTATED,     // it's answering again
+    BLOCK_VOTES,          // len voteResults in data
+    BLOCK_PASS_DONE,      // finished a pass over the whole board
+    BLOCK_STOP,           // run is over
+};
+
+typedef struct {
+    int kind;
+    int chip;             // index into population->all
+    int start;            // first address in the block
+    int len;
+    bool hot;             // an extra read of a hot region, not part of the sweep
+    uint64_t readNs;      // when it came off the bus, relative to startNs
+    uint8_t* data;
+} scanBlock;
+
+// A byte compare wants re-read
+typedef struct {
+    int chip;
+    int addr;
+    uint8_t data;         // what it read as the first time
+} suspectByte;
+
+// What the re-reads made of it
+typedef struct {
+    int chip;
+    int addr;
+    uint8_t first;        // the read that made it a suspect
+    uint8_t voted;        // bit by bit majority of the re-reads
+    uint8_t stuck;        // flipped bits that didn't take the right value when written
+    uint8_t votes;        // re-reads that worked, 0 = couldn't get at it
+} voteResult;
+
+// What the log thread writes
+enum {
+    REC_FLIP,             // bits in a byte flipped
+    REC_SLICE,            // a slice came off the bus
+    REC_CHIP,             // a chip finished its sweep
+    REC_PASS,             // end of a pass, flush
+    REC_QUARANTINE,       // mask 1 = chip out (failures = ms until it's tried again), 0 = back in
+    REC_MISREAD,          // bits in mask read wrong once and never again
+    REC_SNAP_BEGIN,       // chip's sweep starts snapshot number failures
+    REC_SNAP_XOR,         // in the snapshot addr read as pattern ^ mask
+    REC_SNAP_UNREAD,      // failures bytes from addr didn't read
+    REC_SNAP_END,         // chip's snapshot sweep is over, mask 1 = it got all the way round
+    REC_STOP,
+};
+
+typedef struct {
+    int kind;
+    int bank;
+    int eeprom;
+    int addr;
+    uint8_t mask;         // bits that flipped
+    uint8_t data;         // what the byte read as
+    uint8_t pattern;
+    int failures;         // REC_CHIP, the length for REC_SLICE, stuck bits for REC_FLIP
+    uint64_t ns;
+    int chip;             // index into population->all, for the snapshot records
+} logRecord;
+
+typedef struct pipeline pipeline;
+
+// everything on one bus
+typedef struct {
+    pipeline* pipe;
+    allEEPROMs* population; // the board the bus is on
+    int bus;              // index into population->buses
+    scanBlock* pool;
+    spscRing freeBlocks;  // compare -> reader
+    spscRing fullBlocks;  // reader -> compare
+    spscRing records;     // compare -> log
+    spscRing heat;        // compare -> reader, chip << 16 | region that just had a flip
+    spscRing suspects;    // compare -> reader, bytes to vote on
+    scanSched sched;      // reader's
+    uint64_t votedBytes;  // reader's (stats.h), suspects it re-read
+    uint64_t voteNs;      // bus time that took
+    uint64_t stuckTests;  // confirmed bytes that got the stuck test
+    uint64_t stuckWrites; // write cycles those took
+    uint64_t stuckSkipped; // confirmed bytes past the per slice limit, logged untested
+    uint64_t startBytes;  // the bus's readBytes when the scan started, so init doesn't count
+    uint64_t paceNs;      // reader's, earliest the next slice can start under the rate cap
+    snapWriter* snaps;    // its board's, log thread only
+    pthread_t reader;
+    pthread_t compare;
+} pipeShard;
+
+struct pipeline {
+    allEEPROMs** boards;
+    int numBoards;
+    uint64_t startNs;     // every board's startNs
+    runControl* ctl;
+    evlog* log;
+    const char* statsPath;
+    atomic_bool done;     // everything but the stats thread has finished
+    pipeShard shards[MAX_BUSES * MAX_BOARDS];
+    int numShards;
+    snapWriter snaps[MAX_BOARDS]; // one per board
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static scanBlock* takeBlock(pipeShard* pipe) {
+    scanBlock* block;
+    int spins = 0;
+
+    while (!ringPop(&pipe->freeBlocks, &block)) {
+        ringWait(&spins);
+    }
+
+    return block;
+}
+
+static void sendBlock(pipeShard* pipe, scanBlock* block) {
+    int spins = 0;
+
+    while (!ringPush(&pipe->fullBlocks, &block)) {
+        ringWait(&spins);
+    }
+}
+
+// markers don't carry data but still go through the pool so ordering is kept
+static void sendMarker(pipeShard* pipe, int kind, int chip) {
+    scanBlock* block = takeBlock(pipe);
+
+    block->kind = kind;
+    block->chip = chip;
+    block->len = 0;
+    block->readNs = monoNs() - pipe->pipe->startNs;
+    sendBlock(pipe, block);
+}
+
+static void sendRecord(pipeShard* pipe, const logRecord* rec) {
+    int spins = 0;
+
+    while (!ringPush(&pipe->records, rec)) {
+        ringWait(&spins);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// bank switch (+ settle) and handle for a chip, false if it isn't answering
+static bool schedOpen(i2cBus* bus, schedChip* entry) {
+    // handles stay open for the whole run
+    if (entry->handle < 0) {
+        entry->handle = busSetup(bus, entry->devAddr);
+    }
+
+    if (entry->handle < 0) {
+        return false;
+    }
+
+    if (busSelectBank(bus, entry->bank)) {
+        busSettle(bus, entry->handle, entry->devAddr, entry->addrBytes, MUX_SETTLE_TIMEOUT_US);
+    }
+
+    return true;
+}
+
+// one block off the bus and over to compare, false if the read failed
+static bool readSlice(pipeShard* pipe, i2cBus* bus, schedChip* entry, int start, int len, bool hot) {
+    int rateKBps = atomic_load_explicit(&pipe->pipe->ctl->rateKBps, memory_order_relaxed);
+
+    // under a rate cap every slice gets len / rate of bus time, whatever's left over is waited out
+    uint64_t now = monoNs();
+
+    if (rateKBps > 0 && pipe->paceNs > now) {
+        usleep((useconds_t) ((pipe->paceNs - now) / 1000));
+    }
+
+    scanBlock* block = takeBlock(pipe);
+    uint64_t t0 = monoNs();
+
+    if (rateKBps > 0) {
+        pipe->paceNs = (pipe->paceNs > t0 ? pipe->paceNs : t0) + (uint64_t) len * 1000000ULL / (uint64_t) rateKBps;
+    }
+
+    block->chip = entry->chip;
+    block->start = start;
+    block->len = len;
+    block->hot = hot;
+    block->kind = busReadBlock(bus, entry->handle, entry->devAddr, entry->addrBytes, start, block->data, len) == 0
+        ? BLOCK_DATA : BLOCK_BAD_READ;
+    uint64_t t1 = monoNs();
+
+    block->readNs = t1 - pipe->pipe->startNs;
+
+    bool ok = block->kind == BLOCK_DATA;
+
+    histAdd(&entry->sliceHist, t1 - t0);
+    statAdd(ok ? &entry->bytesRead : &entry->readErrors, ok ? (uint64_t) len : 1);
+
+    sendBlock(pipe, block);
+
+    // the sweep still moves past a bad slice (schedAdvance), but its regions don't count as looked at
+    if (ok) {
+        schedRead(entry, start, len, monoNs());
+        schedOk(entry);
+    } else if (schedFailed(entry, monoNs())) {
+        // out of the rotation until its retry, so it stops costing a timeout every slice
+        scanBlock* marker = takeBlock(pipe);
+
+        marker->kind = BLOCK_QUARANTINED;
+        marker->chip = entry->chip;
+        marker->len = (int) (entry->backoffNs / 1000000ULL);
+        marker->readNs = monoNs() - pipe->pipe->startNs;
+        sendBlock(pipe, marker);
+    }
+
+    return ok;
+}
+
+// write one byte and wait the write cycle out
+static int writeByte(i2cBus* bus, schedChip* entry, int addr, uint8_t value) {
+    if (busWritePage(bus, entry->handle, entry->devAddr, entry->addrBytes, addr, &value, 1) != 0) {
+        return -1;
+    }
+
+    return busAckPoll(bus, entry->handle, entry->devAddr, entry->addrBytes, addr, WRITE_TIMEOUT_US);
+}
+
+/*
+Re-read one suspect byte readVotes times and take each bit's majority. If
+testStuck, bits that still come out flipped get the stuck test: write what
+should be there, read it back, then put the flipped value back. False if the
+stuck test wasn't wanted or needed.
+*/
+static bool voteByte(pipeShard* pipe, i2cBus* bus, const suspectByte* suspect, voteResult* result, bool testStuck) {
+    allEEPROMs* population = pipe->population;
+    EEPROM* current = &population->all[suspect->chip];
+    schedChip* entry = NULL;
+
+    result->chip = suspect->chip;
+    result->addr = suspect->addr;
+    result->first = suspect->data;
+    result->stuck = 0;
+    result->votes = 0;
+
+    for (int i = 0; i < pipe->sched.count; i++) {
+        if (pipe->sched.chips[i].chip == suspect->chip) {
+            entry = &pipe->sched.chips[i];
+        }
+    }
+
+    // can't get at it right now - it's not reported, so the next sweep finds it again
+    if (entry == NULL || entry->quarantined || !schedOpen(bus, entry)) {
+        return false;
+    }
+
+    uint8_t expect;
+    int flipped[8] = { 0 };
+
+    patternFill(&current->pattern, wordAddr(suspect->addr, entry->addrBytes), &expect, 1);
+
+    for (int v = 0; v < readVotes; v++) {
+        uint8_t byte;
+
+        if (busReadBlock(bus, entry->handle, entry->devAddr, entry->addrBytes, suspect->addr, &byte, 1) != 0) {
+            continue;
+        }
+
+        result->votes++;
+
+        for (int bit = 0; bit < 8; bit++) {
+            flipped[bit] += ((byte ^ expect) >> bit) & 1;
+        }
+    }
+
+    result->voted = expect;
+
+    for (int bit = 0; bit < 8; bit++) {
+        if (flipped[bit] * 2 > result->votes) {
+            result->voted ^= (uint8_t) (1 << bit);
+        }
+    }
+
+    if (result->votes == 0 || result->voted == expect) {
+        return false;
+    }
+
+    if (!testStuck) {
+        statAdd(&pipe->stuckSkipped, stuckTest);
+
+        return false;
+    }
+
+    uint8_t back;
+
+    statAdd(&pipe->stuckTests, 1);
+    statAdd(&pipe->stuckWrites, 1);
+
+    if (writeByte(bus, entry, suspect->addr, expect) == 0 &&
+        busReadBlock(bus, entry->handle, entry->devAddr, entry->addrBytes, suspect->addr, &back, 1) == 0) {
+        result->stuck = (uint8_t) ((result->voted ^ expect) & (back ^ expect));
+    }
+
+    // leave the evidence where it was
+    statAdd(&pipe->stuckWrites, 1);
+    writeByte(bus, entry, suspect->addr, result->voted);
+
+    return true;
+}
+
+// everything compare's asked about so far, as many to a block as fit
+static void voteSuspects(pipeShard* pipe, i2cBus* bus) {
+    scanBlock* block = NULL;
+    suspectByte suspect;
+    int fit = readChunk / (int) sizeof(voteResult) > 0 ? readChunk / (int) sizeof(voteResult) : 1;
+    int tested = 0;
+    uint64_t t0 = 0;
+
+    while (ringPop(&pipe->suspects, &suspect)) {
+        // only timed when there's something to do, this runs every slice
+        t0 = t0 == 0 ? monoNs() : t0;
+
+        if (block == NULL) {
+            block = takeBlock(pipe);
+            block->kind = BLOCK_VOTES;
+            block->chip = -1;
+            block->len = 0;
+        }
+
+        tested += voteByte(pipe, bus, &suspect, &((voteResult*) block->data)[block->len++], stuckTest && tested < STUCK_TESTS_PER_SLICE);
+        statAdd(&pipe->votedBytes, 1);
+
+        if (block->len == fit) {
+            block->readNs = monoNs() - pipe->pipe->startNs;
+            sendBlock(pipe, block);
+            block = NULL;
+        }
+    }
+
+    if (block != NULL) {
+        block->readNs = monoNs() - pipe->pipe->startNs;
+        sendBlock(pipe, block);
+    }
+
+    if (t0 != 0) {
+        statAdd(&pipe->voteNs, monoNs() - t0);
+    }
+}
+
+/*
+Bus reader - reads whichever slice the scheduler says is due next, across
+every chip on its bus, and keeps handing over blocks until the run time is up.
+Hot regions compare tells us about get squeezed in between.
+*/
+static void* readerThread(void* arg) {
+    pipeShard* pipe = (pipeShard*) arg;
+    allEEPROMs* population = pipe->population;
+    i2cBus* bus = population->buses[pipe->bus];
+    scanSched* sched = &pipe->sched;
+
+    // Continuously read - no sleep needed since takes time to read EEPROMs
+    while (!controlStopped(pipe->pipe->ctl, monoNs())) {
+        uint32_t heat;
+        schedChip* next;
+        int region;
+
+        while (ringPop(&pipe->heat, &heat)) {
+            schedHeat(sched, heat >> 16, heat & 0xFFFF, monoNs());
+        }
+
+        // paused - hands off the bus, suspects and all, until resume
+        if (atomic_load_explicit(&pipe->pipe->ctl->paused, memory_order_relaxed)) {
+            usleep(PIPE_IDLE_US);
+            continue;
+        }
+
+        // suspects first, the sooner they're re-read the less chance the noise (or the upset) changes
+        voteSuspects(pipe, bus);
+
+        // a quarantined chip's turn to prove it's back - one ACK poll, no waiting around
+        if ((next = schedNextRetry(sched, monoNs())) != NULL) {
+            bool back = schedOpen(bus, next) && busAckPoll(bus, next->handle, next->devAddr, next->addrBytes, 0, 0) == 0;
+
+            schedRetried(next, back, monoNs());
+
+            if (back) {
+                sendMarker(pipe, BLOCK_REINSTATED, next->chip);
+            }
+
+            continue;
+        }
+
+        // a hot region's turn - doesn't move the sweep along
+        if (schedNextHot(sched, monoNs(), &next, &region)) {
+            uint64_t t0 = monoNs();
+
+            if (schedOpen(bus, next)) {
+                int end = (region + 1) * REGION_BYTES < next->size ? (region + 1) * REGION_BYTES : next->size;
+
+                for (int start = region * REGION_BYTES, len = 0; start < end && !next->quarantined; start += len) {
+                    len = chunkLen(start, end, readChunk, next->addrBytes);
+                    readSlice(pipe, bus, next, start, len, true);
+                }
+            }
+
+            schedHotDone(sched, monoNs() - t0);
+            continue;
+        }
+
+        next = schedNext(sched, bus->bank);
+
+        // nothing on this bus to look at (or all of it's quarantined)
+        if (next == NULL) {
+            usleep(sched->count > 0 ? PIPE_IDLE_US : 1000000);
+            continue;
+        }
+
+        // the probe said it's there, but handles can still run out
+        if (!schedOpen(bus, next)) {
+            schedSkip(next, monoNs());
+            continue;
+        }
+
+        int len = chunkLen(next->cursor, next->size, readChunk, next->addrBytes);
+
+        readSlice(pipe, bus, next, next->cursor, len, false);
+
+        if (schedAdvance(next, len, monoNs())) {
+            sendMarker(pipe, BLOCK_CHIP_DONE, next->chip);
+        }
+
+        if (schedPassDone(sched)) {
+            sendMarker(pipe, BLOCK_PASS_DONE, -1);
+        }
+    }
+
+    for (int i = 0; i < sched->count; i++) {
+        if (sched->chips[i].handle >= 0) {
+            busClose(bus, sched->chips[i].handle);
+        }
+    }
+
+    sendMarker(pipe, BLOCK_STOP, -1);
+
+    return NULL;
+}
+
+/*
+Account for one byte that didn't read back as expected. The address goes in
+the failure map like before, and every bit in it we haven't already seen flip
+gets counted by position and direction. The new bits go off as one event,
+with whichever of them the write-back test found stuck, and into the
+checkpoint's copy of the seen masks so a resumed run knows they were reported.
+*/
+static void recordDiff(pipeShard* pipe, EEPROM* current, int chip, int byte, const byteDiff* d, uint8_t stuck, uint64_t ns) {
+    // check to see if we've looked at this before
+    // still O(1) but only a bit per address now
+    bool newFailure = failMapTestAndSet(&current->mems, byte);
+
+    if (newFailure) {
+        current->failures =  current->failures + 1;
+    } /// otherwise we do not want to double count failure
+
+    uint8_t* seen = flipMasksSlot(&current->seen, byte);
+
+    if (seen == NULL) {
+        return;
+    }
+
+    uint8_t fresh = d->diff & ~*seen;
+    *seen |= fresh;
+    ckptSeen(pipe->population->ckpt, chip)[byte] = *seen;
+
+    if (__builtin_popcount(fresh) > 1) {
+        current->multiBit++;
+    }
+
+    if (fresh == 0) {
+        return;
+    }
+
+    current->stuckBits += __builtin_popcount(fresh & stuck);
+
+    for (int bit = 0; bit < 8; bit++) {
+        if (fresh & (1 << bit)) {
+            int dir = (d->data >> bit) & 1;   // reads 1 now -> it was a 0->1
+
+            current->bitFlips[bit][dir]++;
+        }
+    }
+
+    // let the reader know this region's warming up, it's only a hint so drop it if the ring's full
+    uint32_t heat = (uint32_t) chip << 16 | (uint32_t) (byte / REGION_BYTES);
+
+    ringPush(&pipe->heat, &heat);
+
+    // one event for the whole byte, the mask says which bits
+    logRecord rec = { .kind = REC_FLIP, .bank = current->bank, .eeprom = eepromNum(current), .addr = byte, .mask = fresh,
+        .data = d->data, .pattern = (uint8_t) current->pattern.type, .failures = fresh & stuck, .ns = ns, .chip = chip };
+
+    sendRecord(pipe, &rec);
+}
+
+/*
+A mismatch straight off a sweep. Bits that have already been reported (this
+run or, out of the checkpoint, before a resume) are known and nothing new
+happens; anything else goes back to the reader to be voted on first.
+*/
+static void checkDiff(pipeShard* pipe, EEPROM* current, int chip, int byte, const byteDiff* d, uint64_t ns) {
+    if (readVotes == 0) {
+        recordDiff(pipe, current, chip, byte, d, 0, ns);
+
+        return;
+    }
+
+    if (failMapTest(&current->mems, byte)) {
+        uint8_t* seen = flipMasksSlot(&current->seen, byte);
+
+        if (seen != NULL && (d->diff & ~*seen) == 0) {
+            return;
+        }
+    }
+
+    // if the reader's that far behind it gets found again next sweep
+    suspectByte suspect = { chip, byte, d->data };
+
+    ringPush(&pipe->suspects, &suspect);
+}
+
+// what the re-reads said - misread bits get logged as such, the rest are real
+static void recordVote(pipeShard* pipe, const voteResult* result, uint64_t ns) {
+    EEPROM* current = &pipe->population->all[result->chip];
+    uint8_t expect;
+
+    if (result->votes == 0) {
+        return;
+    }
+
+    patternFill(&current->pattern, wordAddr(result->addr, current->addrBytes), &expect, 1);
+
+    uint8_t confirmed = result->voted ^ expect;
+    uint8_t misread = (result->first ^ expect) & ~confirmed;
+
+    if (misread != 0) {
+        logRecord rec = { .kind = REC_MISREAD, .bank = current->bank, .eeprom = eepromNum(current), .addr = result->addr,
+            .mask = misread, .data = result->first, .pattern = (uint8_t) current->pattern.type, .ns = ns, .chip = result->chip };
+
+        current->misreads++;
+        sendRecord(pipe, &rec);
+    }
+
+    if (confirmed != 0) {
+        byteDiff d = { 0, confirmed, result->voted };
+
+        recordDiff(pipe, current, result->chip, result->addr, &d, result->stuck, ns);
+    }
+
+    ckptSaveChip(pipe->population->ckpt, result->chip, current);
+}
+
+// every slice gets its own timestamp in the log, the mask says whether the read failed and whether it was a hot region
+static void sendSlice(pipeShard* pipe, const scanBlock* block, const EEPROM* current) {
+    logRecord rec = { .kind = REC_SLICE, .bank = current->bank, .eeprom = eepromNum(current), .addr = block->start,
+        .mask = (uint8_t) ((block->kind == BLOCK_BAD_READ ? EV_SLICE_FAILED : 0) | (block->hot ? EV_SLICE_HOT : 0)), .pattern = (uint8_t) current->pattern.type,
+        .failures = block->len, .ns = block->readNs, .chip = block->chip };
+
+    sendRecord(pipe, &rec);
+}
+
+/*
+Where a chip's snapshot sweep is up to. It starts when the sweep comes round to
+address 0 with a snapshot wanted that the chip hasn't been in yet, and anything
+the sweep jumps over is unread. Hot reads aren't part of the sweep. True if the
+block's wrong bytes go in the snapshot.
+*/
+static bool snapTrack(pipeShard* pipe, EEPROM* current, int chip, const scanBlock* block) {
+    unsigned wanted = atomic_load_explicit(&pipe->pipe->ctl->snapshots, memory_order_relaxed);
+    logRecord rec = { 0 };
+
+    rec.chip = chip;
+    rec.ns = block->readNs;
+
+    if (block->hot) {
+        return false;
+    }
+
+    // went back to the start (or was sent somewhere else) before the end, it gets what it had
+    if (current->snapping && block->start < current->snapNext) {
+        rec.kind = REC_SNAP_END;
+        sendRecord(pipe, &rec);
+        current->snapping = false;
+    }
+
+    if (!current->snapping && current->snapSeq != wanted && block->start == 0) {
+        rec.kind = REC_SNAP_BEGIN;
+        rec.failures = (int) wanted;
+        sendRecord(pipe, &rec);
+        current->snapSeq = wanted;
+        current->snapping = true;
+        current->snapNext = 0;
+    }
+
+    if (current->snapping && block->start > current->snapNext) {
+        rec.kind = REC_SNAP_UNREAD;
+        rec.addr = current->snapNext;
+        rec.failures = block->start - current->snapNext;
+        sendRecord(pipe, &rec);
+    }
+
+    return current->snapping;
+}
+
+// past the block, and done if that's the end of the chip
+static void snapAdvance(pipeShard* pipe, EEPROM* current, int chip, const scanBlock* block) {
+    logRecord rec = { 0 };
+
+    rec.chip = chip;
+    rec.ns = block->readNs;
+
+    if (block->kind == BLOCK_BAD_READ) {
+        rec.kind = REC_SNAP_UNREAD;
+        rec.addr = block->start;
+        rec.failures = block->len;
+        sendRecord(pipe, &rec);
+    }
+
+    current->snapNext = block->start + block->len;
+
+    if (current->snapNext >= current->size) {
+        rec.kind = REC_SNAP_END;
+        rec.mask = 1;
+        sendRecord(pipe, &rec);
+        current->snapping = false;
+    }
+}
+
+/*
+Compare - the only thread that touches the failure maps and counters of the
+chips on its bus while the pipeline is running
+*/
+static void* compareThread(void* arg) {
+    pipeShard* pipe = (pipeShard*) arg;
+    allEEPROMs* population = pipe->population;
+    checkpoint* ckpt = population->ckpt;
+    bool running = true;
+
+    while (running) {
+        scanBlock* block;
+        int spins = 0;
+
+        while (!ringPop(&pipe->fullBlocks, &block)) {
+            ringWait(&spins);
+        }
+
+        EEPROM* current = block->chip >= 0 ? &population->all[block->chip] : NULL;
+        logRecord rec = { 0 };
+
+        rec.ns = block->readNs;
+
+        switch (block->kind) {
+            case BLOCK_DATA: {
+                byteDiff diffs[MAX_DIFFS];
+                int from = 0;
+                int n;
+                bool snap = snapTrack(pipe, current, block->chip, block);
+
+                // vectorized XOR against the pattern, only the bytes that differ come back
+                do {
+                    n = comparePattern(&current->pattern, wordAddr(block->start + from, current->addrBytes), block->data + from, block->len - from, diffs, MAX_DIFFS);
+
+                    for (int k = 0; k < n; k++) {
+                        checkDiff(pipe, current, block->chip, block->start + from + diffs[k].offset, &diffs[k], block->readNs);
+
+                        if (snap) {
+                            logRecord rec = { .kind = REC_SNAP_XOR, .addr = block->start + from + diffs[k].offset, .mask = diffs[k].diff,
+                                .ns = block->readNs, .chip = block->chip };
+
+                            sendRecord(pipe, &rec);
+                        }
+                    }
+
+                    if (n == MAX_DIFFS) {
+                        from += diffs[n - 1].offset + 1;
+                    }
+                } while (n == MAX_DIFFS);
+
+                if (snap) {
+                    snapAdvance(pipe, current, block->chip, block);
+                }
+
+                // everything up to here is in the checkpoint now
+                ckptSaveChip(ckpt, block->chip, current);
+
+                if (!block->hot) {
+                    ckptSetCursor(ckpt, block->chip, (block->start + block->len) % current->size);
+                }
+
+                sendSlice(pipe, block, current);
+
+                break;
+            }
+            case BLOCK_BAD_READ:
+                if (snapTrack(pipe, current, block->chip, block)) {
+                    snapAdvance(pipe, current, block->chip, block);
+                }
+
+                // a failed read has no data in it so just move on like a bad single byte read did
+                if (!block->hot) {
+                    ckptSetCursor(ckpt, block->chip, (block->start + block->len) % current->size);
+                }
+
+                sendSlice(pipe, block, current);
+
+                break;
+            case BLOCK_CHIP_DONE:
+                rec.kind = REC_CHIP;
+                rec.bank = current->bank;
+                rec.eeprom = eepromNum(current);
+                rec.failures = current->failures;
+                rec.pattern = (uint8_t) current->pattern.type;
+                sendRecord(pipe, &rec);
+
+                break;
+            case BLOCK_QUARANTINED:
+            case BLOCK_REINSTATED:
+                rec.kind = REC_QUARANTINE;
+                rec.bank = current->bank;
+                rec.eeprom = eepromNum(current);
+                rec.mask = block->kind == BLOCK_QUARANTINED;
+                rec.failures = block->len;
+                sendRecord(pipe, &rec);
+
+                break;
+            case BLOCK_VOTES:
+                for (int i = 0; i < block->len; i++) {
+                    recordVote(pipe, &((voteResult*) block->data)[i], block->readNs);
+                }
+
+                break;
+            case BLOCK_PASS_DONE:
+                rec.kind = REC_PASS;
+                sendRecord(pipe, &rec);
+                ckptSync(ckpt);
+
+                break;
+            case BLOCK_STOP:
+                rec.kind = REC_STOP;
+                sendRecord(pipe, &rec);
+                running = false;
+
+                break;
+        }
+
+        // back in the pool
+        spins = 0;
+
+        while (!ringPush(&pipe->freeBlocks, &block)) {
+            ringWait(&spins);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+Log writer - the only thread that touches the log, so a slow disk backs up
+into the record rings instead of holding up a bus. Takes whatever any shard
+has ready, round robin.
+*/
+static void* logThread(void* arg) {
+    pipeline* pipe = (pipeline*) arg;
+    int running = pipe->numShards;
+    int next = 0;
+    int spins = 0;
+    unsigned flushed = atomic_load(&pipe->ctl->flushed);
+    uint64_t snapNs = pipe->startNs;
+
+    while (running > 0) {
+        logRecord rec;
+        pipeShard* shard = &pipe->shards[next];
+        unsigned flushes = atomic_load_explicit(&pipe->ctl->flushes, memory_order_relaxed);
+
+        // somebody asked for everything on disk now
+        if (flushes != flushed) {
+            evlogCommit(pipe->log);
+
+            for (int n = 0; n < pipe->numBoards; n++) {
+                ckptFlush(pipe->boards[n]->ckpt);
+            }
+
+            flushed = flushes;
+            atomic_store(&pipe->ctl->flushed, flushed);
+        }
+
+        // one snapshot as soon as the scan starts, then every snapshotMin - once a round is plenty often to look
+        if (next == 0 && snapshotMin > 0 && monoNs() >= snapNs) {
+            atomic_fetch_add(&pipe->ctl->snapshots, 1);
+            snapNs += (uint64_t) snapshotMin * 60000000000ULL;
+        }
+
+        next = (next + 1) % pipe->numShards;
+
+        if (!ringPop(&shard->records, &rec)) {
+            // only back off once every shard came up empty, and commit while we're idle
+            if (next == 0) {
+                evlogTick(pipe->log);
+                ringWait(&spins);
+            }
+
+            continue;
+        }
+
+        spins = 0;
+
+        evlogRecord ev = { 0 };
+
+        ev.ns = rec.ns;
+        ev.board = (uint16_t) shard->population->board;
+        ev.bank = (uint8_t) rec.bank;
+        ev.eeprom = (uint8_t) rec.eeprom;
+
+        switch (rec.kind) {
+            case REC_FLIP:
+                ev.kind = EV_FLIP;
+                ev.addr = (uint32_t) rec.addr;
+                ev.mask = rec.mask;
+                ev.data = rec.data;
+                ev.pattern = rec.pattern;
+                ev.count = (uint32_t) rec.failures;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_MISREAD:
+                ev.kind = EV_MISREAD;
+                ev.addr = (uint32_t) rec.addr;
+                ev.mask = rec.mask;
+                ev.data = rec.data;
+                ev.pattern = rec.pattern;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_SLICE:
+                ev.kind = EV_SLICE;
+                ev.addr = (uint32_t) rec.addr;
+                ev.count = (uint32_t) rec.failures;
+                ev.mask = rec.mask;
+                ev.pattern = rec.pattern;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_CHIP:
+                ev.kind = EV_CHIP;
+                ev.count = (uint32_t) rec.failures;
+                ev.pattern = rec.pattern;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_PASS:
+                ev.kind = EV_PASS;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_QUARANTINE:
+                ev.kind = EV_QUARANTINE;
+                ev.mask = rec.mask;
+                ev.count = (uint32_t) rec.failures;
+                evlogAppend(pipe->log, &ev);
+
+                break;
+            case REC_SNAP_BEGIN:
+                snapBegin(shard->snaps, rec.chip, (unsigned) rec.failures, rec.ns);
+
+                break;
+            case REC_SNAP_XOR:
+                snapXor(shard->snaps, rec.chip, rec.addr, rec.mask);
+
+                break;
+            case REC_SNAP_UNREAD:
+                snapUnread(shard->snaps, rec.chip, rec.addr, rec.failures);
+
+                break;
+            case REC_SNAP_END:
+                snapFinish(shard->snaps, rec.chip, rec.mask, rec.ns);
+
+                break;
+            case REC_STOP:
+                running--;
+
+                break;
+        }
+
+        // a steady trickle never leaves the rings empty, so check the interval here too
+        evlogTick(pipe->log);
+    }
+
+    // snapshots that didn't get all the way round keep what they've got
+    for (int n = 0; n < pipe->numBoards; n++) {
+        snapClose(&pipe->snaps[n], monoNs() - pipe->startNs);
+    }
+
+    return NULL;
+}
+
+/*
+One snapshot of everything into the stats file, one line per bus, chip and the
+log, as name value pairs. Rates are since the last snapshot (recent) and since
+the start of the run.
+*/
+static void writeStats(pipeline* pipe, uint64_t* lastBytes, uint64_t* lastNs) {
+    char tmpPath[300];
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", pipe->statsPath);
+
+    FILE* out = fopen(tmpPath, "w");
+
+    if (out == NULL) {
+        return;
+    }
+
+    uint64_t now = monoNs();
+    double runSec = (now - pipe->startNs) / 1e9;
+    double sinceSec = (now - *lastNs) / 1e9;
+
+    fprintf(out, "# %.1f s into the run, rewritten every %d ms. Times in us\n", runSec, statsMs);
+    fprintf(out, "run %s rateKBps %d\n", atomic_load(&pipe->ctl->stop) ? "stopping" : atomic_load(&pipe->ctl->paused) ? "paused" : "running",
+        atomic_load(&pipe->ctl->rateKBps));
+
+    for (int b = 0; b < pipe->numShards; b++) {
+        pipeShard* shard = &pipe->shards[b];
+        allEEPROMs* population = shard->population;
+        busStats* stats = &population->buses[shard->bus]->stats;
+        uint64_t bytes = statGet(&stats->readBytes) - shard->startBytes;
+        uint64_t settles = statGet(&stats->settles);
+
+        fprintf(out, "bus %d board %d readBytes %llu bytesPerSec %.0f recentBytesPerSec %.0f xfers %llu errors %llu timeouts %llu ackPolls %llu"
+            " clears %llu clearFails %llu bankSwitches %llu switchUs %.1f settleAvgUs %.1f settleMaxUs %.1f votedBytes %llu voteUs %.1f stuckTests %llu stuckWrites %llu stuckSkipped %llu",
+            population->busNum[shard->bus], population->board, (unsigned long long) bytes, runSec > 0 ? bytes / runSec : 0,
+            sinceSec > 0 ? (bytes - lastBytes[b]) / sinceSec : 0,
+            (unsigned long long) statGet(&stats->xfers), (unsigned long long) statGet(&stats->xferErrors),
+            (unsigned long long) statGet(&stats->timeouts), (unsigned long long) statGet(&stats->ackPolls),
+            (unsigned long long) statGet(&stats->clears), (unsigned long long) statGet(&stats->clearFails),
+            (unsigned long long) statGet(&stats->bankSwitches), statGet(&stats->switchNs) / 1e3,
+            settles > 0 ? statGet(&stats->settleNs) / 1e3 / settles : 0, statGet(&stats->maxSettleNs) / 1e3,
+            (unsigned long long) statGet(&shard->votedBytes), statGet(&shard->voteNs) / 1e3,
+            (unsigned long long) statGet(&shard->stuckTests), (unsigned long long) statGet(&shard->stuckWrites),
+            (unsigned long long) statGet(&shard->stuckSkipped));
+        histWrite(out, "xfer", &stats->xferHist);
+        fprintf(out, "\n");
+
+        lastBytes[b] = bytes;
+    }
+
+    for (int b = 0; b < pipe->numShards; b++) {
+        pipeShard* shard = &pipe->shards[b];
+        scanSched* sched = &shard->sched;
+
+        for (int i = 0; i < sched->count; i++) {
+            schedChip* entry = &sched->chips[i];
+
+            fprintf(out, "chip board %d bus %d bank %d eeprom %d readBytes %llu readErrors %llu", shard->population->board,
+                shard->population->busNum[shard->bus], entry->bank, eepromNum(&shard->population->all[entry->chip]),
+                (unsigned long long) statGet(&entry->bytesRead), (unsigned long long) statGet(&entry->readErrors));
+            histWrite(out, "slice", &entry->sliceHist);
+            histWrite(out, "sweep", &entry->sweepHist);
+            fprintf(out, "\n");
+        }
+    }
+
+    evlogStats* log = &pipe->log->stats;
+
+    fprintf(out, "log records %llu commits %llu failures %llu", (unsigned long long) statGet(&log->records),
+        (unsigned long long) statGet(&log->commits), (unsigned long long) statGet(&log->failures));
+    histWrite(out, "commit", &log->commitHist);
+    fprintf(out, "\n");
+
+    statsReplace(out, tmpPath, pipe->statsPath);
+    *lastNs = now;
+}
+
+/*
+Stats - only ever reads what the other threads keep, so it can run late or
+not at all without anything noticing
+*/
+static void* statsThread(void* arg) {
+    pipeline* pipe = (pipeline*) arg;
+    uint64_t lastBytes[MAX_BUSES * MAX_BOARDS] = { 0 };
+    uint64_t lastNs = pipe->startNs;
+    uint64_t nextNs = monoNs() + (uint64_t) statsMs * 1000000ULL;
+
+    while (!atomic_load(&pipe->done)) {
+        usleep(PIPE_STATS_POLL_US);
+
+        if (monoNs() >= nextNs) {
+            writeStats(pipe, lastBytes, &lastNs);
+            nextNs += (uint64_t) statsMs * 1000000ULL;
+        }
+    }
+
+    // and the final numbers
+    writeStats(pipe, lastBytes, &lastNs);
+
+    return NULL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// a block of vote results has to fit at least one
+static size_t blockBytes(void) {
+    return readChunk > (int) sizeof(voteResult) ? (size_t) readChunk : sizeof(voteResult);
+}
+
+size_t pipelineBytes(int numBuses, int numChips) {
+    size_t shard = arenaRound(PIPE_BLOCKS * sizeof(scanBlock)) + PIPE_BLOCKS * arenaRound(blockBytes()) +
+        2 * ringBytes(PIPE_BLOCKS, sizeof(scanBlock*)) + ringBytes(PIPE_LOG_RECORDS, sizeof(logRecord)) +
+        ringBytes(PIPE_HEAT_HINTS, sizeof(uint32_t)) + ringBytes(PIPE_SUSPECTS, sizeof(suspectByte));
+
+    return numBuses * shard + snapWriterBytes(numChips);
+}
+
+// blocks and rings all come out of the board's arena (pipelineBytes of it), and go with it
+static int shardInit(pipeShard* shard, pipeline* pipe, allEEPROMs* population, int bus) {
+    arena* mem = &population->mem;
+
+    shard->pipe = pipe;
+    shard->population = population;
+    shard->bus = bus;
+    shard->startBytes = population->buses[bus]->stats.readBytes;
+    shard->pool = (scanBlock*) arenaAlloc(mem, PIPE_BLOCKS * sizeof(scanBlock));
+
+    if (shard->pool == NULL ||
+        ringInit(&shard->freeBlocks, PIPE_BLOCKS, sizeof(scanBlock*), mem) != 0 ||
+        ringInit(&shard->fullBlocks, PIPE_BLOCKS, sizeof(scanBlock*), mem) != 0 ||
+        ringInit(&shard->records, PIPE_LOG_RECORDS, sizeof(logRecord), mem) != 0 ||
+        ringInit(&shard->heat, PIPE_HEAT_HINTS, sizeof(uint32_t), mem) != 0 ||
+        ringInit(&shard->suspects, PIPE_SUSPECTS, sizeof(suspectByte), mem) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < PIPE_BLOCKS; i++) {
+        scanBlock* block = &shard->pool[i];
+
+        block->data = (uint8_t*) arenaAlloc(mem, blockBytes());
+
+        if (block->data == NULL) {
+            return -1;
+        }
+
+        ringPush(&shard->freeBlocks, &block);
+    }
+
+    // every chip on this bus that got initialized, picking up wherever the checkpoint says its sweep got to.
+    // Built here and not in the reader, the stats thread reads it from its first tick
+    schedInit(&shard->sched, hotShare, monoNs());
+
+    for (int chip = 0; chip < population->count; chip++) {
+        EEPROM* current = &population->all[chip];
+
+        if (current->bus == bus && current->mems.words != NULL) {
+            schedAdd(&shard->sched, chip, current->bank, current->devAddr, current->addrBytes, current->size,
+                population->ckpt->chips[chip].cursor, current->revisitMs, current->regions, monoNs());
+        }
+    }
+
+    return 0;
+}
+
+// "i2c-N", or "board B i2c-N" when there's more than one board to tell apart
+static void shardName(const pipeShard* shard, char* name, size_t len) {
+    if (shard->pipe->numBoards > 1) {
+        snprintf(name, len, "board %d i2c-%d", shard->population->board, shard->population->busNum[shard->bus]);
+    } else {
+        snprintf(name, len, "i2c-%d", shard->population->busNum[shard->bus]);
+    }
+}
+
+void runPipeline(allEEPROMs** boards, int numBoards, runControl* ctl, evlog* log, const char* statsPath) {
+    pipeline* pipe = (pipeline*) calloc(1, sizeof(pipeline));
+
+    if (pipe == NULL) {
+        printf("Out of memory for the scan pipeline\n");
+
+        return;
+    }
+
+    pipe->boards = boards;
+    pipe->numBoards = numBoards;
+    pipe->startNs = boards[0]->startNs;
+    pipe->ctl = ctl;
+    pipe->log = log;
+    pipe->statsPath = statsPath;
+    atomic_init(&pipe->done, false);
+
+    // every bus of every board, and every board's snapshot writer
+    for (int n = 0; n < numBoards; n++) {
+        uint8_t* snapStorage = (uint8_t*) arenaAlloc(&boards[n]->mem, snapWriterBytes(boards[n]->count));
+
+        if (snapStorage == NULL) {
+            printf("Out of memory for the scan pipeline\n");
+            free(pipe);
+
+            return;
+        }
+
+        snapWriterInit(&pipe->snaps[n], boards[n], snapStorage);
+
+        for (int b = 0; b < boards[n]->numBuses; b++) {
+            pipeShard* shard = &pipe->shards[pipe->numShards++];
+
+            if (shardInit(shard, pipe, boards[n], b) != 0) {
+                printf("Out of memory for the scan pipeline\n");
+                free(pipe);
+
+                return;
+            }
+
+            shard->snaps = &pipe->snaps[n];
+        }
+    }
+
+    pthread_t writer;
+    pthread_t exporter;
+
+    pthread_create(&writer, NULL, logThread, pipe);
+
+    if (statsMs > 0) {
+        pthread_create(&exporter, NULL, statsThread, pipe);
+    }
+
+    for (int b = 0; b < pipe->numShards; b++) {
+        pthread_create(&pipe->shards[b].compare, NULL, compareThread, &pipe->shards[b]);
+        pthread_create(&pipe->shards[b].reader, NULL, readerThread, &pipe->shards[b]);
+    }
+
+    for (int b = 0; b < pipe->numShards; b++) {
+        pthread_join(pipe->shards[b].reader, NULL);
+        pthread_join(pipe->shards[b].compare, NULL);
+    }
+
+    pthread_join(writer, NULL);
+
+    if (statsMs > 0) {
+        atomic_store(&pipe->done, true);
+        pthread_join(exporter, NULL);
+    }
+
+    for (int b = 0; b < pipe->numShards; b++) {
+        pipeShard* shard = &pipe->shards[b];
+        allEEPROMs* population = shard->population;
+        scanSched* sched = &shard->sched;
+        busStats* stats = &population->buses[shard->bus]->stats;
+        double runNs = (double) (monoNs() - pipe->startNs);
+        char name[40];
+
+        shardName(shard, name, sizeof(name));
+
+        printf("%s: %llu hot region reads, %.1f%% of the run\n", name, (unsigned long long) sched->hotReads, 100.0 * sched->hotNs / runNs);
+        printf("%s: %llu bank switches (%llu skipped, already there), %.1f us driving the mux, settle avg %.1f us max %.1f us\n",
+            name, (unsigned long long) stats->bankSwitches, (unsigned long long) stats->bankSkips,
+            stats->bankSwitches ? stats->switchNs / 1e3 / stats->bankSwitches : 0,
+            stats->settles ? stats->settleNs / 1e3 / stats->settles : 0, stats->maxSettleNs / 1e3);
+        printf("%s: %llu transactions, %llu failed, %llu over the %d ms deadline, longest %.1f ms, %llu bus clears (%llu didn't work)\n",
+            name, (unsigned long long) stats->xfers, (unsigned long long) stats->xferErrors,
+            (unsigned long long) stats->timeouts, BUS_XFER_TIMEOUT_MS, stats->maxXferNs / 1e6,
+            (unsigned long long) stats->clears, (unsigned long long) stats->clearFails);
+        printf("%s: %.1f KB/s read, transactions p50 %.1f us p99 %.1f us, %llu ack polls\n", name,
+            (stats->readBytes - shard->startBytes) / 1e3 / (runNs / 1e9), histPercentile(&stats->xferHist, 50) / 1e3,
+            histPercentile(&stats->xferHist, 99) / 1e3, (unsigned long long) stats->ackPolls);
+        printf("%s: %llu suspect bytes re-read, %.1f%% of the run\n", name,
+            (unsigned long long) shard->votedBytes, 100.0 * shard->voteNs / runNs);
+
+        if (stuckTest) {
+            printf("%s: %llu stuck tests, %llu write cycles, %llu confirmed bytes over the per slice limit left untested\n", name,
+                (unsigned long long) shard->stuckTests, (unsigned long long) shard->stuckWrites, (unsigned long long) shard->stuckSkipped);
+        }
+
+        for (int i = 0; i < sched->count; i++) {
+            schedChip* entry = &sched->chips[i];
+
+            if (entry->quarantines > 0) {
+                printf("%s: EEPROM %d in bank %d quarantined %u times%s\n", name, eepromNum(&population->all[entry->chip]),
+                    entry->bank, entry->quarantines, entry->quarantined ? ", still out" : "");
+            }
+        }
+    }
+
+    for (int n = 0; n < numBoards; n++) {
+        snapWriter* w = &pipe->snaps[n];
+
+        if (w->snapshots > 0) {
+            printf("Board %d: %llu snapshots, %.1f KB\n", boards[n]->board, (unsigned long long) w->snapshots, w->bytes / 1e3);
+        }
+    }
+
+    free(pipe);
+}
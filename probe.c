@@ -0,0 +1,306 @@
+/*
+
+Board Probe for EEPROM Control
+
+The capacity test only writes address 0 (to the inverse of what's there) and
+puts it back straight after, so it's safe to run on a board with a run in
+progress. Candidates are every power of two from PROBE_MIN_SIZE up, plus the
+topology's own size in case it isn't one (the simulator wraps at exactly what
+it's told).
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "probe.h"
+
+// Positions the bank select mux has, every one gets scanned on a bus that goes through it
+#define PROBE_MUX_POSITIONS 3
+
+// Addresses an ACK scan tries, same as i2cdetect
+#define PROBE_FIRST_ADDR 0x03
+#define PROBE_LAST_ADDR 0x77
+
+// Smallest EEPROM we'd ever see (24C01)
+#define PROBE_MIN_SIZE 128
+
+// powers of two up to 16M + the topology size
+#define PROBE_MAX_CANDIDATES 24
+
+// Longest cache line we bother with
+#define PROBE_LINE 128
+
+static const char* statusNames[] = { "ok", "absent", "dead" };
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static int readByte(i2cBus* bus, int handle, const EEPROM* current, int addr, uint8_t* value) {
+    return busReadBlock(bus, handle, current->devAddr, current->addrBytes, addr, value, 1);
+}
+
+static int writeByte(i2cBus* bus, int handle, const EEPROM* current, int addr, uint8_t value) {
+    if (busWritePage(bus, handle, current->devAddr, current->addrBytes, addr, &value, 1) != 0) {
+        return -1;
+    }
+
+    return busAckPoll(bus, handle, current->devAddr, current->addrBytes, addr, WRITE_TIMEOUT_US);
+}
+
+/*
+Where the chip wraps around: everything at the candidates gets read, address 0
+gets flipped, and the first candidate that changed along with it is the same
+byte. 0 if none did (it's at least as big as its word address reaches), -1 if
+it stopped cooperating.
+*/
+static int probeCapacity(i2cBus* bus, int handle, const EEPROM* current) {
+    long span = chipSpan(current->addrBytes);
+    int candidates[PROBE_MAX_CANDIDATES];
+    uint8_t before[PROBE_MAX_CANDIDATES];
+    uint8_t after[PROBE_MAX_CANDIDATES];
+    int n = 0;
+
+    for (long size = PROBE_MIN_SIZE; size < span; size *= 2) {
+        // topology size goes in order, unless it's a power of two and gets tried anyway
+        if (current->size < size && current->size > size / 2 && current->size < span) {
+            candidates[n++] = current->size;
+        }
+
+        candidates[n++] = (int) size;
+    }
+
+    uint8_t first;
+
+    if (readByte(bus, handle, current, 0, &first) != 0) {
+        return -1;
+    }
+
+    for (int k = 0; k < n; k++) {
+        if (readByte(bus, handle, current, candidates[k], &before[k]) != 0) {
+            return -1;
+        }
+    }
+
+    if (writeByte(bus, handle, current, 0, (uint8_t) ~first) != 0) {
+        return -1;
+    }
+
+    int result = 0;
+
+    for (int k = 0; k < n && result == 0; k++) {
+        if (readByte(bus, handle, current, candidates[k], &after[k]) != 0) {
+            result = -1;
+        } else if (after[k] != before[k]) {
+            result = candidates[k];
+        }
+    }
+
+    // put it back however that went
+    if (writeByte(bus, handle, current, 0, first) != 0) {
+        return -1;
+    }
+
+    return result;
+}
+
+// Everything that ACKs a one byte read in bank, answered[addr]
+static void probeScanBank(allEEPROMs* population, i2cBus* bus, int b, int bank, bool* answered) {
+    // wait out the mux on a chip that should be there, or just the worst case if there isn't one
+    if (busSelectBank(bus, bank)) {
+        bool settled = false;
+
+        for (int i = 0; i < population->count && !settled; i++) {
+            EEPROM* current = &population->all[i];
+
+            if (current->bus == b && current->bank == bank) {
+                int handle = busSetup(bus, current->devAddr);
+
+                settled = handle >= 0 && busSettle(bus, handle, current->devAddr, current->addrBytes, MUX_SETTLE_TIMEOUT_US) == 0;
+                busClose(bus, handle);
+            }
+        }
+
+        if (!settled) {
+            usleep(MUX_SETTLE_TIMEOUT_US);
+        }
+    }
+
+    for (int addr = PROBE_FIRST_ADDR; addr <= PROBE_LAST_ADDR; addr++) {
+        int handle = busSetup(bus, addr);
+        uint8_t byte;
+
+        answered[addr] = handle >= 0 && busXfer(bus, handle, addr, NULL, 0, &byte, 1) == 0;
+
+        if (handle >= 0) {
+            busClose(bus, handle);
+        }
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void probeBoard(allEEPROMs* population, probeResult* results) {
+    for (int b = 0; b < population->numBuses; b++) {
+        i2cBus* bus = population->buses[b];
+        bool banks[TOPO_MAX_BANKS] = { false };
+        int numBanks = 0;
+        int chips = 0;
+        int found = 0;
+        uint64_t t0 = monoNs();
+
+        for (int i = 0; i < population->count; i++) {
+            EEPROM* current = &population->all[i];
+
+            if (current->bus == b) {
+                numBanks += !banks[current->bank];
+                banks[current->bank] = true;
+                chips++;
+            }
+        }
+
+        // through the mux -> look at every position, not just the ones the topology uses
+        for (int bank = 0; bank < PROBE_MUX_POSITIONS && numBanks > 1; bank++) {
+            banks[bank] = true;
+        }
+
+        for (int bank = 0; bank < TOPO_MAX_BANKS; bank++) {
+            bool answered[PROBE_LAST_ADDR + 1] = { false };
+
+            if (!banks[bank]) {
+                continue;
+            }
+
+            probeScanBank(population, bus, b, bank, answered);
+
+            for (int i = 0; i < population->count; i++) {
+                EEPROM* current = &population->all[i];
+                probeResult* result = &results[i];
+
+                if (current->bus != b || current->bank != bank) {
+                    continue;
+                }
+
+                result->size = current->size;
+
+                if (!answered[current->devAddr]) {
+                    result->status = PROBE_ABSENT;
+                    printf("Nothing at 0x%02x in bank %d on i2c-%d\n", current->devAddr, bank, population->busNum[b]);
+
+                    continue;
+                }
+
+                // only the topology's chips are left to account for after this
+                answered[current->devAddr] = false;
+
+                int handle = busSetup(bus, current->devAddr);
+                int wraps = handle >= 0 ? probeCapacity(bus, handle, current) : -1;
+
+                if (handle >= 0) {
+                    busClose(bus, handle);
+                }
+
+                if (wraps < 0) {
+                    result->status = PROBE_DEAD;
+                    printf("EEPROM %d in bank %d answers but can't be read and written\n", eepromNum(current), bank);
+
+                    continue;
+                }
+
+                result->status = PROBE_OK;
+                found++;
+
+                // past what the word address reaches every read is the start of the chip again, so only that much gets scanned
+                if (wraps == 0 && current->size > chipSpan(current->addrBytes)) {
+                    printf("EEPROM %d in bank %d is bigger than %d address bytes reach - only scanning the first %ld bytes\n",
+                        eepromNum(current), bank, current->addrBytes, chipSpan(current->addrBytes));
+                    result->size = (int) chipSpan(current->addrBytes);
+                } else if (wraps > 0 && wraps != current->size) {
+                    printf("EEPROM %d in bank %d wraps at %d bytes, topology says %d - using %d\n",
+                        eepromNum(current), bank, wraps, current->size, wraps);
+                    result->size = wraps;
+                }
+            }
+
+            for (int addr = PROBE_FIRST_ADDR; addr <= PROBE_LAST_ADDR; addr++) {
+                if (answered[addr]) {
+                    printf("Something at 0x%02x in bank %d on i2c-%d isn't in the topology\n", addr, bank, population->busNum[b]);
+                }
+            }
+        }
+
+        printf("i2c-%d: %d of %d chips answered, probed in %.1f ms\n", population->busNum[b], found, chips, (monoNs() - t0) / 1e6);
+    }
+}
+
+/*
+One line per chip: where it is and how the topology described it, then what
+the probe made of it. All of the first part has to match for a line to count.
+*/
+bool probeLoadCache(const char* path, const allEEPROMs* population, probeResult* results) {
+    FILE* in = fopen(path, "r");
+
+    if (in == NULL) {
+        return false;
+    }
+
+    char line[PROBE_LINE];
+    bool* matched = (bool*) calloc(population->count > 0 ? population->count : 1, sizeof(bool));
+    int count = 0;
+
+    while (matched != NULL && fgets(line, sizeof(line), in) != NULL) {
+        int bank, devAddr, busNum, addrBytes, size, probed;
+        char status[16];
+
+        if (line[0] == '#' || sscanf(line, "%d %i %d %d %d %15s %d", &bank, &devAddr, &busNum, &addrBytes, &size, status, &probed) != 7) {
+            continue;
+        }
+
+        for (int i = 0; i < population->count; i++) {
+            const EEPROM* current = &population->all[i];
+
+            if (matched[i] || current->bank != bank || current->devAddr != devAddr || population->busNum[current->bus] != busNum ||
+                current->addrBytes != addrBytes || current->size != size) {
+                continue;
+            }
+
+            for (int s = 0; s < (int) (sizeof(statusNames) / sizeof(statusNames[0])); s++) {
+                if (strcmp(status, statusNames[s]) == 0 && probed > 0) {
+                    results[i].status = (probeStatus) s;
+                    results[i].size = probed;
+                    matched[i] = true;
+                    count++;
+                }
+            }
+        }
+    }
+
+    fclose(in);
+    free(matched);
+
+    return count == population->count;
+}
+
+void probeSaveCache(const char* path, const allEEPROMs* population, const probeResult* results) {
+    FILE* out = fopen(path, "w");
+
+    if (out == NULL) {
+        printf("Failed to open %s\n", path);
+
+        return;
+    }
+
+    fprintf(out, "# bank addr bus addrBytes topologySize -> status size (delete or use --probe to probe again)\n");
+
+    for (int i = 0; i < population->count; i++) {
+        const EEPROM* current = &population->all[i];
+
+        fprintf(out, "%d 0x%02x %d %d %d %s %d\n", current->bank, current->devAddr, population->busNum[current->bus],
+            current->addrBytes, current->size, statusNames[results[i].status], results[i].size);
+    }
+
+    fclose(out);
+}
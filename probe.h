@@ -0,0 +1,43 @@
+/*
+
+Board Probe for EEPROM Control
+
+initEEPROMs() used to take the topology on faith and only found out a chip was
+missing when writing to it failed, and the scan kept trying it every pass
+after that. Now every mux position gets ACK scanned at startup and every chip
+that answers gets its real capacity measured by wrap-around: the address bits
+a part doesn't have are ignored, so writing address 0 shows up again at
+address <capacity>. Chips that don't answer (or answer and then can't be read
+or written) are left out of the run.
+
+The result goes in "board N probe.txt" so the next run on the same board and
+topology doesn't have to probe again. --probe throws it away.
+
+*/
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdbool.h>
+#include "radpi.h"
+
+typedef enum {
+    PROBE_OK,             // answered, size is what it wraps at (or the topology's if it didn't)
+    PROBE_ABSENT,         // nothing at that address
+    PROBE_DEAD,           // ACKs but reads or writes fail
+} probeStatus;
+
+typedef struct {
+    probeStatus status;
+    int size;
+} probeResult;
+
+// Results from an earlier probe of the same topology, false if there aren't any
+bool probeLoadCache(const char* path, const allEEPROMs* population, probeResult* results);
+
+void probeSaveCache(const char* path, const allEEPROMs* population, const probeResult* results);
+
+// ACK scan every bank and measure every chip that's there, results[i] for population->all[i]
+void probeBoard(allEEPROMs* population, probeResult* results);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+
+Shared Definitions for EEPROM Control
+
+The EEPROM bookkeeping that radpicode.c and the scan pipeline both work on.
+
+*/
+
+#ifndef RADPI_H
+#define RADPI_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "bus.h"
+#include "failmap.h"
+#include "pattern.h"
+#include "evlog.h"
+#include "scansched.h"
+#include "topology.h"
+#include "control.h"
+#include "arena.h"
+
+// What's on the board comes from topology.c now, this is just where the logs start counting EEPROMs from
+#define EEPROM_ADDRESS 0x50 // base EEPROM I2C address
+
+// Most I2C controllers banks can be spread over (Pi 4 has i2c-1 and i2c-3..6)
+#define MAX_BUSES 6
+
+// Most boards one process can drive at once (--boards)
+#define MAX_BOARDS 8
+
+// Longest we wait for a bank to answer after switching the mux
+#define MUX_SETTLE_TIMEOUT_US 10000
+
+// Give up on a page write if the chip hasn't ACK'd in this long (datasheet says 5 ms)
+#define WRITE_TIMEOUT_US 20000
+
+// Bytes pulled per bulk read - override with --chunk
+#define READ_CHUNK 4096
+
+// Mismatching bytes handled per compare call
+#define MAX_DIFFS 256
+
+// Times a mismatching byte gets re-read before it counts - override with --votes
+#define VOTE_READS 3
+
+// Most stuck tests (two write cycles each) the reader does between two slices
+// with --stuck-test, the rest of the burst gets logged untested
+#define STUCK_TESTS_PER_SLICE 4
+
+// Seen masks start with room for one failed byte in this many, and the arena has
+// room for all of them to double once more before anything comes off the heap
+#define SEEN_RESERVE 1024
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+typedef struct checkpoint checkpoint;   // checkpoint.h
+
+typedef struct {
+    int size;             // size in bytes of eeprom
+    int bank;             // mux position
+    int devAddr;          // 7 bit I2C address
+    int pageSize;         // page write size
+    int addrBytes;        // word address bytes sent before every read
+    int bus;              // index into population->buses
+    bool present;         // answered the startup probe, nothing else gets scanned
+    int failures;         // how many times has this EEPROM failed
+    int i2cAddr;          // where on the i2c bus is it
+    failMap mems;         // addresses that we know have failed, one bit each
+    flipMasks seen;       // bits we've already reported for each failed address
+    uint32_t bitFlips[8][2]; // flips per bit position, [0] is 1->0 and [1] is 0->1
+    int multiBit;         // times more than one bit in a byte flipped between reads
+    int misreads;         // mismatches the re-reads didn't back up (bus noise, not the chip)
+    int stuckBits;        // confirmed flips that wouldn't write back
+    testPattern pattern;  // what's supposed to be in it
+    int revisitMs;        // target time for a full sweep of it
+    scanRegion* regions;  // heat + read timing per REGION_BYTES, owned by its bus's reader while scanning
+    unsigned snapSeq;     // last snapshot a sweep of it went into (compare's, see snapshot.h)
+    bool snapping;        // that sweep's still going
+    int snapNext;         // where it should carry on from
+} EEPROM; 
+
+typedef struct {
+    int board;            // board number, what its files are named after
+    EEPROM* all;          // one per chip in the topology, same order
+    int count;            // how many
+    i2cBus* buses[MAX_BUSES]; // one backend per bus device
+    int busNum[MAX_BUSES];    // the N in /dev/i2c-N for each of those
+    int numBuses;
+    uint8_t* buf;         // scratch buffer for init, at least readChunk bytes
+    uint64_t startNs;     // monotonic time the run started, the same for every board in a fleet
+    checkpoint* ckpt;     // failure maps and counters live in here
+    arena mem;            // this struct, the chips and everything else of theirs (boardArenaBytes in radpicode.c)
+} allEEPROMs; 
+
+static inline i2cBus* busForChip(allEEPROMs* population, const EEPROM* current) {
+    return population->buses[current->bus];
+}
+
+// addresses a chip's seen masks have room for before they grow
+static inline int seenReserve(const EEPROM* current) {
+    return current->size / SEEN_RESERVE;
+}
+
+// EEPROM number in the logs and reports, 0-7 for the usual 24xx addresses
+static inline int eepromNum(const EEPROM* current) {
+    return current->devAddr - EEPROM_ADDRESS;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// global variables :( (radpicode.c)
+extern int readChunk;
+extern double hotShare;
+extern int readVotes;
+extern bool stuckTest;
+extern int statsMs;
+extern int snapshotMin;
+
+// radpicode.c
+uint64_t monoNs(void);
+uint32_t wordAddr(int addr, int addrBytes);
+int chunkLen(int start, int size, int chunk, int addrBytes);
+
+// pipeline.c - arena a board with numBuses buses and numChips chips needs for its shards' blocks and rings and its snapshots
+size_t pipelineBytes(int numBuses, int numChips);
+
+// pipeline.c - scan every board until ctl says stop, counters go to statsPath every statsMs
+void runPipeline(allEEPROMs** boards, int numBoards, runControl* ctl, evlog* log, const char* statsPath);
+
+#endif
@@ -12,237 +12,944 @@ Email: fdougall@purdue.edu
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <wiringPi.h>
-#include <wiringPiI2C.h>
 #include <time.h>
 #include <stdbool.h>
 #include <stdlib.h>
-
-// Selector Pins
-#define BANK_SELECT_1 0
-#define BANK_SELECT_2 1
-
-// EEPROM Banking Information
-#define EEPROM_ADDRESS 0x50 // base EEPROM I2C address
-#define NUM_BANKS 2
-#define EEPROMS_PER_BANK 8
-#define MAX_EEPROM_SIZE 512000 // maximum size we have
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "radpi.h"
+#include "compare.h"
+#include "checkpoint.h"
+#include "scansched.h"
+#include "topology.h"
+#include "probe.h"
+#include "snapshot.h"
 
 // How long to run the test - seconds
-// default is 30 min -> 1800 seconds
+// default is 30 min -> 1800 seconds, override with --seconds
 #define RUNNING_TIME_SEC 1800
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// --config files can pull in other --config files this deep
+#define CONFIG_MAX_DEPTH 4
 
-// technically this doesn't need to be a struck....
-//typedef struct {
-   // uint8_t* addresses;
-//} eepromMemArray; 
+// Longest line in a --config file
+#define CONFIG_LINE 512
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// One --revisit B:E:MS
 typedef struct {
-    int size;             // size in bytes of eeprom
-    int failures;         // how many times has this EEPROM failed
-    int i2cAddr;          // where on the i2c bus is it
-    uint8_t* mems; // addresses that we know have failed
-} EEPROM; 
+    int bank;
+    int eeprom;
+    int ms;
+} revisitOverride;
 
+// Everything that can be set from the command line
 typedef struct {
-    EEPROM* all;
-} allEEPROMs; 
+    const char* simDir;   // NULL = real board
+    simConfig sim;
+    const char* topology; // NULL = the built-in board
+    int bankBusNum[TOPO_MAX_BANKS]; // /dev/i2c-N each bank is wired to, -1 = what the topology says
+    evlogConfig log;
+    bool fresh;           // ignore any unfinished checkpoint
+    bool probe;           // probe the board even if there's a cached result
+    int revisitMs;        // target sweep time for chips the topology doesn't give one
+    revisitOverride revisit[TOPO_MAX_CHIPS];
+    int numRevisit;
+    int boards[MAX_BOARDS]; // --boards, none = ask for one on stdin
+    int numBoards;
+    int runSeconds;       // 0 = until stopped
+    int rateKBps;         // per bus read cap to start with, 0 = none
+    const char* control;  // control socket, NULL = "board N control.sock" (or "fleet control.sock")
+    bool noControl;       // no control socket at all
+} runOptions;
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 // global variables :(
-int totalEEPROMs = NUM_BANKS * EEPROMS_PER_BANK; 
+int readChunk = READ_CHUNK; 
+double hotShare = HOT_SHARE;
+int readVotes = VOTE_READS;
+bool stuckTest = false;
+int statsMs = STATS_MS;
+int snapshotMin = SNAPSHOT_MIN;
+patternType testPatternType = PATTERN_FF; 
+uint32_t patternSeed = 1; 
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-// Return how many bytes are stored in a given bank,EEPROM combo
-// this is a really stupid and inefficient piece of code 
-// figure out a better way
-int getEEPROMSize(int bank, int num) {
-    int sizeKB;
+// Monotonic clock in ns - time(NULL) only has 1 second resolution
+uint64_t monoNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    switch(bank){
-        case 0: 
-            if(num >= 0 && num <= 3) { 
-                sizeKB = 4;
-            } else {
-                sizeKB = 512; 
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// What the chip sees as the address - past the word address it rolls over (see busReadBlock)
+uint32_t wordAddr(int addr, int addrBytes) {
+    return (uint32_t) (addr % (1L << (8 * addrBytes)));
+}
+
+// How much of a chip to take next - stops at the end of the chip and at the
+// roll over point so the expected pattern stays lined up with what's read
+int chunkLen(int start, int size, int chunk, int addrBytes) {
+    long span = 1L << (8 * addrBytes);
+    long len = size - start < chunk ? size - start : chunk;
+
+    if (start % span + len > span) {
+        len = span - start % span;
+    }
+
+    return (int) len;
+}
+
+/*
+Fill one EEPROM with its test pattern a page at a time. Each chunk is read back
+first and only pages that don't already match get written, so a board that's
+still clean from last time is basically just a read. Returns pages written or -1.
+*/
+int fillEEPROM(i2cBus* bus, EEPROM* current, uint8_t* buf) {
+    int pageSize = current->pageSize;
+    int written = 0;
+    uint8_t want[BUS_MAX_PAGE];
+
+    // read back in whole pages
+    int chunk = readChunk - readChunk % pageSize;
+
+    if (chunk < pageSize) {
+        chunk = pageSize;
+    }
+
+    for (int start = 0; start < current->size; ) {
+        int len = chunkLen(start, current->size, chunk, current->addrBytes);
+
+        // if it won't read back we just write every page blind
+        bool readBack = busReadBlock(bus, current->i2cAddr, current->devAddr, current->addrBytes, start, buf, len) == 0;
+
+        for (int page = 0; page < len; page += pageSize) {
+            int n = len - page < pageSize ? len - page : pageSize;
+
+            patternFill(&current->pattern, wordAddr(start + page, current->addrBytes), want, n);
+
+            if (readBack && memcmp(buf + page, want, n) == 0) {
+                continue;
             }
 
-            break;
-        case 1: 
-            if(num >= 0 && num <= 3) { 
-                sizeKB = 32;
-            } else { 
-                sizeKB = 128; 
+            if (busWritePage(bus, current->i2cAddr, current->devAddr, current->addrBytes, start + page, want, n) != 0 ||
+                busAckPoll(bus, current->i2cAddr, current->devAddr, current->addrBytes, start + page, WRITE_TIMEOUT_US) != 0) {
+                return -1;
             }
 
-            break;
-        case 2: 
-            if(num >= 0 && num <= 3) { 
-                sizeKB = 4;
-            } else {
-                sizeKB = -1; 
-            } 
+            written++;
+        }
 
-            break;
-        default:
-            return -1; 
-            break;
+        start += len;
     }
 
-    // kilobytes -> bytes
-    return 1000 * sizeKB; 
+    return written;
+}
+
+/* 
+Initialize all EEPROMs to hold their test pattern (0xFF unless --pattern says otherwise)
+*/
+void initEEPROMs(allEEPROMs* population) {
+    for (int chip = 0; chip < population->count; chip++) {
+        // grab current EEPROM from array
+        EEPROM* current = &population->all[chip];
+        i2cBus* bus = busForChip(population, current);
+        int eeprom = eepromNum(current);
+
+        // not fitted (or dead) - no map, so it never gets scheduled either
+        if (!current->present) {
+            continue;
+        }
+
+        // the topology is sorted by bank so this only switches once per bank
+        bool switched = busSelectBank(bus, current->bank);
+
+        current->i2cAddr = busSetup(bus, current->devAddr);
+
+        // give the mux a moment before the first chip on the new bank
+        if (switched && current->i2cAddr >= 0) {
+            busSettle(bus, current->i2cAddr, current->devAddr, current->addrBytes, MUX_SETTLE_TIMEOUT_US);
+        }
+
+        if (current->i2cAddr < 0) {
+            printf("Failed to initialize EEPROM %d in bank %d\n", eeprom, current->bank);
+            continue;
+        }
+
+        current->pattern.type = testPatternType;
+        current->pattern.seed = patternSeed + chip;
+
+        // page writes with ACK polling, skipping anything already blank
+        int pages = fillEEPROM(bus, current, population->buf);
+
+        if (pages < 0) {
+            printf("Failed to write to EEPROM %d in bank %d\n", eeprom, current->bank);
+        } else {
+            // bitmap of our saved addresses (kept in the checkpoint file) + which bits of them flipped
+            failMapAttach(&current->mems, ckptMap(population->ckpt, chip), current->size);
+            ckptSaveChip(population->ckpt, chip, current);
+
+            if (flipMasksCreate(&current->seen, seenReserve(current), &population->mem) != 0) {
+                printf("Out of memory for EEPROM %d in bank %d\n", eeprom, current->bank);
+            }
+
+            printf("Initialized EEPROM %d in bank %d (%d pages written)\n", eeprom, current->bank, pages);
+        }
+
+        busClose(bus, current->i2cAddr);
+    }
 }
 
 /*
-Initialize GPIO Pins
+Per bit cumulative counters for every EEPROM
 */
-void initGPIO() {
-    wiringPiSetup();
+void printBitSummary(allEEPROMs* population) {
+    printf("Bank EEPROM   bit: 0    1    2    3    4    5    6    7   (1->0 / 0->1)  multi-bit  stuck  misreads\n");
 
-    pinMode(BANK_SELECT_1, OUTPUT);
-    pinMode(BANK_SELECT_2, OUTPUT);
+    for (int i = 0; i < population->count; i++) {
+        EEPROM* current = &population->all[i];
+
+        printf("%4d %6d      ", current->bank, eepromNum(current));
+
+        for (int bit = 0; bit < 8; bit++) {
+            printf(" %u/%u", current->bitFlips[bit][0], current->bitFlips[bit][1]);
+        }
+
+        printf("   %d  %d  %d\n", current->multiBit, current->stuckBits, current->misreads);
+    }
 }
 
 /*
-Choose with bank of EEPROM we are looking at by changing which switch state we are at
+How often every region actually got looked at this run. Detection latency is
+how long a flip sits there on average before we read it: E[gap^2] / 2E[gap]
 */
-void selectBank(int bank) {
-    switch (bank) {
-        case 0:
-            digitalWrite(BANK_SELECT_1, LOW);
-            digitalWrite(BANK_SELECT_2, LOW);
+void writeRegionReport(allEEPROMs* population, const char* filename) {
+    FILE* out = fopen(filename, "w");
 
-            break;
-        case 1:
-            digitalWrite(BANK_SELECT_1, HIGH);
-            digitalWrite(BANK_SELECT_2, LOW);
-	    
-            break;
-        case 2:
-            digitalWrite(BANK_SELECT_1, HIGH);
-            digitalWrite(BANK_SELECT_2, HIGH);
-	    
-            break;
-        default:
-            printf("Invalid bank number\n");
-            
-            break;
+    if (out == NULL) {
+        printf("Failed to open %s\n", filename);
+        return;
     }
+
+    fprintf(out, "Bank, EEPROM, Start, Reads, Flips, Heat, Avg Gap (ms), Max Gap (ms), Detection Latency (ms)\n");
+
+    for (int i = 0; i < population->count; i++) {
+        EEPROM* current = &population->all[i];
+
+        for (int r = 0; current->regions != NULL && r < regionCount(current->size); r++) {
+            scanRegion* region = &current->regions[r];
+            double gaps = region->reads > 1 ? region->reads - 1 : 0;
+
+            fprintf(out, "%d, %d, %d, %u, %u, %.2f, %.1f, %.1f, %.1f\n", current->bank, eepromNum(current), r * REGION_BYTES,
+                region->reads, region->flips, region->heat,
+                gaps > 0 ? region->gapSumNs / gaps / 1e6 : 0, region->maxGapNs / 1e6,
+                region->gapSumNs > 0 ? region->gapSqSumNs / (2 * region->gapSumNs) / 1e6 : 0);
+        }
+    }
+
+    fclose(out);
 }
 
-/* 
-Initialize all EEPROMs to have 0xFF in all memory locations
+/*
+How long committing the event log took, slow SD cards show up here first
 */
-void initEEPROMs(allEEPROMs* population) {
-    // stores current eeprom
-    EEPROM* current = (EEPROM*) malloc(sizeof(EEPROM)); 
+void printLogStats(const evlogStats* stats) {
+    printf("Event log: %llu records in %llu commits", (unsigned long long) stats->records, (unsigned long long) stats->commits);
+
+    if (stats->commits > 0) {
+        printf(", avg %.1f us, p99 %.1f us, max %.1f us", stats->totalNs / 1e3 / stats->commits,
+            histPercentile(&stats->commitHist, 99) / 1e3, stats->maxNs / 1e3);
+    }
 
-    for (int bank = 0; bank < NUM_BANKS; bank++) {
-        selectBank(bank);
+    if (stats->failures > 0) {
+        printf(", %llu FAILED", (unsigned long long) stats->failures);
+    }
 
-        for (int eeprom = 0; eeprom < EEPROMS_PER_BANK; eeprom++) {
-            // grab current EEPROM from array
-            current = &((population->all)[bank * EEPROMS_PER_BANK  + eeprom]);
-            current->i2cAddr = wiringPiI2CSetup(EEPROM_ADDRESS + eeprom);
+    printf("\n");
+}
 
-            if (current->i2cAddr < 0) {
-                printf("Failed to initialize EEPROM %d in bank %d\n", eeprom, bank);
-            } else {
-		        current->size = getEEPROMSize(bank, eeprom);
-		        bool init = true;
+/*
+Read the command line
+    ./rad                        real board through wiringPi
+    ./rad --sim DIR [options]    simulated board, one file per chip in DIR
+    ./rad --boards N,N,...       drive all of these boards at once, into "fleet events.bin"
+    ./rad --config FILE          options from a file, one "option value" per line (no --), # comments
+        --byte-ns N      bus time per byte (0 = full CPU speed)
+        --xfer-ns N      bus time per transaction
+        --write-ns N     write cycle time after a page write
+        --flip-rate R    upsets per megabit per second
+        --flip-cluster F fraction of upsets that land in one 4K spot per chip
+        --stuck-bits F   fraction of upsets that leave the bit stuck
+        --mux-settle-ns N  time after a bank switch before the new bank answers
+        --read-err P     chance a byte read comes back garbled
+        --stuck-rate P   chance a transaction leaves SDA stuck low
+        --drop-rate R    times a minute each chip stops answering
+        --drop-ms N      for this long
+        --seed S         fault injection seed
+    --chunk N            bytes per bulk read (default READ_CHUNK)
+    --pattern P          ff, 00, checker, addr or prng (default ff)
+    --pattern-seed S     PRNG pattern seed, each chip gets its own off this
+    --topology FILE      what's on the board (default the original board, see topology.h), "board N topology.txt" beats it
+    --buses N,N,...      i2c bus number for each bank in order, over whatever the topology says
+    --commit-ms N        fdatasync the event log at least every N ms (default 1000, 0 = only on full batches)
+    --commit-records N   records per batch, committed as soon as it fills (default 4096)
+    --fresh              re-initialize even if the last run didn't finish
+    --probe              probe the board again instead of using "board N probe.txt"
+    --revisit MS         target time for a full sweep of chips the topology doesn't give one (default REVISIT_MS)
+    --revisit B:E:MS     same for just EEPROM E in bank B, beats the topology
+    --hot-share F        most of the bus time extra reads of hot regions can take (default HOT_SHARE, 0 = off)
+    --votes N            re-reads a mismatching byte gets before it counts (default VOTE_READS, 0 = off)
+    --stuck-test         write confirmed flips back to find stuck bits (off by default, writes to the cells under test)
+    --stats-ms N         rewrite "board N stats.txt" this often (default STATS_MS, 0 = off)
+    --snapshot-min N     keep a snapshot of every chip this often (default SNAPSHOT_MIN, 0 = only when asked for)
+    --seconds N          how long to scan (default RUNNING_TIME_SEC, 0 = until stopped)
+    --rate N             cap every bus at N KB/s to start with (default 0 = flat out), "rate N" on the control socket changes it
+    --control PATH       control socket (default "board N control.sock", see control.h)
+    --no-control         no control socket
+*/
+bool parseOptions(int argc, char** argv, runOptions* opts, int depth);
+
+bool parseArgs(int argc, char** argv, runOptions* opts) {
+    opts->simDir = NULL;
+    opts->sim = simDefaults();
+    opts->log = evlogDefaults();
+    opts->fresh = false;
+    opts->probe = false;
+    opts->topology = NULL;
+    opts->revisitMs = REVISIT_MS;
+    opts->numRevisit = 0;
+    opts->numBoards = 0;
+    opts->runSeconds = RUNNING_TIME_SEC;
+    opts->rateKBps = 0;
+    opts->control = NULL;
+    opts->noControl = false;
+
+    for (int bank = 0; bank < TOPO_MAX_BANKS; bank++) {
+        opts->bankBusNum[bank] = -1;
+    }
 
-                // Linearly initialize all locations in EEPROM ; wish this was faster but impossible for better than O(n)
-                for (int num = 0; num < current->size; num++) {
-                    if (wiringPiI2CWrite(current->i2cAddr, 0xFF) == -1) {
-                        printf("Failed to write to EEPROM %d in bank %d\n", eeprom, bank);
-                        init = false;
+    return parseOptions(argc, argv, opts, 0);
+}
+
+/*
+Options out of a file instead of the command line, so a beam run can be set
+up ahead of time. Same names without the dashes, the value is the rest of the
+line (so paths can have spaces):
 
-                        break;
-                    } 		
+    # day 2, boards 3 and 5 on their own buses
+    boards 3,5
+    seconds 28800
+    pattern checker
+    fresh
+
+Whatever comes after --config on the command line still wins.
+*/
+bool parseConfig(const char* path, runOptions* opts, int depth) {
+    FILE* in = fopen(path, "r");
+
+    if (in == NULL || depth >= CONFIG_MAX_DEPTH) {
+        printf(in == NULL ? "Failed to open config %s\n" : "Too many --config files inside each other at %s\n", path);
+
+        if (in != NULL) {
+            fclose(in);
+        }
+
+        return false;
+    }
+
+    char line[CONFIG_LINE];
+    int lineNum = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), in) != NULL) {
+        char* name = line + strspn(line, " \t");
+        char* end = name + strcspn(name, "#\r\n");
+
+        lineNum++;
+
+        // trailing space and comments off
+        while (end > name && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+
+        *end = '\0';
+
+        if (*name == '\0') {
+            continue;
+        }
+
+        char* value = name + strcspn(name, " \t");
+
+        if (*value != '\0') {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+        }
+
+        // the options keep pointers into these, so they stay for the whole run
+        char* args[3] = { (char*) path, (char*) malloc(strlen(name) + 3), *value != '\0' ? strdup(value) : NULL };
+
+        if (args[1] == NULL) {
+            break;
+        }
+
+        sprintf(args[1], "--%s", name);
+        ok = parseOptions(args[2] != NULL ? 3 : 2, args, opts, depth + 1);
+
+        if (!ok) {
+            printf("(line %d of %s)\n", lineNum, path);
+        }
+    }
+
+    fclose(in);
+
+    return ok;
+}
+
+// argv[1..] on top of whatever's already in opts
+bool parseOptions(int argc, char** argv, runOptions* opts, int depth) {
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--sim") == 0 && hasValue) {
+            opts->simDir = argv[++i];
+        } else if (strcmp(argv[i], "--byte-ns") == 0 && hasValue) {
+            opts->sim.byteLatencyNs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--xfer-ns") == 0 && hasValue) {
+            opts->sim.xferLatencyNs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--write-ns") == 0 && hasValue) {
+            opts->sim.writeCycleNs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--flip-rate") == 0 && hasValue) {
+            opts->sim.flipRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--mux-settle-ns") == 0 && hasValue) {
+            opts->sim.muxSettleNs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--flip-cluster") == 0 && hasValue) {
+            opts->sim.flipCluster = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stuck-bits") == 0 && hasValue) {
+            opts->sim.stuckBits = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--read-err") == 0 && hasValue) {
+            opts->sim.readErrRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stuck-rate") == 0 && hasValue) {
+            opts->sim.stuckRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--drop-rate") == 0 && hasValue) {
+            opts->sim.dropRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--drop-ms") == 0 && hasValue) {
+            opts->sim.dropMs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            opts->sim.seed = (unsigned int) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--chunk") == 0 && hasValue) {
+            readChunk = atoi(argv[++i]);
+
+            if (readChunk <= 0) {
+                printf("Chunk size has to be positive\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--pattern") == 0 && hasValue) {
+            int type = patternParse(argv[++i]);
+
+            if (type < 0) {
+                printf("Unknown pattern %s\n", argv[i]);
+
+                return false;
+            }
+
+            testPatternType = (patternType) type;
+        } else if (strcmp(argv[i], "--buses") == 0 && hasValue) {
+            char* list = argv[++i];
+
+            for (int bank = 0; bank < TOPO_MAX_BANKS; bank++) {
+                opts->bankBusNum[bank] = atoi(list);
+
+                // short list -> the rest stay on the last bus given
+                char* comma = strchr(list, ',');
+
+                if (comma != NULL) {
+                    list = comma + 1;
+                } else if (bank + 1 < TOPO_MAX_BANKS) {
+                    opts->bankBusNum[bank + 1] = opts->bankBusNum[bank];
                 }
+            }
+        } else if (strcmp(argv[i], "--boards") == 0 && hasValue) {
+            char* list = argv[++i];
 
-                if(init) {
-                    // malloc our saved addresses array
-                   current->mems = calloc(current->size, sizeof(current->mems));
+            for (opts->numBoards = 0; list != NULL; list = strchr(list, ',') != NULL ? strchr(list, ',') + 1 : NULL) {
+                int num = atoi(list);
 
-                    printf("Initialized EEPROM %d in bank %d\n", eeprom, bank);
+                for (int n = 0; n < opts->numBoards; n++) {
+                    if (opts->boards[n] == num) {
+                        printf("Board %d is in --boards twice\n", num);
+
+                        return false;
+                    }
                 }
 
-                close(current->i2cAddr);
+                if (opts->numBoards == MAX_BOARDS || num < 0 || num >= EVLOG_FLEET) {
+                    printf("--boards takes up to %d board numbers\n", MAX_BOARDS);
+
+                    return false;
+                }
+
+                opts->boards[opts->numBoards++] = num;
+            }
+        } else if (strcmp(argv[i], "--topology") == 0 && hasValue) {
+            opts->topology = argv[++i];
+        } else if (strcmp(argv[i], "--revisit") == 0 && hasValue) {
+            int bank, eeprom, ms;
+            const char* arg = argv[++i];
+
+            if (sscanf(arg, "%d:%d:%d", &bank, &eeprom, &ms) == 3) {
+                if (ms <= 0 || opts->numRevisit == TOPO_MAX_CHIPS) {
+                    printf("Bad --revisit %s\n", arg);
+
+                    return false;
+                }
+
+                // checked against the topology once it's loaded
+                revisitOverride* over = &opts->revisit[opts->numRevisit++];
+
+                over->bank = bank;
+                over->eeprom = eeprom;
+                over->ms = ms;
+            } else if ((ms = atoi(arg)) > 0) {
+                opts->revisitMs = ms;
+            } else {
+                printf("Bad --revisit %s\n", arg);
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--hot-share") == 0 && hasValue) {
+            hotShare = atof(argv[++i]);
+
+            if (hotShare < 0 || hotShare > 0.9) {
+                printf("--hot-share has to be between 0 and 0.9\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--votes") == 0 && hasValue) {
+            readVotes = atoi(argv[++i]);
+
+            if (readVotes < 0 || readVotes > 255) {
+                printf("--votes has to be between 0 and 255\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--stats-ms") == 0 && hasValue) {
+            statsMs = atoi(argv[++i]);
+
+            if (statsMs < 0) {
+                printf("--stats-ms can't be negative\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--snapshot-min") == 0 && hasValue) {
+            snapshotMin = atoi(argv[++i]);
+
+            if (snapshotMin < 0) {
+                printf("--snapshot-min can't be negative\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--stuck-test") == 0) {
+            stuckTest = true;
+        } else if (strcmp(argv[i], "--fresh") == 0) {
+            opts->fresh = true;
+        } else if (strcmp(argv[i], "--probe") == 0) {
+            opts->probe = true;
+        } else if (strcmp(argv[i], "--commit-ms") == 0 && hasValue) {
+            opts->log.intervalMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--commit-records") == 0 && hasValue) {
+            opts->log.batchRecords = atoi(argv[++i]);
+
+            if (opts->log.batchRecords <= 0) {
+                printf("--commit-records has to be at least 1\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--pattern-seed") == 0 && hasValue) {
+            patternSeed = (uint32_t) atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            opts->runSeconds = atoi(argv[++i]);
+
+            if (opts->runSeconds < 0) {
+                printf("--seconds can't be negative\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--rate") == 0 && hasValue) {
+            opts->rateKBps = atoi(argv[++i]);
+
+            if (opts->rateKBps < 0) {
+                printf("--rate can't be negative\n");
+
+                return false;
+            }
+        } else if (strcmp(argv[i], "--control") == 0 && hasValue) {
+            opts->control = argv[++i];
+        } else if (strcmp(argv[i], "--no-control") == 0) {
+            opts->noControl = true;
+        } else if (strcmp(argv[i], "--config") == 0 && hasValue) {
+            if (!parseConfig(argv[++i], opts, depth)) {
+                return false;
             }
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+
+            return false;
         }
     }
 
-    // free our temporary storage
-   // free(current); 
+    return true;
 }
 
-void logger(time_t startTime, int greedy, int boardNum, FILE* csv_file, allEEPROMs* population) {
-    time_t currTime = 0;
-    int elapsedTime = 0; 
-    int eepromSize = 0; 
-
-    EEPROM* current = (EEPROM*) malloc(sizeof(EEPROM)); 
-
-    // Go through all EEPROMs and banks 
-    for (int bank = 0; bank < NUM_BANKS; bank++) {
-        selectBank(bank); 
-
-        for (int eeprom = 0; eeprom < EEPROMS_PER_BANK; eeprom++) {
-            // Get current EEPROM from total population
-
-		// this line does not properly bounds check
-		//potential segfault????
-            current = &((population->all)[bank * EEPROMS_PER_BANK  + eeprom]);
-            current->i2cAddr = wiringPiI2CSetup(EEPROM_ADDRESS + eeprom); 
-
-	    //printf("yeet %d", current->size);
-            // make sure our EEPROM actually exists lol 
-            if(current->i2cAddr >= 0) {
-
-                /*
-                do 512 in 128k blocks so more data points :) 
-                */
-                for (int byte = 0; byte < current->size; byte++) {     
-                    int data = wiringPiI2CRead(current->i2cAddr);
-
-			// july 18 - this line changed from > to >= , which is more correct
-			// but untested as of today - this will be removed once confirmed
-                    if(data != 0xFF && data >= 0){
-                        // check to see if we've looked at this before
-                        // yay O(1) access but rip space complexity :( 
-                        if( ((current->mems))[byte] != 1) {
-                            current->failures =  current->failures + 1; 
-                            (current->mems)[byte] = 1;
-                         } /// otherwise we do not want to double count failure
-                    } 
-                }
-                // get current time and calculate how long since we've started
-                currTime = time(NULL); 
-                elapsedTime = difftime(currTime, startTime); 
-
-                // Log to CSV file 
-                fprintf(csv_file, "%d, %d, %d, %d\n", elapsedTime, bank, eeprom, current->failures);
-                
-                close(current->i2cAddr); 
-            } else {
-                current->failures = -1337; // since it doesn't exist 
+/*
+Read the board's topology - "board N topology.txt" if there is one, otherwise
+--topology or the built-in one - and put the command line on top of it:
+--buses moves whole banks, --revisit fills in sweep targets.
+*/
+bool loadTopology(const runOptions* opts, int num, boardTopology* topo) {
+    char own[50];
+    const char* path = opts->topology;
+
+    sprintf(own, "board %d topology.txt", num);
+
+    if (access(own, R_OK) == 0) {
+        path = own;
+    }
+
+    if (path == NULL) {
+        topologyDefault(topo);
+    } else if (topologyLoad(path, topo) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < topo->count; i++) {
+        chipDesc* chip = &topo->chips[i];
+
+        if (opts->bankBusNum[chip->bank] >= 0) {
+            chip->busNum = opts->bankBusNum[chip->bank];
+        }
+
+        if (chip->revisitMs == 0) {
+            chip->revisitMs = opts->revisitMs;
+        }
+    }
+
+    for (int k = 0; k < opts->numRevisit; k++) {
+        const revisitOverride* over = &opts->revisit[k];
+        int i = topologyFind(topo, over->bank, EEPROM_ADDRESS + over->eeprom);
+
+        if (i < 0) {
+            printf("--revisit %d:%d:%d - there's no EEPROM %d in bank %d\n", over->bank, over->eeprom, over->ms, over->eeprom, over->bank);
+
+            return false;
+        }
+
+        topo->chips[i].revisitMs = over->ms;
+    }
+
+    return topo->count > 0;
+}
+
+/*
+Open one bus per distinct bus number the chips are spread over. A bus that
+carries more than one bank has to go through the mux. If one won't open,
+numBuses is how many did and it's up to the caller to close them.
+*/
+bool openBuses(const runOptions* opts, const boardTopology* topo, allEEPROMs* population) {
+    population->numBuses = 0;
+
+    for (int i = 0; i < topo->count; i++) {
+        int found = -1;
+
+        for (int b = 0; b < population->numBuses; b++) {
+            if (population->busNum[b] == topo->chips[i].busNum) {
+                found = b;
             }
         }
+
+        if (found < 0) {
+            if (population->numBuses == MAX_BUSES) {
+                printf("Too many buses, max is %d\n", MAX_BUSES);
+                population->numBuses = 0;
+
+                return false;
+            }
+
+            found = population->numBuses++;
+            population->busNum[found] = topo->chips[i].busNum;
+        }
+
+        population->all[i].bus = found;
+    }
+
+    for (int b = 0; b < population->numBuses; b++) {
+        int firstBank = -1;
+        bool useMux = false;
+
+        for (int i = 0; i < topo->count; i++) {
+            if (population->all[i].bus != b) {
+                continue;
+            }
+
+            if (firstBank < 0) {
+                firstBank = topo->chips[i].bank;
+            }
+
+            useMux |= topo->chips[i].bank != firstBank;
+        }
+
+        if (opts->simDir == NULL) {
+            population->buses[b] = busOpenWiringPi(population->busNum[b], useMux);
+        } else {
+            population->buses[b] = busOpenSim(opts->simDir, &opts->sim);
+        }
+
+        if (population->buses[b] == NULL) {
+            population->numBuses = b;
+
+            return false;
+        }
+    }
+
+    // populate the fake board(s) the same way the topology says the real one is laid out
+    for (int i = 0; i < topo->count && opts->simDir != NULL; i++) {
+        const chipDesc* chip = &topo->chips[i];
+
+        simAddChip(busForChip(population, &population->all[i]), chip->bank, chip->devAddr, chip->size, chip->pageSize, chip->addrBytes);
+    }
+
+    return true;
+}
+
+/*
+How much arena a board needs, all of it known from the topology before anything
+gets opened: the chips, the init buffer, region heat and seen masks for the
+biggest each one could probe as (it can wrap anywhere under what its address
+bytes reach), and the scan pipeline's blocks and rings for every bus and the
+snapshot writer.
+*/
+size_t boardArenaBytes(const boardTopology* topo) {
+    int busNums[TOPO_MAX_CHIPS];
+    int numBuses = 0;
+    size_t bytes = arenaRound(sizeof(allEEPROMs)) + arenaRound(topo->count * sizeof(EEPROM)) +
+        arenaRound(readChunk > BUS_MAX_PAGE ? readChunk : BUS_MAX_PAGE);
+
+    for (int i = 0; i < topo->count; i++) {
+        const chipDesc* chip = &topo->chips[i];
+        long span = 1L << (8 * chip->addrBytes);
+        int most = chip->size > span ? chip->size : (int) span;
+        bool seenBus = false;
+
+        // the seen masks as they start, then the same again at twice the size
+        bytes += arenaRound(regionCount(most) * sizeof(scanRegion)) +
+            flipMasksBytes(most / SEEN_RESERVE) + flipMasksBytes(2 * (most / SEEN_RESERVE));
+
+        for (int b = 0; b < numBuses; b++) {
+            seenBus |= busNums[b] == chip->busNum;
+        }
+
+        if (!seenBus) {
+            busNums[numBuses++] = chip->busNum;
+        }
     }
 
+    return bytes + pipelineBytes(numBuses, topo->count);
+}
 
-   // free(current); 
+/*
+Undo setupBoard: close the checkpoint (marked done if clean), shut the buses,
+give back any seen masks that outgrew the arena and then the arena itself,
+which takes population with it.
+*/
+void teardownBoard(allEEPROMs* population, bool clean) {
+    ckptClose(population->ckpt, clean);
+
+    for (int b = 0; b < population->numBuses; b++) {
+        busDestroy(population->buses[b]);
+    }
+
+    for (int i = 0; i < population->count; i++) {
+        flipMasksFree(&population->all[i].seen);
+    }
+
+    arenaDestroy(&population->mem);
 }
 
+/*
+Everything one board needs before it can be scanned: buses, probe, checkpoint,
+and either the pattern written or the last run's state picked back up. In a
+fleet every board's simulator gets its own directory (and seed) under --sim.
+All of it but the checkpoint and the buses comes out of one arena (see arena.h).
+NULL if the board can't be run.
+*/
+allEEPROMs* setupBoard(const runOptions* opts, int num, boardTopology* board) {
+    boardTopology topo = *board;
+    runOptions boardOpts = *opts;
+    char simDir[300];
+
+    if (opts->simDir != NULL && opts->numBoards > 1) {
+        if (mkdir(opts->simDir, 0755) != 0 && errno != EEXIST) {
+            printf("Failed to create sim directory %s\n", opts->simDir);
+            return NULL;
+        }
 
-int main() {
-    initGPIO();
+        snprintf(simDir, sizeof(simDir), "%s/board %d", opts->simDir, num);
+        boardOpts.simDir = simDir;
+        boardOpts.sim.seed = opts->sim.seed + (unsigned int) num;
+    }
 
+    // one mapping for the whole board, the EEPROM handler itself included
+    arena mem;
+
+    if (arenaCreate(&mem, boardArenaBytes(&topo)) != 0) {
+        printf("Out of memory for board %d\n", num);
+        return NULL;
+    }
+
+    allEEPROMs* population = (allEEPROMs*) arenaAlloc(&mem, sizeof(*population));
+
+    population->mem = mem;
+
+    // storage of all our eeprom structs
+    population->board = num;
+    population->count = topo.count;
+    population->all = (EEPROM*) arenaAlloc(&population->mem, population->count * sizeof(EEPROM));
+
+    for (int i = 0; i < population->count; i++) {
+        EEPROM* current = &population->all[i];
+        const chipDesc* chip = &topo.chips[i];
+
+        current->size = chip->size;
+        current->bank = chip->bank;
+        current->devAddr = chip->devAddr;
+        current->pageSize = chip->pageSize;
+        current->addrBytes = chip->addrBytes;
+        current->revisitMs = chip->revisitMs;
+    }
+
+    if (!openBuses(&boardOpts, &topo, population)) {
+        printf("Failed to open I2C bus for board %d\n", num);
+
+        // the ones that did open aren't in the arena
+        for (int b = 0; b < population->numBuses; b++) {
+            busDestroy(population->buses[b]);
+        }
+
+        arenaDestroy(&population->mem);
+        return NULL;
+    }
+
+    // big enough for a page even if --chunk is tiny
+    population->buf = (uint8_t*) arenaAlloc(&population->mem, readChunk > BUS_MAX_PAGE ? readChunk : BUS_MAX_PAGE);
+
+    // what's actually on the board - saved per board so only the first run has to look
+    char probename[50];
+    probeResult* probed = (probeResult*) calloc(population->count, sizeof(probeResult));
+
+    if (probed == NULL) {
+        printf("Out of memory probing board %d\n", num);
+        teardownBoard(population, false);
+        return NULL;
+    }
+
+    sprintf(probename, "board %d probe.txt", num);
+
+    if (opts->probe || !probeLoadCache(probename, population, probed)) {
+        probeBoard(population, probed);
+        probeSaveCache(probename, population, probed);
+    } else {
+        printf("Using the probe results in %s\n", probename);
+    }
+
+    for (int i = 0; i < population->count; i++) {
+        EEPROM* current = &population->all[i];
+
+        current->present = probed[i].status == PROBE_OK;
+        current->size = probed[i].size;
+
+        // the checkpoint has to know about the measured size
+        topo.chips[i].size = current->size;
+    }
+
+    free(probed);
+
+    // failure state goes in a file so a crash doesn't lose it
+    ckptLayout layout = { 0 };
+
+    layout.board = num;
+    layout.topo = &topo;
+    layout.patternType = testPatternType;
+    layout.patternSeed = patternSeed;
+
+    char statename[50];
+    bool resumed;
+
+    sprintf(statename, "board %d state.bin", num);
+    population->ckpt = ckptOpen(statename, &layout, opts->fresh, &resumed);
+
+    if (population->ckpt == NULL) {
+        printf("Failed to open checkpoint for board %d\n", num);
+        teardownBoard(population, false);
+        return NULL;
+    }
+
+    if (resumed) {
+        // chips still hold the pattern (and the flips) from before, don't touch them
+        uint64_t t0 = monoNs();
+
+        ckptRestore(population->ckpt, population);
+        printf("Board %d resumed from checkpoint in %.2f ms\n", num, (monoNs() - t0) / 1e6);
+    } else {
+        // Initialize everything
+        initEEPROMs(population);
+        ckptInitDone(population->ckpt);
+    }
+
+    for (int i = 0; i < population->count; i++) {
+        EEPROM* current = &population->all[i];
+
+        if (current->mems.words != NULL) {
+            current->regions = (scanRegion*) arenaAlloc(&population->mem, regionCount(current->size) * sizeof(scanRegion));
+        }
+    }
+
+    printf("Board %d: %zu KB arena%s, %zu KB of it set aside for the scan\n", num, population->mem.size / 1024,
+        population->mem.huge ? " on huge pages" : "", (population->mem.size - atomic_load(&population->mem.used)) / 1024);
+
+    return population;
+}
+
+/*
+Give up on a run after the event log's open: close the log, tear down the
+numBoards boards that got set up (left resumable) and free the topologies.
+Always -1, for main to return.
+*/
+int abortRun(evlog* log, allEEPROMs** boards, int numBoards, boardTopology* topos) {
+    evlogClose(log);
+
+    for (int n = 0; n < numBoards; n++) {
+        teardownBoard(boards[n], false);
+    }
+
+    free(topos);
+
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    runOptions opts;
+
+    // as a daemon stdout is a file, and a block buffered one shows nothing until the run's over
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (!parseArgs(argc, argv, &opts)) {
+        return -1;
+    }
 
     // illusion of choice ^-^ 
     // Optionally initialize EEPROMs or not
@@ -250,57 +957,168 @@ int main() {
     //int choice;
    // scanf("%d", &choice);
 
-    printf("Board number: ");
-    int num; 
-    scanf("%d", &num); 
+    // headless runs give --boards, nothing reads stdin then
+    if (opts.numBoards == 0) {
+        printf("Board number: ");
+        int num; 
+
+        if (scanf("%d", &num) != 1) {
+            printf("No board number (give one with --boards N to run without asking)\n");
+            return -1;
+        }
+
+        opts.boards[opts.numBoards++] = num;
+    }
+
+    bool fleet = opts.numBoards > 1;
 
-    time_t ctime = time(NULL); 
+    // a run that's answering on the socket is using the same chips and files - leave it be
+    char controlname[50];
+
+    if (fleet) {
+        sprintf(controlname, "fleet control.sock");
+    } else {
+        sprintf(controlname, "board %d control.sock", opts.boards[0]);
+    }
+
+    const char* controlPath = opts.control != NULL ? opts.control : controlname;
+
+    if (!opts.noControl && controlInUse(controlPath)) {
+        printf("Another run is answering on %s, not starting\n", controlPath);
+        return -1;
+    }
     
+    // every flip and chip pass goes in here, evlog2csv turns it back into the CSVs
+    // a fleet shares one, every record says which board it's from
     char filename[50];
 
-    sprintf(filename, "board %d data.csv", num);
-    FILE *csv_file = fopen(filename, "a");
+    if (fleet) {
+        sprintf(filename, "fleet events.bin");
+    } else {
+        sprintf(filename, "board %d events.bin", opts.boards[0]);
+    }
+
+    evlog* log = evlogOpen(filename, fleet ? EVLOG_FLEET : opts.boards[0], &opts.log);
 
-    if (csv_file == NULL) {
-        printf("Failed to open CSV file\n");
+    if (log == NULL) {
+        printf("Failed to open event log\n");
         return -1;
     }
 
-    fprintf(csv_file, "Elapsed Time, Bank, EEPROM, Failures\n");
+    // what's on every board, before anything touches them
+    boardTopology* topos = (boardTopology*) calloc(opts.numBoards, sizeof(boardTopology));
 
-    fclose(csv_file);
-    fopen(filename, "a");
+    for (int n = 0; n < opts.numBoards; n++) {
+        if (topos == NULL || !loadTopology(&opts, opts.boards[n], &topos[n])) {
+            printf("No usable board topology for board %d\n", opts.boards[n]);
+            return abortRun(log, NULL, 0, topos);
+        }
 
-    // malloc our entire EEPROM handler
-     allEEPROMs* population = (allEEPROMs*) malloc(sizeof(*population));
-    
-    // malloc storage of all our eeprom structs
-    population->all = (EEPROM*) calloc(totalEEPROMs, sizeof(EEPROM));
+        // two boards can't both drive the same controller (the simulator gives each board its own)
+        for (int m = 0; m < n && opts.simDir == NULL; m++) {
+            for (int i = 0; i < topos[n].count; i++) {
+                for (int j = 0; j < topos[m].count; j++) {
+                    if (topos[n].chips[i].busNum == topos[m].chips[j].busNum) {
+                        printf("Boards %d and %d are both on i2c-%d - give each one its own buses in \"board N topology.txt\"\n",
+                            opts.boards[m], opts.boards[n], topos[n].chips[i].busNum);
+                        return abortRun(log, NULL, 0, topos);
+                    }
+                }
+            }
+        }
+    }
+
+    allEEPROMs* boards[MAX_BOARDS];
+
+    for (int n = 0; n < opts.numBoards; n++) {
+        boards[n] = setupBoard(&opts, opts.boards[n], &topos[n]);
+
+        // the ones already set up stay resumable
+        if (boards[n] == NULL) {
+            return abortRun(log, boards, n, topos);
+        }
+    }
+
+    free(topos);
+
+    // reset - one time base for the whole fleet, so timestamps line up across boards
+    runControl ctl;
+
+    controlInit(&ctl, opts.runSeconds, opts.rateKBps);
 
-    // Initialize everything
-    initEEPROMs(population);
+    for (int n = 0; n < opts.numBoards; n++) {
+        boards[n]->startNs = ctl.startNs;
+    }
+
+    // from here on ^C / kill winds the run down instead of cutting it off mid write
+    controlSignals(&ctl);
+
+    // only a socket that can't be made at all gets left out, not one that got taken while the boards were set up
+    if (!opts.noControl && controlOpen(&ctl, controlPath) != 0) {
+        if (controlInUse(controlPath)) {
+            printf("Another run started on %s while setting up, stopping\n", controlPath);
+            return abortRun(log, boards, opts.numBoards, NULL);
+        }
+
+        printf("Carrying on without a control socket\n");
+    }
 
-    // reset
-    ctime = time(NULL); 
+    // mark where this run starts in the log, once per board
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    for (int n = 0; n < opts.numBoards; n++) {
+        evlogRecord start = { 0 };
+        start.kind = EV_START;
+        start.board = (uint16_t) boards[n]->board;
+        start.ns = (uint64_t) wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+        start.count = patternSeed;
+        start.pattern = (uint8_t) testPatternType;
+        evlogAppend(log, &start);
+    }
 
     printf("it's logging time\n");
 
-    // Continuously log data - no sleep needed since takes time to read EEPROMs
-    while ( (int)(difftime(time(NULL), ctime)) <= RUNNING_TIME_SEC ) {
-        logger(ctime, 0, num, csv_file, population);
-	fclose(csv_file); // update file
-	fopen(filename, "a");
+    // Continuously log data - reader and compare threads for every bus of every board, one log thread, until time's up
+    char statsname[50];
+
+    if (fleet) {
+        sprintf(statsname, "fleet stats.txt");
+    } else {
+        sprintf(statsname, "board %d stats.txt", opts.boards[0]);
     }
 
-    // Close & Free all allocated stuff
-    fclose(csv_file);
+    runPipeline(boards, opts.numBoards, &ctl, log, statsname);
+    controlClose(&ctl);
+
+    // stopped early - the checkpoint stays unfinished so the next start carries on from here
+    bool stopped = atomic_load(&ctl.stop);
 
-    // still need to free all EEPROM elements :) 
+    if (stopped) {
+        printf("Stopped early, everything read so far is logged and the next start picks up where this left off\n");
+    }
+
+    for (int n = 0; n < opts.numBoards; n++) {
+        if (fleet) {
+            printf("Board %d\n", boards[n]->board);
+        }
+
+        printBitSummary(boards[n]);
+
+        char regionname[50];
 
-    // WHAT THE HECK IS A GARBAGE COLLECTOR RAHHHH
-    // I AM THE GARBAGE COLLECTOR
-    // THEY CALL ME THE TRASH MAN
-    // I COLLECT TRASH
+        sprintf(regionname, "board %d regions.csv", boards[n]->board);
+        writeRegionReport(boards[n], regionname);
+    }
+
+    // Close & Free all allocated stuff
+    evlogCommit(log);
+    printLogStats(&log->stats);
+    evlogClose(log);
+
+    for (int n = 0; n < opts.numBoards; n++) {
+        teardownBoard(boards[n], !stopped);
+    }
 
     printf("Completed and written to file.\n"); 
 
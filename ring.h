@@ -0,0 +1,113 @@
+/*
+
+Lock-free Ring Buffer for EEPROM Control
+
+Single producer / single consumer queue of fixed size elements. One thread
+only ever pushes and one only ever pops, so a pair of atomic counters is all
+the synchronization it needs.
+
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include "arena.h"
+
+typedef struct {
+    _Atomic size_t head;  // next slot to pop, only the consumer moves it
+    char pad1[64 - sizeof(size_t)];
+    _Atomic size_t tail;  // next slot to push, only the producer moves it
+    char pad2[64 - sizeof(size_t)];
+    size_t mask;          // capacity - 1, capacity is a power of 2
+    size_t elemSize;
+    uint8_t* slots;
+} spscRing;
+
+// slots a ring asked for capacity elements really gets
+static inline size_t ringSlots(size_t capacity) {
+    size_t cap = 2;
+
+    while (cap < capacity) {
+        cap *= 2;
+    }
+
+    return cap;
+}
+
+// bytes of arena a ring takes
+static inline size_t ringBytes(size_t capacity, size_t elemSize) {
+    return arenaRound(ringSlots(capacity) * elemSize);
+}
+
+// slots come out of mem and go when it does, -1 if it's full
+static inline int ringInit(spscRing* ring, size_t capacity, size_t elemSize, arena* mem) {
+    size_t cap = ringSlots(capacity);
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = cap - 1;
+    ring->elemSize = elemSize;
+    ring->slots = (uint8_t*) arenaAlloc(mem, cap * elemSize);
+
+    return ring->slots == NULL ? -1 : 0;
+}
+
+// false if full
+static inline bool ringPush(spscRing* ring, const void* elem) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head > ring->mask) {
+        return false;
+    }
+
+    memcpy(ring->slots + (tail & ring->mask) * ring->elemSize, elem, ring->elemSize);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+// false if empty
+static inline bool ringPop(spscRing* ring, void* elem) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(elem, ring->slots + (head & ring->mask) * ring->elemSize, ring->elemSize);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+static inline size_t ringCount(spscRing* ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) - atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/*
+Back off while waiting on a ring: spin a bit, then yield, then actually sleep
+so an idle stage doesn't eat a whole core
+*/
+static inline void ringWait(int* spins) {
+    (*spins)++;
+
+    if (*spins < 64) {
+        return;
+    } else if (*spins < 1024) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, 50000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+#endif
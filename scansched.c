@@ -0,0 +1,374 @@
+/*
+
+Scan Scheduler for EEPROM Control
+
+A chip's deadline moves forward by revisitNs * len / size for every len bytes
+read off it, so a chip that's kept up finishes each sweep in revisitNs. When
+the bus can't keep up with everybody the deadlines slip behind real time;
+they're never allowed to get more than one slice behind. That way a chip that
+was out of the rotation doesn't hog the bus catching up, and a big chip can't
+bank a whole revisit interval of lateness and push the small ones off their
+targets - it's the big ones that take longer.
+
+Hot reads come out of a token bucket that fills at hotShare of real time, so
+over any stretch longer than a second they can't take more than that share of
+the bus. When the sweeps are all ahead of schedule the bus would be reading
+early anyway, so hot reads are free then.
+
+*/
+
+// Libraries
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "scansched.h"
+
+int regionCount(int size) {
+    return (size + REGION_BYTES - 1) / REGION_BYTES;
+}
+
+void schedInit(scanSched* sched, double hotShare, uint64_t nowNs) {
+    sched->count = 0;
+    sched->numHot = 0;
+    sched->hotShare = hotShare;
+    sched->budgetNs = 0;
+    sched->budgetAtNs = nowNs;
+    sched->hotReads = 0;
+    sched->hotNs = 0;
+    sched->charge = false;
+}
+
+int schedAdd(scanSched* sched, int chip, int bank, int devAddr, int addrBytes, int size, int cursor, int revisitMs, scanRegion* regions, uint64_t nowNs) {
+    if (sched->count == SCHED_MAX_CHIPS || size <= 0 || revisitMs <= 0) {
+        return -1;
+    }
+
+    schedChip* entry = &sched->chips[sched->count++];
+
+    entry->chip = chip;
+    entry->bank = bank;
+    entry->devAddr = devAddr;
+    entry->addrBytes = addrBytes;
+    entry->size = size;
+    entry->handle = -1;
+    entry->cursor = cursor >= 0 && cursor < size ? cursor : 0;
+    entry->revisitNs = (uint64_t) revisitMs * 1000000ULL;
+    entry->dueNs = nowNs;
+    entry->swept = false;
+    entry->regions = regions;
+    entry->errors = 0;
+    entry->quarantined = false;
+    entry->retryNs = 0;
+    entry->backoffNs = 0;
+    entry->quarantines = 0;
+    entry->sweepStartNs = entry->cursor == 0 ? nowNs : 0;
+    entry->bytesRead = 0;
+    entry->readErrors = 0;
+    memset(&entry->sweepHist, 0, sizeof(latHist));
+    memset(&entry->sliceHist, 0, sizeof(latHist));
+
+    return 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static double heatNow(scanRegion* region, uint64_t nowNs) {
+    if (region->heat > 0 && nowNs > region->heatNs) {
+        region->heat *= exp2(-(double) (nowNs - region->heatNs) / (HEAT_HALF_LIFE_SEC * 1e9));
+    }
+
+    region->heatNs = nowNs;
+
+    return region->heat;
+}
+
+// how long a region with this much heat should go between reads
+static uint64_t hotIntervalNs(const schedChip* entry, double heat) {
+    uint64_t interval = (uint64_t) (entry->revisitNs / (1.0 + heat));
+
+    return interval < HOT_MIN_MS * 1000000ULL ? HOT_MIN_MS * 1000000ULL : interval;
+}
+
+void schedRead(schedChip* entry, int start, int len, uint64_t nowNs) {
+    if (entry->regions == NULL || len <= 0) {
+        return;
+    }
+
+    for (int r = start / REGION_BYTES; r <= (start + len - 1) / REGION_BYTES; r++) {
+        scanRegion* region = &entry->regions[r];
+
+        if (region->lastReadNs != 0) {
+            uint64_t gap = nowNs - region->lastReadNs;
+
+            region->gapSumNs += gap;
+            region->gapSqSumNs += (double) gap * gap;
+
+            if (gap > region->maxGapNs) {
+                region->maxGapNs = gap;
+            }
+        }
+
+        region->lastReadNs = nowNs;
+        region->reads++;
+    }
+}
+
+void schedHeat(scanSched* sched, int chip, int region, uint64_t nowNs) {
+    for (int i = 0; i < sched->count; i++) {
+        schedChip* entry = &sched->chips[i];
+
+        if (entry->chip != chip || entry->regions == NULL || region < 0 || region >= regionCount(entry->size)) {
+            continue;
+        }
+
+        scanRegion* hit = &entry->regions[region];
+
+        hit->heat = heatNow(hit, nowNs) + 1;
+        hit->flips++;
+
+        for (int h = 0; h < sched->numHot; h++) {
+            if (sched->hot[h].entry == i && sched->hot[h].region == region) {
+                return;
+            }
+        }
+
+        // full up -> push out whichever has cooled off the most
+        int slot = sched->numHot;
+
+        if (slot == SCHED_MAX_HOT) {
+            slot = 0;
+
+            for (int h = 1; h < sched->numHot; h++) {
+                schedHot* a = &sched->hot[h];
+                schedHot* b = &sched->hot[slot];
+
+                if (heatNow(&sched->chips[a->entry].regions[a->region], nowNs) < heatNow(&sched->chips[b->entry].regions[b->region], nowNs)) {
+                    slot = h;
+                }
+            }
+        } else {
+            sched->numHot++;
+        }
+
+        sched->hot[slot].entry = i;
+        sched->hot[slot].region = region;
+
+        return;
+    }
+}
+
+bool schedNextHot(scanSched* sched, uint64_t nowNs, schedChip** entry, int* region) {
+    if (sched->hotShare <= 0 || sched->numHot == 0) {
+        return false;
+    }
+
+    // top up the bucket, never more than a second's worth
+    sched->budgetNs += (nowNs - sched->budgetAtNs) * sched->hotShare;
+    sched->budgetAtNs = nowNs;
+
+    if (sched->budgetNs > sched->hotShare * 1e9) {
+        sched->budgetNs = sched->hotShare * 1e9;
+    }
+
+    schedChip* base = schedNext(sched, -1);
+    bool ahead = base != NULL && base->dueNs > nowNs;
+
+    if (!ahead && sched->budgetNs <= 0) {
+        return false;
+    }
+
+    int best = -1;
+    uint64_t bestDue = 0;
+
+    for (int h = 0; h < sched->numHot; ) {
+        schedChip* e = &sched->chips[sched->hot[h].entry];
+        scanRegion* r = &e->regions[sched->hot[h].region];
+        double heat = heatNow(r, nowNs);
+
+        // stays hot for when it's back
+        if (e->quarantined) {
+            h++;
+            continue;
+        }
+
+        // cooled off, back to just the sweeps
+        if (heat < HOT_HEAT) {
+            sched->hot[h] = sched->hot[--sched->numHot];
+            continue;
+        }
+
+        uint64_t due = r->lastReadNs + hotIntervalNs(e, heat);
+
+        if (due <= nowNs && (best < 0 || due < bestDue)) {
+            best = h;
+            bestDue = due;
+        }
+
+        h++;
+    }
+
+    if (best < 0) {
+        return false;
+    }
+
+    *entry = &sched->chips[sched->hot[best].entry];
+    *region = sched->hot[best].region;
+    sched->charge = !ahead;
+
+    return true;
+}
+
+void schedHotDone(scanSched* sched, uint64_t busNs) {
+    if (sched->charge) {
+        sched->budgetNs -= busNs;
+    }
+
+    sched->hotReads++;
+    sched->hotNs += busNs;
+}
+
+schedChip* schedNext(scanSched* sched, int bank) {
+    schedChip* best = NULL;
+    schedChip* here = NULL;
+
+    // a few dozen chips tops, a heap would be slower than just looking
+    for (int i = 0; i < sched->count; i++) {
+        schedChip* entry = &sched->chips[i];
+
+        if (entry->quarantined) {
+            continue;
+        }
+
+        if (best == NULL || entry->dueNs < best->dueNs) {
+            best = entry;
+        }
+
+        if (entry->bank == bank && (here == NULL || entry->dueNs < here->dueNs)) {
+            here = entry;
+        }
+    }
+
+    // every switch costs mux settle time, not worth it for a few ms of deadline
+    if (here != NULL && here->dueNs <= best->dueNs + SCHED_BANK_SLACK_MS * 1000000ULL) {
+        return here;
+    }
+
+    return best;
+}
+
+static void schedCatchUp(schedChip* entry, uint64_t behindNs, uint64_t nowNs) {
+    if (nowNs > behindNs && entry->dueNs < nowNs - behindNs) {
+        entry->dueNs = nowNs - behindNs;
+    }
+}
+
+bool schedAdvance(schedChip* entry, int len, uint64_t nowNs) {
+    uint64_t stepNs = entry->revisitNs * (uint64_t) len / (uint64_t) entry->size;
+
+    entry->dueNs += stepNs;
+    entry->cursor += len;
+
+    schedCatchUp(entry, stepNs, nowNs);
+
+    if (entry->cursor < entry->size) {
+        return false;
+    }
+
+    entry->cursor = 0;
+    entry->swept = true;
+
+    if (entry->sweepStartNs != 0) {
+        histAdd(&entry->sweepHist, nowNs - entry->sweepStartNs);
+    }
+
+    entry->sweepStartNs = nowNs;
+
+    // a whole sweep without getting quarantined, next time starts from the short backoff again
+    entry->backoffNs = 0;
+
+    return true;
+}
+
+void schedSkip(schedChip* entry, uint64_t nowNs) {
+    entry->dueNs = nowNs + entry->revisitNs;
+    entry->cursor = 0;
+    entry->swept = true;
+}
+
+static void backoffGrow(schedChip* entry) {
+    entry->backoffNs *= 2;
+
+    if (entry->backoffNs > QUARANTINE_MAX_MS * 1000000ULL) {
+        entry->backoffNs = QUARANTINE_MAX_MS * 1000000ULL;
+    }
+}
+
+bool schedFailed(schedChip* entry, uint64_t nowNs) {
+    if (entry->quarantined || ++entry->errors < QUARANTINE_ERRORS) {
+        return false;
+    }
+
+    if (entry->backoffNs == 0) {
+        entry->backoffNs = QUARANTINE_MIN_MS * 1000000ULL;
+    }
+
+    entry->quarantined = true;
+    entry->retryNs = nowNs + entry->backoffNs;
+    entry->quarantines++;
+
+    return true;
+}
+
+schedChip* schedNextRetry(scanSched* sched, uint64_t nowNs) {
+    for (int i = 0; i < sched->count; i++) {
+        schedChip* entry = &sched->chips[i];
+
+        if (entry->quarantined && entry->retryNs <= nowNs) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void schedRetried(schedChip* entry, bool answered, uint64_t nowNs) {
+    if (!answered) {
+        backoffGrow(entry);
+        entry->retryNs = nowNs + entry->backoffNs;
+
+        return;
+    }
+
+    // picks its sweep up where it was, without trying to catch up on what it missed
+    entry->quarantined = false;
+    entry->errors = 0;
+    entry->dueNs = nowNs;
+
+    // if it goes again before finishing a sweep the wait keeps growing
+    backoffGrow(entry);
+}
+
+bool schedPassDone(scanSched* sched) {
+    int swept = 0;
+
+    // quarantined chips don't hold the pass up
+    for (int i = 0; i < sched->count; i++) {
+        if (sched->chips[i].quarantined) {
+            continue;
+        }
+
+        if (!sched->chips[i].swept) {
+            return false;
+        }
+
+        swept++;
+    }
+
+    for (int i = 0; i < sched->count; i++) {
+        sched->chips[i].swept = false;
+    }
+
+    return swept > 0;
+}
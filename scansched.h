@@ -0,0 +1,168 @@
+/*
+
+Scan Scheduler for EEPROM Control
+
+Instead of reading each chip start to finish (so the 4K parts only got looked
+at once per 2 minute sweep behind the 512K ones) every chip is cut into
+slices of readChunk bytes and the slices are interleaved. Each chip gets a
+target revisit interval - how long a full sweep of it should take - which
+works out to a deadline for every slice, and the bus always reads the slice
+that's due soonest (earliest deadline first). Small chips meet their target
+easily; whatever bus time is left goes to the big ones, so total coverage
+doesn't drop.
+
+On top of that flips aren't spread evenly, so every chip is also split into
+REGION_BYTES regions that remember how many flips turned up in them lately
+(heat, decaying with HEAT_HALF_LIFE_SEC). Hot regions get extra reads in
+between the sweeps, more often the hotter they are, but only out of a fixed
+share of the bus time (--hot-share) so the cold regions still get swept
+within revisit / (1 - share).
+
+A chip that fails QUARANTINE_ERRORS reads in a row is taken out of the
+rotation instead of eating a timeout every slice, and only gets poked again
+after a backoff that doubles every time it still isn't answering.
+
+*/
+
+#ifndef SCANSCHED_H
+#define SCANSCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stats.h"
+
+// Same as TOPO_MAX_CHIPS, a bus could have the whole board on it
+#define SCHED_MAX_CHIPS 64
+
+// Default target time for a full sweep of a chip - override with --revisit
+#define REVISIT_MS 1000
+
+// Stay on the bank the mux is already on if its slice is due within this much of the soonest one
+#define SCHED_BANK_SLACK_MS 20
+
+// Heat tracking granularity
+#define REGION_BYTES 4096
+
+// Most regions that can be hot at once per bus
+#define SCHED_MAX_HOT 64
+
+// Heat halves this often with no new flips
+#define HEAT_HALF_LIFE_SEC 60.0
+
+// Heat a region needs to get extra reads
+#define HOT_HEAT 0.5
+
+// Never revisit a hot region more often than this
+#define HOT_MIN_MS 50
+
+// Default share of bus time hot regions can have - override with --hot-share
+#define HOT_SHARE 0.25
+
+// Failed reads in a row before a chip gets quarantined
+#define QUARANTINE_ERRORS 3
+
+// First retry of a quarantined chip, doubling up to the max
+#define QUARANTINE_MIN_MS 1000
+#define QUARANTINE_MAX_MS 60000
+
+// Per region bookkeeping, only ever touched by the bus's reader thread
+typedef struct {
+    uint64_t lastReadNs;  // 0 = not read yet this run
+    uint64_t maxGapNs;    // longest time between two reads
+    double gapSumNs;      // for the average gap
+    double gapSqSumNs;    // for the expected detection latency
+    uint32_t reads;
+    uint32_t flips;       // flip events in it this run
+    double heat;          // recent flips, decayed to heatNs
+    uint64_t heatNs;
+} scanRegion;
+
+typedef struct {
+    int chip;             // index into population->all
+    int bank;
+    int devAddr;
+    int addrBytes;
+    int size;
+    int handle;           // opened the first time it's read and kept for the run, -1 = not yet
+    int cursor;           // next address to read
+    uint64_t revisitNs;   // target time for a full sweep
+    uint64_t dueNs;       // deadline for the next slice
+    bool swept;           // finished a sweep since the last pass
+    scanRegion* regions;  // regionCount(size) of them
+    int errors;           // failed reads in a row
+    bool quarantined;     // out of the rotation until retryNs
+    uint64_t retryNs;
+    uint64_t backoffNs;   // wait before the next retry, 0 = hasn't been quarantined since its last clean sweep
+    uint32_t quarantines; // this run
+    uint64_t sweepStartNs; // when its current sweep started, 0 = picked up mid sweep so it isn't timed
+    latHist sweepHist;    // time per full sweep
+    latHist sliceHist;    // bus time per slice read, hot reads too
+    uint64_t bytesRead;   // slices that came back
+    uint64_t readErrors;  // slices that didn't
+} schedChip;
+
+typedef struct {
+    int entry;            // index into chips
+    int region;
+} schedHot;
+
+typedef struct {
+    schedChip chips[SCHED_MAX_CHIPS];
+    int count;
+    schedHot hot[SCHED_MAX_HOT];
+    int numHot;
+    double hotShare;      // 0 = never any extra reads
+    double budgetNs;      // bus time hot reads can still take
+    uint64_t budgetAtNs;  // when budget was last topped up
+    bool charge;          // the hot read just handed out comes out of the budget
+    uint64_t hotReads;
+    uint64_t hotNs;       // bus time spent on hot reads
+} scanSched;
+
+// Regions a chip of size bytes gets
+int regionCount(int size);
+
+void schedInit(scanSched* sched, double hotShare, uint64_t nowNs);
+
+// Put a chip in the rotation, picking its sweep up at cursor
+int schedAdd(scanSched* sched, int chip, int bank, int devAddr, int addrBytes, int size, int cursor, int revisitMs, scanRegion* regions, uint64_t nowNs);
+
+// start..start+len of entry just came off the bus. Only for reads that worked -
+// a failed one leaves its regions as overdue as they were
+void schedRead(schedChip* entry, int start, int len, uint64_t nowNs);
+
+// Compare found a new flip in region of chip
+void schedHeat(scanSched* sched, int chip, int region, uint64_t nowNs);
+
+// Is a hot region due an extra read right now? Which one if so
+bool schedNextHot(scanSched* sched, uint64_t nowNs, schedChip** entry, int* region);
+
+// The extra read took busNs
+void schedHotDone(scanSched* sched, uint64_t busNs);
+
+// The chip whose next slice is due soonest, going easy on bank switches
+schedChip* schedNext(scanSched* sched, int bank);
+
+// len bytes got read off entry, true if that finished its sweep
+bool schedAdvance(schedChip* entry, int len, uint64_t nowNs);
+
+// Couldn't talk to the chip - try again in one revisit interval
+void schedSkip(schedChip* entry, uint64_t nowNs);
+
+// A read off entry failed - true if that got it quarantined
+bool schedFailed(schedChip* entry, uint64_t nowNs);
+
+static inline void schedOk(schedChip* entry) {
+    entry->errors = 0;
+}
+
+// A quarantined chip whose retry is due, NULL if none
+schedChip* schedNextRetry(scanSched* sched, uint64_t nowNs);
+
+// How its retry went - back in the rotation, or wait twice as long
+void schedRetried(schedChip* entry, bool answered, uint64_t nowNs);
+
+// Every chip swept at least once since last time this said true
+bool schedPassDone(scanSched* sched);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+
+Snapshot Diff for EEPROM Control
+
+Bit by bit comparison of two snapshots (snapshot.h), or of one snapshot
+against the test pattern its chips were filled with:
+
+    ./snapdiff "board 7 snapshot 20261017-090000.snap" "board 7 snapshot 20261017-100000.snap" > changed.csv
+    ./snapdiff "board 7 snapshot 20261017-100000.snap" > flipped.csv
+    ./snapdiff --summary "board 7 snapshot 20261017-090000.snap" "board 7 snapshot 20261017-100000.snap"
+
+One line per bit that's different: Bank, EEPROM, Address, Bit, Was, Now - Was
+from the first snapshot (or the pattern), Now from the second. Bytes either one
+couldn't read are left out and only show up in the summary. Chips are matched
+on bank and address, so the two don't need the same topology.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "pattern.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// What changed on one chip
+typedef struct {
+    long bytes;           // bytes with at least one bit different
+    long fell;            // bits 1 -> 0
+    long rose;            // bits 0 -> 1
+    long unread;          // bytes left out because one side couldn't read them
+} chipDiff;
+
+// what the chip was filled with, rolling over past what its word address reaches like the reads do
+static void fillPattern(const snapChip* info, uint8_t* out) {
+    testPattern pat = { (patternType) info->pattern, info->patternSeed };
+    uint32_t span = info->addrBytes >= 4 ? UINT32_MAX : 1U << (8 * info->addrBytes);
+
+    for (uint32_t start = 0; start < info->size; ) {
+        uint32_t len = info->size - start < span - start % span ? info->size - start : span - start % span;
+
+        patternFill(&pat, start % span, out + start, (int) len);
+        start += len;
+    }
+}
+
+// what it read as: pattern ^ the stored XOR
+static uint8_t* readImage(const snapImageChip* chip) {
+    uint8_t* image = (uint8_t*) malloc(chip->info.size > 0 ? chip->info.size : 1);
+
+    if (image != NULL) {
+        fillPattern(&chip->info, image);
+
+        for (uint32_t i = 0; i < chip->info.size; i++) {
+            image[i] ^= chip->xor[i];
+        }
+    }
+
+    return image;
+}
+
+static const snapImageChip* findChip(const snapImage* img, int bank, int devAddr) {
+    for (int i = 0; i < TOPO_MAX_CHIPS; i++) {
+        const snapImageChip* chip = img->chips[i];
+
+        if (chip != NULL && chip->info.bank == bank && chip->info.devAddr == devAddr) {
+            return chip;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+Every bit that's different between was and now, as CSV lines unless quiet.
+Either unread marks a byte as not comparable.
+*/
+static chipDiff diffChip(const snapChip* info, const uint8_t* was, const uint8_t* wasUnread, const uint8_t* now, const uint8_t* nowUnread,
+    uint32_t size, bool quiet) {
+    chipDiff d = { 0 };
+
+    for (uint32_t addr = 0; addr < size; addr++) {
+        if ((wasUnread != NULL && wasUnread[addr]) || nowUnread[addr]) {
+            d.unread++;
+            continue;
+        }
+
+        uint8_t changed = was[addr] ^ now[addr];
+
+        if (changed == 0) {
+            continue;
+        }
+
+        d.bytes++;
+
+        for (int bit = 0; bit < 8; bit++) {
+            if ((changed >> bit) & 1) {
+                int before = (was[addr] >> bit) & 1;
+
+                d.fell += before;
+                d.rose += !before;
+
+                if (!quiet) {
+                    printf("%d, %d, %u, %d, %d, %d\n", info->bank, info->devAddr - EEPROM_ADDRESS, addr, bit, before, !before);
+                }
+            }
+        }
+    }
+
+    return d;
+}
+
+static void printFile(const char* path, const snapImage* img) {
+    long chips = 0;
+    long bytes = 0;
+
+    for (int i = 0; i < TOPO_MAX_CHIPS; i++) {
+        if (img->chips[i] != NULL) {
+            chips++;
+            bytes += img->chips[i]->info.size;
+        }
+    }
+
+    printf("%s: board %d, snapshot %u, %ld chips, %.1f KB for %.1f KB of EEPROM\n", path, img->header.board, img->header.seq,
+        chips, img->fileBytes / 1e3, bytes / 1e3);
+}
+
+static void printSummaryLine(const snapImageChip* chip, const chipDiff* d, const char* note) {
+    printf("%4d %6d  %8ld %8ld %8ld %8ld  %s\n", chip->info.bank, chip->info.devAddr - EEPROM_ADDRESS, d->bytes, d->fell, d->rose, d->unread, note);
+}
+
+int main(int argc, char** argv) {
+    bool summary = false;
+    const char* paths[2] = { NULL, NULL };
+    int numPaths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--summary") == 0) {
+            summary = true;
+        } else if (numPaths < 2) {
+            paths[numPaths++] = argv[i];
+        } else {
+            numPaths = 3;
+        }
+    }
+
+    if (numPaths < 1 || numPaths > 2) {
+        printf("Usage: %s [--summary] SNAPSHOT [LATER_SNAPSHOT]\n", argv[0]);
+
+        return -1;
+    }
+
+    snapImage images[2];
+
+    for (int n = 0; n < numPaths; n++) {
+        if (snapLoad(paths[n], &images[n]) != 0) {
+            return -1;
+        }
+    }
+
+    if (summary) {
+        for (int n = 0; n < numPaths; n++) {
+            printFile(paths[n], &images[n]);
+        }
+
+        printf("Bank EEPROM  changed     1->0     0->1   unread\n");
+    } else {
+        printf("Bank, EEPROM, Address, Bit, Was, Now\n");
+    }
+
+    snapImage* was = &images[0];
+    snapImage* now = &images[numPaths - 1];
+
+    for (int i = 0; i < TOPO_MAX_CHIPS; i++) {
+        const snapImageChip* later = now->chips[i];
+        const snapImageChip* earlier = numPaths == 2 && later != NULL ? findChip(was, later->info.bank, later->info.devAddr) : NULL;
+        chipDiff d = { 0 };
+
+        if (later == NULL) {
+            continue;
+        }
+
+        uint8_t* nowData = readImage(later);
+        uint8_t* wasData = earlier != NULL ? readImage(earlier) : NULL;
+        const char* note = !later->end.complete || (earlier != NULL && !earlier->end.complete) ? "partial sweep" : "";
+
+        // one file: against the pattern
+        if (numPaths == 1) {
+            wasData = (uint8_t*) malloc(later->info.size > 0 ? later->info.size : 1);
+
+            if (wasData != NULL) {
+                fillPattern(&later->info, wasData);
+            }
+        }
+
+        if (nowData == NULL || (numPaths == 2 && earlier != NULL && wasData == NULL) || (numPaths == 1 && wasData == NULL)) {
+            printf("Out of memory\n");
+
+            return -1;
+        }
+
+        if (numPaths == 2 && earlier == NULL) {
+            note = "not in the first snapshot";
+        } else {
+            uint32_t size = later->info.size;
+
+            if (earlier != NULL && earlier->info.size != size) {
+                note = "sizes differ, compared up to the smaller";
+                size = earlier->info.size < size ? earlier->info.size : size;
+            }
+
+            d = diffChip(&later->info, wasData, earlier != NULL ? earlier->unread : NULL, nowData, later->unread, size, summary);
+        }
+
+        if (summary) {
+            printSummaryLine(later, &d, note);
+        }
+
+        free(nowData);
+        free(wasData);
+    }
+
+    // and the other way round, so nothing goes missing without a mention
+    for (int i = 0; i < TOPO_MAX_CHIPS && summary && numPaths == 2; i++) {
+        const snapImageChip* earlier = was->chips[i];
+        chipDiff none = { 0 };
+
+        if (earlier != NULL && findChip(now, earlier->info.bank, earlier->info.devAddr) == NULL) {
+            printSummaryLine(earlier, &none, "not in the second snapshot");
+        }
+    }
+
+    for (int n = 0; n < numPaths; n++) {
+        snapFree(&images[n]);
+    }
+
+    return 0;
+}
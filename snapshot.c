@@ -0,0 +1,416 @@
+/*
+
+Snapshots for EEPROM Control
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "snapshot.h"
+
+size_t snapWriterBytes(int count) {
+    return arenaRound(count * sizeof(snapEncoder)) + count * arenaRound(SNAP_CHUNK);
+}
+
+void snapWriterInit(snapWriter* w, allEEPROMs* population, uint8_t* storage) {
+    memset(w, 0, sizeof(*w));
+    w->population = population;
+    w->chips = (snapEncoder*) storage;
+    storage += arenaRound(population->count * sizeof(snapEncoder));
+
+    for (int i = 0; i < population->count; i++) {
+        memset(&w->chips[i], 0, sizeof(snapEncoder));
+        w->chips[i].ops = storage;
+        storage += arenaRound(SNAP_CHUNK);
+
+        // same ones the readers pick up
+        if (population->all[i].mems.words != NULL) {
+            w->expected++;
+        }
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void snapChunk(snapWriter* w, int chip, int kind, const void* data, uint32_t len) {
+    snapChunkHeader hdr = { (uint16_t) chip, (uint16_t) kind, len };
+
+    if (w->out != NULL && fwrite(&hdr, sizeof(hdr), 1, w->out) == 1 && (len == 0 || fwrite(data, len, 1, w->out) == 1)) {
+        w->bytes += sizeof(hdr) + len;
+    }
+}
+
+static void snapFlushOps(snapWriter* w, int chip) {
+    snapEncoder* enc = &w->chips[chip];
+
+    if (enc->used > 0) {
+        snapChunk(w, chip, SNAP_CHUNK_OPS, enc->ops, (uint32_t) enc->used);
+        enc->used = 0;
+    }
+}
+
+static void snapOp(snapWriter* w, int chip, int kind, uint32_t len, const uint8_t* data) {
+    snapEncoder* enc = &w->chips[chip];
+    uint8_t op[8];
+    int n = 0;
+
+    if (len <= SNAP_LITERAL) {
+        op[n++] = (uint8_t) (kind << 6 | len);
+    } else {
+        uint32_t rest = len;
+
+        op[n++] = (uint8_t) (kind << 6);
+
+        do {
+            op[n++] = (uint8_t) ((rest & 0x7F) | (rest > 0x7F ? 0x80 : 0));
+            rest >>= 7;
+        } while (rest > 0);
+    }
+
+    int total = n + (kind == SNAP_XOR ? (int) len : 0);
+
+    if (enc->used + total > SNAP_CHUNK) {
+        snapFlushOps(w, chip);
+    }
+
+    memcpy(enc->ops + enc->used, op, n);
+    enc->used += n;
+
+    if (kind == SNAP_XOR) {
+        memcpy(enc->ops + enc->used, data, len);
+        enc->used += len;
+    }
+}
+
+static void snapFlushLiteral(snapWriter* w, int chip) {
+    snapEncoder* enc = &w->chips[chip];
+
+    if (enc->litLen > 0) {
+        snapOp(w, chip, SNAP_XOR, (uint32_t) enc->litLen, enc->lit);
+        enc->litLen = 0;
+    }
+}
+
+// bytes between the last one encoded and addr read back fine
+static void snapSkipTo(snapWriter* w, int chip, int addr) {
+    snapEncoder* enc = &w->chips[chip];
+
+    if (addr > enc->next) {
+        snapFlushLiteral(w, chip);
+        snapOp(w, chip, SNAP_SAME, (uint32_t) (addr - enc->next), NULL);
+        enc->next = addr;
+    }
+}
+
+// done with the current file, whatever's still open in it didn't make it to the end
+static void snapCloseFile(snapWriter* w, uint64_t ns) {
+    for (int i = 0; i < w->population->count; i++) {
+        if (w->chips[i].open) {
+            snapFinish(w, i, false, ns);
+        }
+    }
+
+    if (w->out != NULL) {
+        fclose(w->out);
+        w->out = NULL;
+    }
+}
+
+static void snapOpenFile(snapWriter* w, unsigned seq, uint64_t ns) {
+    struct timespec wall;
+    char stamp[32];
+    char path[100];
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&wall.tv_sec));
+    snprintf(path, sizeof(path), "board %d snapshot %s.snap", w->population->board, stamp);
+
+    // two asked for in the same second
+    w->out = fopen(path, "wx");
+
+    if (w->out == NULL) {
+        snprintf(path, sizeof(path), "board %d snapshot %s-%u.snap", w->population->board, stamp, seq);
+        w->out = fopen(path, "wx");
+    }
+
+    w->seq = seq;
+    w->finished = 0;
+
+    if (w->out == NULL) {
+        printf("Failed to open snapshot %s\n", path);
+
+        return;
+    }
+
+    snapHeader hdr = { 0 };
+
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAP_VERSION;
+    hdr.board = (uint16_t) w->population->board;
+    hdr.headerSize = sizeof(snapHeader);
+    hdr.chipSize = sizeof(snapChip);
+    hdr.wallNs = (uint64_t) wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    hdr.ns = ns;
+    hdr.seq = seq;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, w->out) == 1) {
+        w->bytes += sizeof(hdr);
+    }
+
+    w->snapshots++;
+}
+
+void snapBegin(snapWriter* w, int chip, unsigned seq, uint64_t ns) {
+    // an older one still going gets cut off, this one's file might already be done (or couldn't be opened)
+    if (seq != w->seq) {
+        snapCloseFile(w, ns);
+        snapOpenFile(w, seq, ns);
+    }
+
+    snapEncoder* enc = &w->chips[chip];
+    EEPROM* current = &w->population->all[chip];
+
+    if (w->out == NULL || enc->open) {
+        return;
+    }
+
+    snapChip info = { 0 };
+
+    info.size = (uint32_t) current->size;
+    info.patternSeed = current->pattern.seed;
+    info.bank = (uint8_t) current->bank;
+    info.devAddr = (uint8_t) current->devAddr;
+    info.addrBytes = (uint8_t) current->addrBytes;
+    info.pattern = (uint8_t) current->pattern.type;
+    info.ns = ns;
+    snapChunk(w, chip, SNAP_CHUNK_CHIP, &info, sizeof(info));
+
+    enc->open = true;
+    enc->used = 0;
+    enc->litLen = 0;
+    enc->next = 0;
+    enc->unread = 0;
+}
+
+void snapXor(snapWriter* w, int chip, int addr, uint8_t x) {
+    snapEncoder* enc = &w->chips[chip];
+
+    if (!enc->open || addr < enc->next) {
+        return;
+    }
+
+    snapSkipTo(w, chip, addr);
+    enc->lit[enc->litLen++] = x;
+    enc->next = addr + 1;
+
+    if (enc->litLen == SNAP_LITERAL) {
+        snapFlushLiteral(w, chip);
+    }
+}
+
+void snapUnread(snapWriter* w, int chip, int addr, int len) {
+    snapEncoder* enc = &w->chips[chip];
+
+    if (!enc->open || addr < enc->next) {
+        return;
+    }
+
+    snapSkipTo(w, chip, addr);
+    snapFlushLiteral(w, chip);
+    snapOp(w, chip, SNAP_UNREAD, (uint32_t) len, NULL);
+    enc->next = addr + len;
+    enc->unread += (uint32_t) len;
+}
+
+void snapFinish(snapWriter* w, int chip, bool complete, uint64_t ns) {
+    snapEncoder* enc = &w->chips[chip];
+    int size = w->population->all[chip].size;
+
+    if (!enc->open) {
+        return;
+    }
+
+    snapFlushLiteral(w, chip);
+
+    if (enc->next < size) {
+        snapOp(w, chip, complete ? SNAP_SAME : SNAP_UNREAD, (uint32_t) (size - enc->next), NULL);
+        enc->unread += complete ? 0 : (uint32_t) (size - enc->next);
+        enc->next = size;
+    }
+
+    snapFlushOps(w, chip);
+
+    snapEnd end = { ns, complete && enc->unread == 0, enc->unread };
+
+    snapChunk(w, chip, SNAP_CHUNK_END, &end, sizeof(end));
+    enc->open = false;
+
+    // a chip at a time, so a crash only loses the ones still going
+    if (w->out != NULL) {
+        fflush(w->out);
+    }
+
+    if (++w->finished >= w->expected && w->out != NULL) {
+        fclose(w->out);
+        w->out = NULL;
+    }
+}
+
+void snapClose(snapWriter* w, uint64_t ns) {
+    snapCloseFile(w, ns);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// ops for one chip onto its image, false if they run past the end or off the chip
+static bool snapDecode(snapImageChip* chip, uint32_t* pos, const uint8_t* ops, uint32_t len) {
+    uint32_t i = 0;
+
+    while (i < len) {
+        int kind = ops[i] >> 6;
+        uint32_t n = ops[i++] & 0x3F;
+
+        if (n == 0) {
+            for (int shift = 0; i < len && shift < 32; shift += 7) {
+                n |= (uint32_t) (ops[i] & 0x7F) << shift;
+
+                if ((ops[i++] & 0x80) == 0) {
+                    break;
+                }
+            }
+        }
+
+        if (n > chip->info.size - *pos || (kind == SNAP_XOR && n > len - i)) {
+            return false;
+        }
+
+        if (kind == SNAP_XOR) {
+            memcpy(chip->xor + *pos, ops + i, n);
+            i += n;
+        } else if (kind == SNAP_UNREAD) {
+            memset(chip->unread + *pos, 1, n);
+        }
+
+        *pos += n;
+    }
+
+    return true;
+}
+
+int snapLoad(const char* path, snapImage* img) {
+    FILE* in = fopen(path, "rb");
+    uint32_t pos[TOPO_MAX_CHIPS] = { 0 };
+    uint8_t* buf = NULL;
+    bool ok = true;
+
+    memset(img, 0, sizeof(*img));
+
+    if (in == NULL) {
+        printf("Failed to open %s\n", path);
+
+        return -1;
+    }
+
+    if (fread(&img->header, sizeof(img->header), 1, in) != 1 || memcmp(img->header.magic, SNAP_MAGIC, sizeof(img->header.magic)) != 0 ||
+        img->header.version != SNAP_VERSION || img->header.chipSize != sizeof(snapChip)) {
+        printf("%s isn't a snapshot this version can read\n", path);
+        fclose(in);
+
+        return -1;
+    }
+
+    fseek(in, img->header.headerSize, SEEK_SET);
+    img->fileBytes = img->header.headerSize;
+
+    snapChunkHeader hdr;
+
+    while (ok && fread(&hdr, sizeof(hdr), 1, in) == 1) {
+        uint8_t* data = (uint8_t*) realloc(buf, hdr.len > 0 ? hdr.len : 1);
+        snapImageChip* chip = hdr.chip < TOPO_MAX_CHIPS ? img->chips[hdr.chip] : NULL;
+
+        buf = data;
+        ok = data != NULL && hdr.chip < TOPO_MAX_CHIPS;
+
+        if (!ok) {
+            break;
+        }
+
+        // the run died mid write, everything before it is still good
+        if (hdr.len > 0 && fread(data, hdr.len, 1, in) != 1) {
+            printf("%s is cut short, using what's there\n", path);
+            break;
+        }
+
+        img->fileBytes += sizeof(hdr) + hdr.len;
+
+        switch (hdr.kind) {
+            case SNAP_CHUNK_CHIP:
+                ok = chip == NULL && hdr.len == sizeof(snapChip);
+
+                if (ok) {
+                    chip = (snapImageChip*) calloc(1, sizeof(snapImageChip));
+                    ok = chip != NULL;
+                }
+
+                if (ok) {
+                    memcpy(&chip->info, data, sizeof(snapChip));
+                    chip->xor = (uint8_t*) calloc(chip->info.size, 1);
+                    chip->unread = (uint8_t*) calloc(chip->info.size, 1);
+                    img->chips[hdr.chip] = chip;
+                    ok = chip->xor != NULL && chip->unread != NULL;
+                }
+
+                break;
+            case SNAP_CHUNK_OPS:
+                ok = chip != NULL && !chip->ended && snapDecode(chip, &pos[hdr.chip], data, hdr.len);
+
+                break;
+            case SNAP_CHUNK_END:
+                ok = chip != NULL && hdr.len == sizeof(snapEnd);
+
+                if (ok) {
+                    memcpy(&chip->end, data, sizeof(snapEnd));
+                    chip->ended = true;
+                }
+
+                break;
+            default:
+                // something newer, skip it
+                break;
+        }
+    }
+
+    free(buf);
+    fclose(in);
+
+    if (!ok) {
+        printf("%s is damaged\n", path);
+        snapFree(img);
+
+        return -1;
+    }
+
+    // a capture the run died in the middle of - what didn't get written wasn't read as far as we know
+    for (int i = 0; i < TOPO_MAX_CHIPS; i++) {
+        if (img->chips[i] != NULL && pos[i] < img->chips[i]->info.size) {
+            memset(img->chips[i]->unread + pos[i], 1, img->chips[i]->info.size - pos[i]);
+        }
+    }
+
+    return 0;
+}
+
+void snapFree(snapImage* img) {
+    for (int i = 0; i < TOPO_MAX_CHIPS; i++) {
+        if (img->chips[i] != NULL) {
+            free(img->chips[i]->xor);
+            free(img->chips[i]->unread);
+            free(img->chips[i]);
+            img->chips[i] = NULL;
+        }
+    }
+}
@@ -0,0 +1,160 @@
+/*
+
+Snapshots for EEPROM Control
+
+Every so often (--snapshot-min, and "snapshot" on the control socket) each
+chip's next full sweep gets kept: not just the failure count, the whole chip
+as it read back, so two points in a run can be compared after the fact with
+snapdiff. Nothing extra goes over the bus - compare already has every byte
+that didn't match, so that's all a snapshot needs to be sent.
+
+An image is stored XOR'd against the chip's test pattern and run length
+encoded, so a chip that still holds its pattern is a few bytes and each flipped
+byte costs about two. A 16 chip board is a few KB instead of 4 MB.
+
+File layout ("board N snapshot YYYYMMDD-HHMMSS.snap"): snapHeader, then chunks,
+each a snapChunkHeader and len bytes. Chips are captured at the same time on
+different buses so their chunks are interleaved; a chip's are SNAP_CHUNK_CHIP
+(a snapChip), any number of SNAP_CHUNK_OPS and a SNAP_CHUNK_END (a snapEnd).
+Ops are one byte, kind << 6 | length, 1-63 - 0 means a LEB128 length follows.
+SNAP_XOR is followed by that many bytes of read ^ pattern. Host byte order,
+same as the event log.
+
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "radpi.h"
+
+#define SNAP_MAGIC "RADSNAPS"
+#define SNAP_VERSION 1
+
+// Minutes between snapshots - override with --snapshot-min (0 = only when asked for)
+#define SNAPSHOT_MIN 60
+
+// Encoded bytes a chip builds up before they go to the file as one chunk
+#define SNAP_CHUNK 4096
+
+// Longest SNAP_XOR run, so its length always fits in the op byte
+#define SNAP_LITERAL 63
+
+// Op kinds
+enum {
+    SNAP_SAME,            // length bytes that read back as the pattern
+    SNAP_XOR,             // length bytes of read ^ pattern follow
+    SNAP_UNREAD,          // length bytes the sweep couldn't read
+};
+
+// Chunk kinds
+enum {
+    SNAP_CHUNK_CHIP,
+    SNAP_CHUNK_OPS,
+    SNAP_CHUNK_END,
+};
+
+typedef struct {
+    char magic[8];        // SNAP_MAGIC, no terminator
+    uint16_t version;
+    uint16_t board;
+    uint16_t headerSize;  // sizeof(snapHeader) when it was written
+    uint16_t chipSize;    // sizeof(snapChip) when it was written
+    uint64_t wallNs;      // wall clock when the first chip started
+    uint64_t ns;          // since the run started, same moment
+    uint32_t seq;         // snapshot number within the run, from 1
+    uint32_t reserved[3];
+} snapHeader;
+
+typedef struct {
+    uint16_t chip;        // index in the topology
+    uint16_t kind;
+    uint32_t len;         // bytes that follow
+} snapChunkHeader;
+
+typedef struct {
+    uint32_t size;
+    uint32_t patternSeed;
+    uint8_t bank;
+    uint8_t devAddr;
+    uint8_t addrBytes;
+    uint8_t pattern;      // patternType
+    uint64_t ns;          // since the run started, when its sweep got to address 0
+} snapChip;
+
+typedef struct {
+    uint64_t ns;          // when the sweep got to the end
+    uint32_t complete;    // 1 = every byte came from the one sweep
+    uint32_t unread;      // bytes stored as SNAP_UNREAD
+} snapEnd;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// One chip's capture in progress
+typedef struct {
+    uint8_t* ops;         // SNAP_CHUNK bytes of encoded ops not written yet
+    int used;
+    uint8_t lit[SNAP_LITERAL]; // XOR bytes not turned into an op yet
+    int litLen;
+    int next;             // everything below this is encoded (or in lit)
+    uint32_t unread;
+    bool open;            // being captured into the current file
+} snapEncoder;
+
+// One board's snapshots, only the log thread touches it
+typedef struct {
+    allEEPROMs* population;
+    snapEncoder* chips;   // one per chip
+    int expected;         // chips that get scanned, the file's done when they all are
+    int finished;         // of the current file's
+    FILE* out;
+    unsigned seq;         // the current file's
+    uint64_t snapshots;   // files started this run
+    uint64_t bytes;       // written this run
+} snapWriter;
+
+// arena a writer for count chips needs
+size_t snapWriterBytes(int count);
+
+// storage is snapWriterBytes(population->count) long
+void snapWriterInit(snapWriter* w, allEEPROMs* population, uint8_t* storage);
+
+// chip's sweep is at address 0 and snapshot seq wants it, starts a new file if seq is new
+void snapBegin(snapWriter* w, int chip, unsigned seq, uint64_t ns);
+
+// addr read back as pattern ^ x, addresses only ever go up
+void snapXor(snapWriter* w, int chip, int addr, uint8_t x);
+
+// len bytes from addr couldn't be read
+void snapUnread(snapWriter* w, int chip, int addr, int len);
+
+// the sweep got to the end (complete) or went somewhere else, the rest is the pattern or unread
+void snapFinish(snapWriter* w, int chip, bool complete, uint64_t ns);
+
+// end of the run, anything still being captured is finished as unread
+void snapClose(snapWriter* w, uint64_t ns);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// One chip out of a snapshot file, decoded
+typedef struct {
+    snapChip info;
+    snapEnd end;
+    bool ended;           // has its SNAP_CHUNK_END (the run didn't die mid capture)
+    uint8_t* xor;         // info.size bytes of read ^ pattern
+    uint8_t* unread;      // info.size bytes, 1 = not read
+} snapImageChip;
+
+typedef struct {
+    snapHeader header;
+    snapImageChip* chips[TOPO_MAX_CHIPS]; // by topology index, NULL = not in it
+    long fileBytes;
+} snapImage;
+
+// whole file in, -1 (and a message) if it isn't a snapshot or doesn't decode
+int snapLoad(const char* path, snapImage* img);
+void snapFree(snapImage* img);
+
+#endif
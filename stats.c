@@ -0,0 +1,70 @@
+/*
+
+Run Stats for EEPROM Control
+
+The reading side - only the stats thread and the end of run summary get here,
+so none of this has to be quick.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "stats.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+uint64_t histPercentile(const latHist* hist, double p) {
+    uint64_t counts[STATS_BUCKETS];
+    uint64_t total = 0;
+
+    // a snapshot first, the owner may still be adding to it
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        counts[b] = statGet(&hist->buckets[b]);
+        total += counts[b];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t want = (uint64_t) (p / 100.0 * total + 0.5);
+    uint64_t seen = 0;
+    uint64_t maxNs = statGet(&hist->maxNs);
+
+    want = want > 0 ? want : 1;
+
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += counts[b];
+
+        // nothing went over the max, so it's a tighter edge for the bucket it's in (and the top one has no other)
+        if (seen >= want) {
+            return b < STATS_BUCKETS - 1 && (1024ULL << b) < maxNs ? 1024ULL << b : maxNs;
+        }
+    }
+
+    return maxNs;
+}
+
+void histWrite(FILE* out, const char* name, const latHist* hist) {
+    uint64_t count = statGet(&hist->count);
+
+    fprintf(out, " %s count %llu avgUs %.1f p50Us %.1f p99Us %.1f maxUs %.1f", name, (unsigned long long) count,
+        count > 0 ? statGet(&hist->sumNs) / 1e3 / count : 0, histPercentile(hist, 50) / 1e3, histPercentile(hist, 99) / 1e3,
+        statGet(&hist->maxNs) / 1e3);
+}
+
+/*
+Written to a temp file and renamed over the old one, so anything tailing it
+always sees a whole snapshot
+*/
+int statsReplace(FILE* tmp, const char* tmpPath, const char* path) {
+    if (fclose(tmp) != 0) {
+        unlink(tmpPath);
+
+        return -1;
+    }
+
+    return rename(tmpPath, path);
+}
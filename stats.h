@@ -0,0 +1,79 @@
+/*
+
+Run Stats for EEPROM Control
+
+Counters and latency histograms for the hot path. Every counter has exactly
+one thread that writes it (a bus's reader, the log thread) so bumping one is a
+plain load and store - no locked instructions, nothing shared to bounce
+between cores. The store is atomic though, so the stats thread can read any
+of them at any time without tearing and without holding anybody up.
+
+Histograms are power of two buckets from 1 us up: bucket b counts everything
+under 1024 << b ns, so percentiles come out within a factor of 2 and a whole
+histogram is a few hundred bytes.
+
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// 1 us .. ~35 minutes
+#define STATS_BUCKETS 32
+
+// Default time between writes of "board N stats.txt" - override with --stats-ms
+#define STATS_MS 1000
+
+typedef struct {
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint64_t buckets[STATS_BUCKETS];
+} latHist;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// only call from the counter's own thread
+static inline void statAdd(uint64_t* counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void statMax(uint64_t* counter, uint64_t value) {
+    if (value > *counter) {
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+    }
+}
+
+// from anywhere
+static inline uint64_t statGet(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static inline void histAdd(latHist* hist, uint64_t ns) {
+    int bucket = 0;
+
+    if (ns >= 1024) {
+        bucket = 64 - __builtin_clzll(ns >> 10);
+        bucket = bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+    }
+
+    statAdd(&hist->buckets[bucket], 1);
+    statAdd(&hist->sumNs, ns);
+    statMax(&hist->maxNs, ns);
+    statAdd(&hist->count, 1);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Upper edge of the bucket the p'th percentile (0-100) lands in (no more than the max), 0 if it's empty
+uint64_t histPercentile(const latHist* hist, double p);
+
+// "name count N avg ... p50 ... p99 ... max ..." in us, on the end of a line
+void histWrite(FILE* out, const char* name, const latHist* hist);
+
+// Atomically replace path with what's been written to tmp (tmp gets closed)
+int statsReplace(FILE* tmp, const char* tmpPath, const char* path);
+
+#endif
@@ -0,0 +1,1090 @@
+/*
+
+Regression Tests for EEPROM Control
+
+Checks for the pieces a run depends on but would only get wrong quietly - a
+sweep that reads the same bytes twice, a map that loses a bit, a log that
+won't read back after a crash. Anything that needs a bus runs against the
+simulator, so it all works on any Linux box:
+
+    ./tests              every case
+    ./tests wrap         just the ones with wrap in their name
+
+Each case gets its own scratch directory under /tmp (removed afterwards, --keep
+leaves it) and is the working directory while it runs, since some of what gets
+tested names its files relative to it. Prints a line per case and exits with
+the number that failed.
+
+*/
+
+// Libraries
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ftw.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bus.h"
+#include "failmap.h"
+#include "compare.h"
+#include "pattern.h"
+#include "evlog.h"
+#include "scansched.h"
+#include "topology.h"
+#include "checkpoint.h"
+#include "probe.h"
+#include "snapshot.h"
+
+// Bytes per bulk read in the sweeps, same as the default --chunk
+#define TEST_CHUNK 4096
+
+// One case - false from a check() doesn't stop it, so it reports everything that's wrong
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} testCase;
+
+static const char* currentCase;
+static int caseFailures;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// radpicode.c has the real one, probe.c only needs it for timing
+uint64_t monoNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool check(bool ok, const char* what) {
+    if (!ok) {
+        printf("  %s: %s\n", currentCase, what);
+        caseFailures++;
+    }
+
+    return ok;
+}
+
+// simulator with no bus time and no faults, chips go in dir
+static i2cBus* quietSim(const char* dir) {
+    simConfig cfg = simDefaults();
+
+    cfg.byteLatencyNs = 0;
+    cfg.xferLatencyNs = 0;
+    cfg.writeCycleNs = 0;
+
+    return busOpenSim(dir, &cfg);
+}
+
+// change one byte of a sim chip behind the bus's back, like an upset would
+static bool simPoke(const char* dir, int bank, int devAddr, int addr, uint8_t value) {
+    char path[300];
+
+    snprintf(path, sizeof(path), "%s/bank%d_0x%02x.bin", dir, bank, devAddr);
+
+    int fd = open(path, O_RDWR);
+    bool ok = fd >= 0 && pwrite(fd, &value, 1, addr) == 1;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return ok;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+The packed map has to agree with a byte per address on every cell, including
+the last word when the size isn't a multiple of 64, and count each address
+once. The seen masks have to keep every address's bits while they grow out of
+the arena they started in and onto the heap.
+*/
+static void testFailMap(void) {
+    int nbits = 65536 + 37;
+    uint8_t* truth = (uint8_t*) calloc(nbits, 1);
+    failMap map;
+
+    if (!check(truth != NULL && failMapCreate(&map, nbits) == 0, "out of memory")) {
+        free(truth);
+
+        return;
+    }
+
+    check(failMapBytes(nbits) % 8 == 0 && failMapBytes(nbits) * 8 >= (size_t) nbits, "map storage doesn't cover every cell");
+
+    srand(4);
+
+    int set = 0;
+    bool agrees = true;
+
+    for (int i = 0; i < 20000; i++) {
+        int bit = i < 2 ? (i == 0 ? 0 : nbits - 1) : rand() % nbits;
+        bool fresh = failMapTestAndSet(&map, bit);
+
+        agrees &= fresh == !truth[bit];
+        set += !truth[bit];
+        truth[bit] = 1;
+    }
+
+    check(agrees, "test and set said new for an old cell or old for a new one");
+
+    for (int bit = 0; bit < nbits; bit++) {
+        agrees &= failMapTest(&map, bit) == truth[bit];
+    }
+
+    check(agrees, "a cell reads back different from what was set");
+    check(map.count == set && failMapPopcount(&map) == set, "count doesn't match the cells set");
+
+    // someone else's storage, like the checkpoint's - the count comes from what's in it
+    failMap attached;
+
+    failMapAttach(&attached, map.words, nbits);
+    check(attached.count == set && failMapTest(&attached, nbits - 1), "attached map lost its count or its last cell");
+
+    failMapFree(&map);
+    free(truth);
+
+    // room for 8 in the arena, 1000 addresses means it has to grow onto the heap on the way
+    arena mem;
+    flipMasks seen;
+
+    if (!check(arenaCreate(&mem, flipMasksBytes(8) + flipMasksBytes(16)) == 0 && flipMasksCreate(&seen, 8, &mem) == 0,
+        "seen masks wouldn't open")) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint8_t* slot = flipMasksSlot(&seen, i * 7919);
+
+        if (!check(slot != NULL && *slot == 0, "new address didn't come back empty")) {
+            break;
+        }
+
+        *slot = (uint8_t) (1 << (i % 8));
+    }
+
+    agrees = true;
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint8_t* slot = flipMasksSlot(&seen, i * 7919);
+
+        agrees &= slot != NULL && *slot == (uint8_t) (1 << (i % 8));
+    }
+
+    check(agrees, "reported bits lost while the table grew");
+    check(seen.used == 1000 && seen.owned, "table didn't end up with every address on the heap");
+
+    flipMasksFree(&seen);
+    arenaDestroy(&mem);
+}
+
+// same differences in the same order
+static bool sameDiffs(const byteDiff* a, int na, const byteDiff* b, int nb) {
+    if (na != nb) {
+        return false;
+    }
+
+    for (int k = 0; k < na; k++) {
+        if (a[k].offset != b[k].offset || a[k].diff != b[k].diff || a[k].data != b[k].data) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+The SSE2/NEON kernels skip clean data 64 bytes at a time and only look closer
+at what's left, so they have to come out the same as the byte at a time
+versions for every pattern, at every length and alignment, and when maxDiffs
+cuts them off partway through a block.
+*/
+static void testCompare(void) {
+    static uint8_t data[TEST_CHUNK + 64];
+    static byteDiff fast[TEST_CHUNK];
+    static byteDiff slow[TEST_CHUNK];
+    bool agrees = true;
+
+    printf("  compare kernel is %s\n", compareKernelName());
+    srand(5);
+
+    for (int type = PATTERN_FF; type <= PATTERN_PRNG && agrees; type++) {
+        testPattern pat = { .type = (patternType) type, .seed = 77 };
+
+        for (int trial = 0; trial < 400 && agrees; trial++) {
+            int skew = rand() % 64;
+            int len = trial < 130 ? trial : rand() % TEST_CHUNK + 1;
+            uint32_t addr = (uint32_t) (rand() % 65536);
+            uint8_t* block = data + skew;
+
+            patternFill(&pat, addr, block, len);
+
+            // a few flips, sometimes a burst, sometimes none at all
+            int flips = trial % 5 == 0 ? 0 : (trial % 7 == 0 ? len : rand() % 8 + 1);
+
+            for (int f = 0; f < flips && len > 0; f++) {
+                block[rand() % len] ^= (uint8_t) (1 << (rand() % 8));
+            }
+
+            int maxDiffs = trial % 3 == 0 ? 5 : TEST_CHUNK;
+            int nf = comparePattern(&pat, addr, block, len, fast, maxDiffs);
+            int ns = comparePatternScalar(&pat, addr, block, len, slow, maxDiffs);
+
+            agrees &= sameDiffs(fast, nf, slow, ns);
+
+            // flat patterns go through compareBlock too
+            if (type == PATTERN_FF || type == PATTERN_00) {
+                uint8_t expected = patternByte(&pat, addr);
+
+                nf = compareBlock(block, len, expected, fast, maxDiffs);
+                ns = compareBlockScalar(block, len, expected, slow, maxDiffs);
+                agrees &= sameDiffs(fast, nf, slow, ns);
+            }
+        }
+
+        if (!agrees) {
+            printf("  %s pattern differs from the scalar compare\n", patternName((patternType) type));
+        }
+    }
+
+    check(agrees, "vectorized compare doesn't match the scalar one");
+
+    // one flip right at the end of a 64 byte stride, and one in the tail past the last stride
+    testPattern ff = { .type = PATTERN_FF };
+
+    memset(data, 0xFF, 200);
+    data[63] = 0x7F;
+    data[199] = 0xFE;
+
+    int n = comparePattern(&ff, 0, data, 200, fast, TEST_CHUNK);
+
+    check(n == 2 && fast[0].offset == 63 && fast[0].diff == 0x80 && fast[1].offset == 199 && fast[1].diff == 0x01,
+        "flips at the edges of a stride missed");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// every record in a log, -1 if the header's wrong or a record is cut off
+static int readLog(const char* path, evlogRecord* recs, int max) {
+    FILE* in = fopen(path, "rb");
+    evlogHeader header;
+    int n = 0;
+
+    if (in == NULL) {
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || !evlogHeaderValid(&header)) {
+        fclose(in);
+
+        return -1;
+    }
+
+    while (n < max && fread(&recs[n], sizeof(evlogRecord), 1, in) == 1) {
+        n++;
+    }
+
+    // anything past the last whole record is a partial one
+    struct stat st;
+    bool clean = fstat(fileno(in), &st) == 0 && st.st_size == (off_t) (sizeof(header) + n * sizeof(evlogRecord));
+
+    fclose(in);
+
+    return clean ? n : -1;
+}
+
+/*
+Records have to come back exactly as appended, with batches committed as they
+fill rather than at close. A run that dies halfway through a write leaves a
+partial record on the end - the next open has to cut it off so everything
+after it still lines up, and a log from another board isn't appended to.
+A slice's failed and hot bits have to come back apart, so a hot read that
+worked doesn't look like one that failed.
+*/
+static void testEvlog(void) {
+    evlogConfig cfg = { .intervalMs = 0, .batchRecords = 4 };
+    evlogRecord sent[16];
+    evlogRecord got[32];
+    evlog* log = evlogOpen("events.bin", 7, &cfg);
+
+    if (!check(log != NULL, "new log wouldn't open")) {
+        return;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        sent[i] = (evlogRecord) { .ns = 1000000ULL * i + 7, .addr = (uint32_t) (i * 4099), .count = (uint32_t) i, .board = 7,
+            .kind = (uint8_t) (i == 0 ? EV_START : EV_FLIP), .bank = (uint8_t) (i & 1), .eeprom = (uint8_t) (i % 8),
+            .mask = (uint8_t) (1 << (i % 8)), .data = (uint8_t) ~(1 << (i % 8)), .pattern = PATTERN_FF };
+    }
+
+    for (int i = 0; i < 10; i++) {
+        evlogAppend(log, &sent[i]);
+    }
+
+    // two full batches are out, the last 2 are still buffered
+    check(readLog("events.bin", got, 32) == 8, "full batches weren't committed as they filled");
+
+    evlogClose(log);
+    check(readLog("events.bin", got, 32) == 10 && memcmp(got, sent, 10 * sizeof(evlogRecord)) == 0,
+        "records came back different");
+
+    // died mid write
+    FILE* file = fopen("events.bin", "ab");
+
+    fwrite(&sent[10], 11, 1, file);
+    fclose(file);
+    check(readLog("events.bin", got, 32) < 0, "torn record not there to clean up");
+
+    log = evlogOpen("events.bin", 7, &cfg);
+
+    if (!check(log != NULL, "log with a torn record wouldn't reopen")) {
+        return;
+    }
+
+    for (int i = 10; i < 16; i++) {
+        evlogAppend(log, &sent[i]);
+    }
+
+    evlogClose(log);
+    check(readLog("events.bin", got, 32) == 16 && memcmp(got, sent, sizeof(sent)) == 0, "records after the torn one don't line up");
+
+    log = evlogOpen("events.bin", 8, &cfg);
+    check(log == NULL, "another board's log was opened for appending");
+
+    if (log != NULL) {
+        evlogClose(log);
+    }
+
+    // every combination of failed and hot
+    log = evlogOpen("slices.bin", 7, &cfg);
+
+    if (!check(log != NULL, "slice log wouldn't open")) {
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        evlogRecord slice = { .kind = EV_SLICE, .board = 7, .addr = (uint32_t) (i * TEST_CHUNK), .count = TEST_CHUNK,
+            .mask = (uint8_t) ((i & 1 ? EV_SLICE_FAILED : 0) | (i & 2 ? EV_SLICE_HOT : 0)) };
+
+        evlogAppend(log, &slice);
+    }
+
+    evlogClose(log);
+
+    bool apart = readLog("slices.bin", got, 32) == 4;
+
+    for (int i = 0; apart && i < 4; i++) {
+        apart &= got[i].kind == EV_SLICE && ((got[i].mask & EV_SLICE_FAILED) != 0) == ((i & 1) != 0) &&
+            ((got[i].mask & EV_SLICE_HOT) != 0) == ((i & 2) != 0);
+    }
+
+    check(apart, "slice failed and hot bits didn't come back apart");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+A chip listed bigger than 2 address bytes reach used to get swept to its full
+size, so everything past 64K was the start of the chip again and one upset got
+logged 8 times over. The topology has to cut it down, and a sweep of what's left
+has to see the upset exactly once.
+*/
+static void testWrap(void) {
+    boardTopology topo;
+    FILE* file = fopen("topology.txt", "w");
+
+    topologyDefault(&topo);
+
+    for (int i = 0; i < topo.count; i++) {
+        check(topo.chips[i].size <= chipSpan(topo.chips[i].addrBytes), "built-in topology chip past its word address");
+    }
+
+    fprintf(file, "0 0x54 512K 128 2 1\n1 0x50 128K 128 3 1\n");
+    fclose(file);
+
+    if (!check(topologyLoad("topology.txt", &topo) == 0 && topo.count == 2, "topology file didn't load")) {
+        return;
+    }
+
+    check(topo.chips[0].size == 65536, "512K chip with 2 address bytes not cut to 64K");
+    check(topo.chips[1].size == 128000, "128K chip with 3 address bytes was cut");
+
+    const chipDesc* chip = &topo.chips[0];
+    i2cBus* bus = quietSim("sim");
+
+    if (!check(bus != NULL && simAddChip(bus, chip->bank, chip->devAddr, chip->size, chip->pageSize, chip->addrBytes) == 0,
+        "sim chip wouldn't open")) {
+        return;
+    }
+
+    // fresh sim chips are all 0xFF, which is the ff pattern
+    int flipAt = 11598;
+
+    check(simPoke("sim", chip->bank, chip->devAddr, flipAt, 0xF7), "couldn't flip a bit in the sim chip");
+
+    int handle = busSetup(bus, chip->devAddr);
+    uint8_t buf[TEST_CHUNK];
+    int mismatches = 0;
+    int firstAt = -1;
+
+    busSelectBank(bus, chip->bank);
+
+    for (int start = 0; start < chip->size; start += TEST_CHUNK) {
+        int len = chip->size - start < TEST_CHUNK ? chip->size - start : TEST_CHUNK;
+
+        if (!check(busReadBlock(bus, handle, chip->devAddr, chip->addrBytes, start, buf, len) == 0, "sweep read failed")) {
+            break;
+        }
+
+        for (int k = 0; k < len; k++) {
+            if (buf[k] != 0xFF) {
+                firstAt = firstAt < 0 ? start + k : firstAt;
+                mismatches++;
+            }
+        }
+    }
+
+    check(mismatches == 1, "one upset didn't show up exactly once in a sweep");
+    check(firstAt == flipAt, "upset showed up at the wrong address");
+
+    busDestroy(bus);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// a board's EEPROM structs for topo out of its own arena, the way setupBoard lays them out
+static allEEPROMs* testBoard(const boardTopology* topo) {
+    arena mem;
+
+    if (arenaCreate(&mem, arenaRound(sizeof(allEEPROMs)) + arenaRound(topo->count * sizeof(EEPROM)) + 64 * 1024) != 0) {
+        return NULL;
+    }
+
+    allEEPROMs* population = (allEEPROMs*) arenaAlloc(&mem, sizeof(*population));
+
+    population->mem = mem;
+    population->count = topo->count;
+    population->all = (EEPROM*) arenaAlloc(&population->mem, topo->count * sizeof(EEPROM));
+
+    for (int i = 0; i < topo->count; i++) {
+        population->all[i].size = topo->chips[i].size;
+        population->all[i].bank = topo->chips[i].bank;
+        population->all[i].devAddr = topo->chips[i].devAddr;
+        population->all[i].addrBytes = topo->chips[i].addrBytes;
+    }
+
+    return population;
+}
+
+static void freeBoard(allEEPROMs* population) {
+    for (int i = 0; i < population->count; i++) {
+        flipMasksFree(&population->all[i].seen);
+    }
+
+    arenaDestroy(&population->mem);
+}
+
+/*
+A run that dies has to come back with the same failure map, counters, sweep
+position and reported bits, so bits flipped before the crash aren't reported
+twice and the ones in a byte that hasn't had anything reported still are.
+Anything that doesn't match the layout, or finished cleanly, isn't resumed.
+*/
+static void testCheckpoint(void) {
+    boardTopology topo = { .count = 2 };
+    ckptLayout layout = { .board = 3, .topo = &topo, .patternType = PATTERN_CHECKER, .patternSeed = 9 };
+    bool resumed;
+
+    topo.chips[0] = (chipDesc) { .bank = 0, .devAddr = 0x50, .size = 4096, .pageSize = 32, .addrBytes = 2, .busNum = 1 };
+    topo.chips[1] = (chipDesc) { .bank = 0, .devAddr = 0x54, .size = 65536, .pageSize = 128, .addrBytes = 2, .busNum = 1 };
+
+    allEEPROMs* before = testBoard(&topo);
+    checkpoint* ckpt = ckptOpen("state.bin", &layout, false, &resumed);
+
+    if (!check(before != NULL && ckpt != NULL && !resumed, "new checkpoint didn't open empty")) {
+        return;
+    }
+
+    // what a run leaves behind: 3 failed bytes on chip 1, the last one failed right before the crash with nothing reported yet
+    EEPROM* current = &before->all[1];
+
+    for (int i = 0; i < topo.count; i++) {
+        failMapAttach(&before->all[i].mems, ckptMap(ckpt, i), topo.chips[i].size);
+    }
+
+    failMapTestAndSet(&current->mems, 100);
+    failMapTestAndSet(&current->mems, 65535);
+    failMapTestAndSet(&current->mems, 300);
+    ckptSeen(ckpt, 1)[100] = 0x01;
+    ckptSeen(ckpt, 1)[65535] = 0x81;
+    current->failures = 3;
+    current->multiBit = 1;
+    current->misreads = 4;
+    current->bitFlips[0][0] = 2;
+    current->bitFlips[7][1] = 1;
+
+    for (int i = 0; i < topo.count; i++) {
+        ckptSaveChip(ckpt, i, &before->all[i]);
+    }
+
+    ckptSetCursor(ckpt, 1, 8192);
+    ckptInitDone(ckpt);
+    ckptClose(ckpt, false);
+    freeBoard(before);
+
+    allEEPROMs* after = testBoard(&topo);
+
+    ckpt = ckptOpen("state.bin", &layout, false, &resumed);
+
+    if (!check(after != NULL && ckpt != NULL && resumed, "unfinished checkpoint wasn't resumed")) {
+        return;
+    }
+
+    ckptRestore(ckpt, after);
+    current = &after->all[1];
+
+    check(current->mems.count == 3 && current->failures == 3, "failure map came back with a different count");
+    check(failMapTest(&current->mems, 100) && failMapTest(&current->mems, 65535) && failMapTest(&current->mems, 300),
+        "failed addresses missing after restore");
+    check(current->multiBit == 1 && current->misreads == 4 && current->bitFlips[0][0] == 2 && current->bitFlips[7][1] == 1,
+        "counters came back different");
+    check(ckpt->chips[1].cursor == 8192, "sweep position lost");
+    check(*flipMasksSlot(&current->seen, 100) == 0x01 && *flipMasksSlot(&current->seen, 65535) == 0x81,
+        "reported bits lost, they'd be logged again");
+    check(*flipMasksSlot(&current->seen, 300) == 0, "a byte with nothing reported came back with bits marked");
+    check(after->all[0].mems.count == 0 && after->all[0].pattern.seed == 9, "untouched chip came back wrong");
+
+    ckptClose(ckpt, true);
+    freeBoard(after);
+
+    // finished cleanly -> starts over
+    ckpt = ckptOpen("state.bin", &layout, false, &resumed);
+
+    if (check(ckpt != NULL && !resumed, "finished checkpoint was resumed")) {
+        failMap map;
+
+        failMapAttach(&map, ckptMap(ckpt, 1), 65536);
+        check(map.count == 0 && ckptSeen(ckpt, 1)[100] == 0, "started over with the old failures still in it");
+        ckptInitDone(ckpt);
+        ckptClose(ckpt, false);
+    }
+
+    // unfinished but a chip's a different size -> refused
+    topo.chips[1].size = 32768;
+    ckpt = ckptOpen("state.bin", &layout, false, &resumed);
+    check(ckpt == NULL, "checkpoint resumed under a different topology");
+    ckptClose(ckpt, false);
+}
+
+/*
+Same roll over from the probe's side: a chip that doesn't wrap anywhere under
+what its address bytes reach, but is described as bigger, has to come back
+sized to the reach and not to the description. One that does wrap comes back
+at the wrap.
+*/
+static void testProbeWrap(void) {
+    boardTopology topo = { .count = 2 };
+    i2cBus* bus = quietSim("sim");
+
+    topo.chips[0] = (chipDesc) { .bank = 0, .devAddr = 0x54, .size = 512000, .pageSize = 128, .addrBytes = 2, .busNum = 1 };
+    topo.chips[1] = (chipDesc) { .bank = 0, .devAddr = 0x55, .size = 65536, .pageSize = 128, .addrBytes = 2, .busNum = 1 };
+
+    allEEPROMs* population = testBoard(&topo);
+
+    if (!check(bus != NULL && population != NULL && simAddChip(bus, 0, 0x54, 512000, 128, 2) == 0 &&
+        simAddChip(bus, 0, 0x55, 32768, 128, 2) == 0, "sim board wouldn't open")) {
+        return;
+    }
+
+    probeResult results[2];
+
+    population->buses[0] = bus;
+    population->busNum[0] = 1;
+    population->numBuses = 1;
+    probeBoard(population, results);
+
+    check(results[0].status == PROBE_OK && results[0].size == 65536, "512K chip on 2 address bytes not sized to 64K");
+    check(results[1].status == PROBE_OK && results[1].size == 32768, "chip that wraps at 32K not sized to it");
+
+    busDestroy(bus);
+    freeBoard(population);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+A file in any order, with comments, K sizes and the optional revisit time has
+to come back sorted by bank and address, with every chip cut down to what its
+address bytes reach. One that doesn't make sense is refused whole.
+*/
+static void testTopology(void) {
+    boardTopology topo;
+    FILE* file = fopen("topology.txt", "w");
+
+    fprintf(file, "# bank addr size page addrbytes bus [revisit]\n"
+        "1 0x52 2K 16 1 3     # 1 address byte only reaches 256\n"
+        "\n"
+        "0 0x54 512K 128 2 1 5000\n"
+        "0 0x50 4K 32 2 1\n"
+        "1 0x51 0x8000 64 2 3\n"
+        "0 0x57 2000K 256 3 1\n");
+    fclose(file);
+
+    if (!check(topologyLoad("topology.txt", &topo) == 0 && topo.count == 5, "topology file didn't load")) {
+        return;
+    }
+
+    const int want[5][5] = {
+        // bank, addr, size, bus, revisit
+        { 0, 0x50, 4000, 1, 0 },
+        { 0, 0x54, 65536, 1, 5000 },
+        { 0, 0x57, 2000000, 1, 0 },
+        { 1, 0x51, 32768, 3, 0 },
+        { 1, 0x52, 256, 3, 0 },
+    };
+    bool same = true;
+
+    for (int i = 0; i < 5; i++) {
+        const chipDesc* chip = &topo.chips[i];
+
+        same &= chip->bank == want[i][0] && chip->devAddr == want[i][1] && chip->size == want[i][2] &&
+            chip->busNum == want[i][3] && chip->revisitMs == want[i][4];
+    }
+
+    check(same, "chips came back unsorted, sized wrong or with the wrong bus or revisit");
+    check(topologyFind(&topo, 1, 0x52) == 4 && topologyFind(&topo, 2, 0x50) == -1, "topologyFind got the wrong chip");
+
+    const char* bad[] = {
+        "0 0x50 4K 32 2 1\n0 0x50 4K 32 2 1\n",   // two chips at one address
+        "0 0x50 4K 32 2 1\n0 0x51 4K 32 2 3\n",   // a bank on two buses
+        "0 0x50 4Q 32 2 1\n",                      // size
+        "0 0x50 4K 32 4 1\n",                      // address bytes
+        "0 0x50 4K 32 2\n",                        // no bus
+        "4 0x50 4K 32 2 1\n",                      // bank
+    };
+
+    for (int i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i++) {
+        file = fopen("bad.txt", "w");
+        fputs(bad[i], file);
+        fclose(file);
+
+        if (!check(topologyLoad("bad.txt", &topo) != 0, "a topology that doesn't make sense loaded")) {
+            printf("  %s", bad[i]);
+        }
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+#define MS 1000000ULL
+
+/*
+Earliest deadline first: the chip handed out always has the soonest deadline
+(bar the bank slack), and with bus time to spare every chip gets swept in
+proportion to its revisit target. When the bus can't keep up the small chips
+still make their target and the big ones take longer. A chip picks its sweep
+up at the checkpoint's cursor, and one that can't be scanned isn't added.
+*/
+static void testSchedule(void) {
+    static scanSched sched;
+    static scanRegion regions[3][16];
+
+    memset(regions, 0, sizeof(regions));
+    schedInit(&sched, 0, 0);
+
+    check(schedAdd(&sched, 0, 0, 0x50, 2, 4096, 0, 100, regions[0], 0) == 0 &&
+        schedAdd(&sched, 1, 0, 0x54, 2, 65536, 8192, 1000, regions[1], 0) == 0 &&
+        schedAdd(&sched, 2, 0, 0x55, 2, 16384, 0, 500, regions[2], 0) == 0, "chips wouldn't go in the schedule");
+    check(schedAdd(&sched, 3, 0, 0x56, 2, 0, 0, 100, NULL, 0) < 0 && schedAdd(&sched, 3, 0, 0x56, 2, 4096, 0, 0, NULL, 0) < 0,
+        "chip with no size or no revisit time went in");
+    check(sched.count == 3 && sched.chips[1].cursor == 8192, "schedule didn't pick the sweep up at the cursor");
+
+    // 1 ms a slice, way more bus than they need
+    uint64_t now = 0;
+    int sweeps[3] = { 0 };
+    bool earliest = true;
+
+    for (int i = 0; i < 60000; i++) {
+        schedChip* next = schedNext(&sched, 0);
+
+        for (int c = 0; c < sched.count; c++) {
+            earliest &= next->dueNs <= sched.chips[c].dueNs;
+        }
+
+        int len = next->size - next->cursor < TEST_CHUNK ? next->size - next->cursor : TEST_CHUNK;
+
+        now += MS;
+        schedRead(next, next->cursor, len, now);
+        sweeps[next->chip] += schedAdvance(next, len, now);
+    }
+
+    check(earliest, "a chip was handed out ahead of one with an earlier deadline");
+
+    // sweeps in the ratio of the targets: 100 ms, 1000 ms and 500 ms -> 10 : 1 : 2
+    check(abs(sweeps[0] - 10 * sweeps[1]) <= 20 && abs(sweeps[2] - 2 * sweeps[1]) <= 4,
+        "spare bus time wasn't shared out by revisit target");
+
+    // 25 ms a slice: the 4K part needs a quarter of the bus and the 64K part all of it
+    uint64_t lastSweep[2] = { 0 };
+    uint64_t worst[2] = { 0 };
+
+    schedInit(&sched, 0, 0);
+    schedAdd(&sched, 0, 0, 0x50, 2, 4096, 0, 100, NULL, 0);
+    schedAdd(&sched, 1, 0, 0x54, 2, 65536, 0, 400, NULL, 0);
+    now = 0;
+
+    for (int i = 0; i < 4000; i++) {
+        schedChip* next = schedNext(&sched, 0);
+        int len = next->size - next->cursor < TEST_CHUNK ? next->size - next->cursor : TEST_CHUNK;
+
+        now += 25 * MS;
+
+        // the first few seconds are the deadlines settling in behind real time
+        if (schedAdvance(next, len, now) && now > 5000 * MS && now - lastSweep[next->chip] > worst[next->chip]) {
+            worst[next->chip] = now - lastSweep[next->chip];
+        }
+
+        if (next->cursor == 0) {
+            lastSweep[next->chip] = now;
+        }
+    }
+
+    check(worst[0] > 0 && worst[0] <= 125 * MS, "small chip fell off its target on a bus that can't keep up");
+    check(worst[1] > 400 * MS, "big chip made its target on a bus that can't do it");
+
+    // stay on the bank the mux is on if that's due within the slack, not if it's further off
+    schedInit(&sched, 0, 0);
+    schedAdd(&sched, 0, 0, 0x50, 2, 4096, 0, 100, NULL, 100 * MS);
+    schedAdd(&sched, 1, 1, 0x50, 2, 4096, 0, 100, NULL, 100 * MS - SCHED_BANK_SLACK_MS * MS / 2);
+    check(schedNext(&sched, 0)->bank == 0, "switched banks for a slice due within the slack");
+    sched.chips[1].dueNs = 100 * MS - 2 * SCHED_BANK_SLACK_MS * MS;
+    check(schedNext(&sched, 0)->bank == 1, "stayed on the bank while another's slice was well overdue");
+}
+
+/*
+Hot regions get extra reads out of a bucket that fills at hotShare of real
+time. With the sweeps behind, an empty bucket means no hot reads, and however
+much they'd like the hot reads can't take more than the share of the bus. With
+the sweeps ahead they're free. A region that cools off drops out.
+*/
+static void testHotRegions(void) {
+    static scanSched sched;
+    static scanRegion regions[16];
+    schedChip* entry;
+    int region;
+
+    memset(regions, 0, sizeof(regions));
+    schedInit(&sched, 0.25, 0);
+
+    // 64K in 100 ms at 30 ms a slice never keeps up, so the sweep's always behind
+    schedAdd(&sched, 0, 0, 0x50, 2, 65536, 0, 100, regions, 0);
+    check(!schedNextHot(&sched, 1000 * MS, &entry, &region), "hot read handed out with nothing hot");
+
+    schedHeat(&sched, 0, 3, 1000 * MS);
+    schedHeat(&sched, 0, 3, 1000 * MS);
+    check(sched.numHot == 1 && regions[3].flips == 2, "two flips in one region didn't make it one hot region");
+
+    // a second's worth of budget is a quarter second, one long read empties it
+    check(schedNextHot(&sched, 2000 * MS, &entry, &region) && region == 3 && sched.charge, "hot region not read when due");
+    schedRead(entry, region * REGION_BYTES, REGION_BYTES, 2000 * MS);
+    schedHotDone(&sched, 300 * MS);
+    check(sched.budgetNs <= 0 && !schedNextHot(&sched, 2100 * MS, &entry, &region), "hot read handed out with the budget spent");
+
+    // left to it for a minute it'd read the region every 50 ms for 30 ms - 60% of the bus
+    uint64_t now = 2100 * MS;
+    uint64_t start = now;
+
+    sched.hotNs = 0;
+
+    while (now < start + 60000 * MS) {
+        if (schedNextHot(&sched, now, &entry, &region)) {
+            now += 30 * MS;
+            schedRead(entry, region * REGION_BYTES, REGION_BYTES, now);
+            schedHotDone(&sched, 30 * MS);
+        } else {
+            schedChip* next = schedNext(&sched, 0);
+            int len = next->size - next->cursor < TEST_CHUNK ? next->size - next->cursor : TEST_CHUNK;
+
+            now += 30 * MS;
+            schedRead(next, next->cursor, len, now);
+            schedAdvance(next, len, now);
+        }
+    }
+
+    double share = (double) sched.hotNs / (now - start);
+
+    check(share > 0.2 && share <= 0.25 + 0.25 / 60 + 0.001, "hot reads didn't get (only) their share of the bus");
+
+    // sweeps way ahead: hot reads don't cost anything, even with the bucket empty
+    memset(regions, 0, sizeof(regions));
+    schedInit(&sched, 0.25, 0);
+    schedAdd(&sched, 0, 0, 0x50, 2, 4096, 0, 1000, regions, 0);
+    schedAdvance(&sched.chips[0], 4096, 500 * MS);
+
+    for (int i = 0; i < 3; i++) {
+        schedHeat(&sched, 0, 0, 500 * MS);
+    }
+
+    sched.budgetNs = -1e9;
+    check(schedNextHot(&sched, 500 * MS, &entry, &region) && !sched.charge, "hot read charged while the sweeps were ahead");
+
+    // heat halves every minute, ten minutes later it's cold and gone
+    check(!schedNextHot(&sched, 600500 * MS, &entry, &region) && sched.numHot == 0, "cooled off region still hot");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// the one snapshot file in the working directory that isn't skip, NULL if there isn't exactly one
+static char* snapFile(const char* skip) {
+    glob_t found;
+    char* path = NULL;
+    int matches = 0;
+
+    if (glob("board 3 snapshot *.snap", 0, NULL, &found) != 0) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < found.gl_pathc; i++) {
+        if (skip == NULL || strcmp(found.gl_pathv[i], skip) != 0) {
+            free(path);
+            path = strdup(found.gl_pathv[i]);
+            matches++;
+        }
+    }
+
+    globfree(&found);
+
+    if (matches != 1) {
+        free(path);
+
+        return NULL;
+    }
+
+    return path;
+}
+
+/*
+What the log thread encodes has to be what snapdiff decodes: runs of flipped
+bytes longer than an op can hold, gaps and unread stretches long enough to need
+a LEB128 length, a chip that isn't scanned staying out of the file, and a
+capture the run died in the middle of coming back as unread past where it got.
+*/
+static void testSnapshot(void) {
+    boardTopology topo = { .count = 3 };
+
+    topo.chips[0] = (chipDesc) { .bank = 0, .devAddr = 0x50, .size = 4096, .pageSize = 32, .addrBytes = 2, .busNum = 1 };
+    topo.chips[1] = (chipDesc) { .bank = 0, .devAddr = 0x54, .size = 65536, .pageSize = 128, .addrBytes = 2, .busNum = 1 };
+    topo.chips[2] = (chipDesc) { .bank = 1, .devAddr = 0x50, .size = 4096, .pageSize = 32, .addrBytes = 2, .busNum = 1 };
+
+    allEEPROMs* population = testBoard(&topo);
+    uint8_t* storage = (uint8_t*) malloc(snapWriterBytes(topo.count));
+
+    if (!check(population != NULL && storage != NULL, "out of memory")) {
+        free(storage);
+
+        return;
+    }
+
+    // chip 2 didn't answer the probe, so it never gets a map and never gets swept
+    population->board = 3;
+
+    for (int i = 0; i < 2; i++) {
+        failMapCreate(&population->all[i].mems, topo.chips[i].size);
+        population->all[i].pattern.type = PATTERN_CHECKER;
+        population->all[i].pattern.seed = 9 + i;
+    }
+
+    static uint8_t expectXor[4096];
+    static uint8_t expectUnread[4096];
+    snapWriter w;
+
+    memset(expectXor, 0, sizeof(expectXor));
+    memset(expectUnread, 0, sizeof(expectUnread));
+    snapWriterInit(&w, population, storage);
+    check(w.expected == 2, "writer expects the wrong number of chips");
+
+    snapBegin(&w, 0, 1, 1000);
+    snapBegin(&w, 1, 1, 1500);
+
+    // two separate bytes, then 100 in a row (more than one literal), then 2800 clean and 200 unread
+    expectXor[5] = 0x10;
+    expectXor[7] = 0x20;
+
+    for (int addr = 100; addr < 200; addr++) {
+        expectXor[addr] = (uint8_t) (addr | 1);
+    }
+
+    memset(expectUnread + 3000, 1, 200);
+    expectXor[4000] = 0x80;
+
+    for (int addr = 0; addr < 4096; addr++) {
+        if (expectUnread[addr]) {
+            snapUnread(&w, 0, addr, 200);
+            addr += 199;
+        } else if (expectXor[addr] != 0) {
+            snapXor(&w, 0, addr, expectXor[addr]);
+        }
+    }
+
+    snapXor(&w, 1, 40000, 0x01);
+    snapFinish(&w, 0, true, 2000);
+    snapFinish(&w, 1, true, 2500);
+    check(w.out == NULL, "file still open after every chip finished");
+
+    char* first = snapFile(NULL);
+    snapImage img;
+
+    if (check(first != NULL && snapLoad(first, &img) == 0, "snapshot didn't load back")) {
+        snapImageChip* chip = img.chips[0];
+
+        check(img.header.board == 3 && img.header.seq == 1, "header came back different");
+        check(img.chips[2] == NULL, "chip that isn't scanned is in the file");
+
+        if (check(chip != NULL && img.chips[1] != NULL, "scanned chip missing from the file")) {
+            check(chip->info.size == 4096 && chip->info.patternSeed == 9 && chip->info.pattern == PATTERN_CHECKER && chip->info.ns == 1000,
+                "chip info came back different");
+            check(memcmp(chip->xor, expectXor, sizeof(expectXor)) == 0, "flipped bytes came back different");
+            check(memcmp(chip->unread, expectUnread, sizeof(expectUnread)) == 0, "unread bytes came back different");
+            check(chip->ended && !chip->end.complete && chip->end.unread == 200 && chip->end.ns == 2000,
+                "end of a sweep with unread bytes came back wrong");
+
+            chip = img.chips[1];
+
+            bool clean = true;
+
+            for (int addr = 0; addr < 65536; addr++) {
+                clean &= chip->xor[addr] == (addr == 40000 ? 0x01 : 0) && chip->unread[addr] == 0;
+            }
+
+            check(clean, "64K chip with one flip came back different");
+            check(chip->ended && chip->end.complete && chip->end.unread == 0, "complete sweep not marked complete");
+        }
+
+        snapFree(&img);
+    }
+
+    // the run stops mid capture, then the last few bytes of the file never make it to disk
+    snapBegin(&w, 0, 2, 3000);
+    snapXor(&w, 0, 10, 0x04);
+    snapClose(&w, 3500);
+
+    char* second = first != NULL ? snapFile(first) : NULL;
+    FILE* file = second != NULL ? fopen(second, "r+") : NULL;
+
+    if (check(file != NULL, "second snapshot wasn't written")) {
+        fseek(file, 0, SEEK_END);
+        check(ftruncate(fileno(file), ftell(file) - 4) == 0, "couldn't cut the file short");
+        fclose(file);
+
+        if (check(snapLoad(second, &img) == 0 && img.chips[0] != NULL, "cut short snapshot didn't load")) {
+            snapImageChip* chip = img.chips[0];
+
+            check(img.header.seq == 2 && img.chips[1] == NULL, "cut short snapshot has the wrong chips");
+            check(!chip->ended && chip->xor[10] == 0x04, "what got written before the cut is missing");
+            check(chip->unread[9] == 0 && chip->unread[11] == 1 && chip->unread[4095] == 1, "past the cut isn't unread");
+            snapFree(&img);
+        }
+    }
+
+    free(first);
+    free(second);
+    free(storage);
+
+    for (int i = 0; i < 2; i++) {
+        failMapFree(&population->all[i].mems);
+    }
+
+    freeBoard(population);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static const testCase cases[] = {
+    { "failmap", testFailMap },
+    { "compare", testCompare },
+    { "evlog", testEvlog },
+    { "topology", testTopology },
+    { "schedule", testSchedule },
+    { "hot-regions", testHotRegions },
+    { "wrap", testWrap },
+    { "probe-wrap", testProbeWrap },
+    { "checkpoint", testCheckpoint },
+    { "snapshot", testSnapshot },
+};
+
+static int removeEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void) st;
+    (void) flag;
+    (void) ftw;
+
+    return remove(path);
+}
+
+int main(int argc, char** argv) {
+    const char* only = NULL;
+    bool keep = false;
+    int failed = 0;
+    int ran = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keep") == 0) {
+            keep = true;
+        } else if (only == NULL && argv[i][0] != '-') {
+            only = argv[i];
+        } else {
+            printf("Usage: %s [--keep] [CASE]\n", argv[0]);
+
+            return -1;
+        }
+    }
+
+    char home[4096];
+
+    if (getcwd(home, sizeof(home)) == NULL) {
+        return -1;
+    }
+
+    for (int c = 0; c < (int) (sizeof(cases) / sizeof(cases[0])); c++) {
+        char dir[] = "/tmp/radtests.XXXXXX";
+
+        if (only != NULL && strstr(cases[c].name, only) == NULL) {
+            continue;
+        }
+
+        if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+            printf("Failed to make a scratch directory\n");
+
+            return -1;
+        }
+
+        currentCase = cases[c].name;
+        caseFailures = 0;
+        cases[c].run();
+
+        printf("%-12s %s\n", cases[c].name, caseFailures == 0 ? "ok" : "FAILED");
+        failed += caseFailures > 0;
+        ran++;
+
+        if (chdir(home) != 0) {
+            return -1;
+        }
+
+        if (keep) {
+            printf("  scratch files left in %s\n", dir);
+        } else {
+            nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+    }
+
+    printf("%d of %d cases passed\n", ran - failed, ran);
+
+    return failed;
+}
@@ -0,0 +1,225 @@
+/*
+
+Board Topology for EEPROM Control
+
+Every line is checked as it's read so a typo in the file stops the run before
+anything gets written to the chips, instead of showing up as a chip that
+never answers.
+
+*/
+
+// Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+#include "bus.h"
+
+// Longest line we bother with
+#define TOPO_LINE 256
+
+// The board the code was written for. The old test programs had bank 2 as
+// 4K x4 too, but NUM_BANKS was 2 so it was never scanned - fit it and add it here.
+static const char* defaultTopology =
+    "0 0x50 4K   32  2 1\n"
+    "0 0x51 4K   32  2 1\n"
+    "0 0x52 4K   32  2 1\n"
+    "0 0x53 4K   32  2 1\n"
+    "0 0x54 512K 128 2 1\n"
+    "0 0x55 512K 128 2 1\n"
+    "0 0x56 512K 128 2 1\n"
+    "0 0x57 512K 128 2 1\n"
+    "1 0x50 32K  64  2 1\n"
+    "1 0x51 32K  64  2 1\n"
+    "1 0x52 32K  64  2 1\n"
+    "1 0x53 32K  64  2 1\n"
+    "1 0x54 128K 128 2 1\n"
+    "1 0x55 128K 128 2 1\n"
+    "1 0x56 128K 128 2 1\n"
+    "1 0x57 128K 128 2 1\n";
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// bytes, with an optional K (x1000)
+static bool parseSize(const char* text, int* size) {
+    char* end;
+    long value = strtol(text, &end, 0);
+
+    if (*end == 'K' || *end == 'k') {
+        value *= 1000;
+        end++;
+    }
+
+    *size = (int) value;
+
+    return *end == '\0' && value > 0 && value <= 0x7FFFFFFF;
+}
+
+/*
+One line of the file -> chip. Returns 1 for a chip, 0 for a blank/comment
+line and -1 if it's wrong (printed).
+*/
+static int parseLine(char* line, int lineNum, chipDesc* chip) {
+    char* hash = strchr(line, '#');
+
+    if (hash != NULL) {
+        *hash = '\0';
+    }
+
+    char size[32];
+    int fields = sscanf(line, "%d %i %31s %d %d %d %d", &chip->bank, &chip->devAddr, size, &chip->pageSize,
+        &chip->addrBytes, &chip->busNum, &chip->revisitMs);
+
+    if (fields <= 0) {
+        return 0;
+    }
+
+    if (fields < 6) {
+        printf("Topology line %d: want bank, address, size, page size, address bytes and bus\n", lineNum);
+
+        return -1;
+    }
+
+    if (fields == 6) {
+        chip->revisitMs = 0;
+    }
+
+    if (chip->bank < 0 || chip->bank >= TOPO_MAX_BANKS) {
+        printf("Topology line %d: bank has to be 0 to %d\n", lineNum, TOPO_MAX_BANKS - 1);
+    } else if (chip->devAddr < 0x03 || chip->devAddr > 0x77) {
+        printf("Topology line %d: 0x%02x isn't a usable I2C address\n", lineNum, chip->devAddr);
+    } else if (!parseSize(size, &chip->size)) {
+        printf("Topology line %d: bad size %s\n", lineNum, size);
+    } else if (chip->pageSize <= 0 || chip->pageSize > BUS_MAX_PAGE) {
+        printf("Topology line %d: page size has to be 1 to %d\n", lineNum, BUS_MAX_PAGE);
+    } else if (chip->addrBytes < 1 || chip->addrBytes > 3) {
+        printf("Topology line %d: address bytes has to be 1 to 3\n", lineNum);
+    } else if (chip->busNum < 0 || chip->revisitMs < 0) {
+        printf("Topology line %d: bad bus or revisit time\n", lineNum);
+    } else {
+        return 1;
+    }
+
+    return -1;
+}
+
+static int compareChips(const void* a, const void* b) {
+    const chipDesc* x = (const chipDesc*) a;
+    const chipDesc* y = (const chipDesc*) b;
+
+    return x->bank != y->bank ? x->bank - y->bank : x->devAddr - y->devAddr;
+}
+
+/*
+Sort, then make sure no two chips fight over an address and every bank is on
+one bus. Chips bigger than their word address reaches get cut down to what it
+does reach (and it gets said), so nothing past the roll over gets swept.
+*/
+static int topologyCheck(boardTopology* topo) {
+    qsort(topo->chips, topo->count, sizeof(chipDesc), compareChips);
+
+    for (int i = 0; i < topo->count; i++) {
+        chipDesc* chip = &topo->chips[i];
+        long span = chipSpan(chip->addrBytes);
+
+        if (chip->size > span) {
+            printf("Topology has 0x%02x in bank %d at %d bytes, but %d address bytes only reach %ld - scanning those\n",
+                chip->devAddr, chip->bank, chip->size, chip->addrBytes, span);
+            chip->size = (int) span;
+        }
+    }
+
+    for (int i = 1; i < topo->count; i++) {
+        chipDesc* prev = &topo->chips[i - 1];
+        chipDesc* chip = &topo->chips[i];
+
+        if (chip->bank != prev->bank) {
+            continue;
+        }
+
+        if (chip->devAddr == prev->devAddr) {
+            printf("Topology has two chips at 0x%02x in bank %d\n", chip->devAddr, chip->bank);
+
+            return -1;
+        }
+
+        if (chip->busNum != prev->busNum) {
+            printf("Topology has bank %d on more than one bus\n", chip->bank);
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+int topologyLoad(const char* path, boardTopology* topo) {
+    FILE* in = fopen(path, "r");
+
+    if (in == NULL) {
+        printf("Failed to open %s\n", path);
+
+        return -1;
+    }
+
+    char line[TOPO_LINE];
+    int lineNum = 0;
+    int result = 0;
+
+    topo->count = 0;
+
+    while (result == 0 && fgets(line, sizeof(line), in) != NULL) {
+        chipDesc chip;
+        int parsed = parseLine(line, ++lineNum, &chip);
+
+        if (parsed < 0) {
+            result = -1;
+        } else if (parsed > 0 && topo->count == TOPO_MAX_CHIPS) {
+            printf("Topology has more than %d chips\n", TOPO_MAX_CHIPS);
+            result = -1;
+        } else if (parsed > 0) {
+            topo->chips[topo->count++] = chip;
+        }
+    }
+
+    fclose(in);
+
+    return result == 0 ? topologyCheck(topo) : -1;
+}
+
+void topologyDefault(boardTopology* topo) {
+    char line[TOPO_LINE];
+    const char* next = defaultTopology;
+
+    topo->count = 0;
+
+    while (*next != '\0') {
+        const char* end = strchr(next, '\n');
+        int len = (int) (end - next);
+
+        memcpy(line, next, len);
+        line[len] = '\0';
+
+        if (parseLine(line, topo->count + 1, &topo->chips[topo->count]) > 0) {
+            topo->count++;
+        }
+
+        next = end + 1;
+    }
+
+    topologyCheck(topo);
+}
+
+int topologyFind(const boardTopology* topo, int bank, int devAddr) {
+    for (int i = 0; i < topo->count; i++) {
+        if (topo->chips[i].bank == bank && topo->chips[i].devAddr == devAddr) {
+            return i;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,66 @@
+/*
+
+Board Topology for EEPROM Control
+
+What's on the board - which bus, mux bank and address every chip sits at, how
+big it is and how it wants to be talked to. This used to be the switch in
+getEEPROMSize() plus the NUM_BANKS / EEPROMS_PER_BANK macros, so every board
+revision meant editing code and recompiling. Now it's a text file
+(--topology FILE) read once at startup, one line per chip:
+
+    # bank  addr  size  page  addr bytes  bus  [revisit ms]
+    0       0x50  4K    32    2           1
+    1       0x54  128K  128   2           1    5000
+
+K means x1000 like the old table did. Chips that aren't fitted just aren't
+listed. Without --topology the built-in table for the original board is used.
+
+A chip listed bigger than its address bytes reach (64K for 2) only has that
+much of it scanned: past it the word address rolls over and every read would
+just be the start of the chip again, counted under another address.
+
+*/
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Most chips a board can have
+#define TOPO_MAX_CHIPS 64
+
+// Mux positions (the real mux has 3, the sim takes 4)
+#define TOPO_MAX_BANKS 4
+
+typedef struct {
+    int bank;             // mux position
+    int devAddr;          // 7 bit I2C address
+    int size;             // bytes
+    int pageSize;         // page write size
+    int addrBytes;        // word address bytes sent before every read
+    int busNum;           // the N in /dev/i2c-N
+    int revisitMs;        // target sweep time, 0 = whatever the command line says
+} chipDesc;
+
+// Sorted by bank then address, so a chip's index doesn't depend on how the file was written
+typedef struct {
+    chipDesc chips[TOPO_MAX_CHIPS];
+    int count;
+} boardTopology;
+
+// Bytes a word address of addrBytes reaches
+static inline long chipSpan(int addrBytes) {
+    return 1L << (8 * addrBytes);
+}
+
+// Read a topology file. -1 (and says which line) if anything in it doesn't make sense
+int topologyLoad(const char* path, boardTopology* topo);
+
+// The original board
+void topologyDefault(boardTopology* topo);
+
+// Index of the chip at bank/devAddr, -1 if there isn't one
+int topologyFind(const boardTopology* topo, int bank, int devAddr);
+
+#endif